@@ -5,30 +5,25 @@
 #include <ios>
 #include <iostream>
 #include <sstream>
+#include <string_view>
 #include <vector>
 
 #include "lib/code_generation.hpp"
-#include "lib/parser.hpp"
-#include "lib/tokenizer.hpp"
+#include "vm/lib/symbols.hpp"
 
 int main(int argc, char **argv) {
-  if (argc != 3) {
-    std::cerr << "Argc should be 3:\n\tassemble <INPUT_FILE> <OUTPUT_FILE>\n";
+  const bool with_symbols =
+      argc == 5 && std::string_view(argv[3]) == "--symbols";
+  if (argc != 3 && !with_symbols) {
+    std::cerr << "Usage:\n\tassemble <INPUT_FILE> <OUTPUT_FILE> "
+                 "[--symbols <SYMBOL_FILE>]\n";
     exit(EXIT_FAILURE);
   }
 
-  auto [tokens, t_success] = tokenize(argv[1]);
-  if (!t_success) {
-    return EXIT_FAILURE;
-  }
-
-  auto [ast, p_success] = parse(tokens.begin(), tokens.end());
-  if (!p_success) {
-    return EXIT_FAILURE;
-  }
-
-  auto [code, cg_success] = generate(ast);
-  if (!cg_success) {
+  // Tokens, syntax tree and code in one pass
+  SynacorVM::symbol_table symbols;
+  auto [code, success] = assemble(argv[1], with_symbols ? &symbols : nullptr);
+  if (!success) {
     return EXIT_FAILURE;
   }
 
@@ -43,5 +38,14 @@ int main(int argc, char **argv) {
     return EXIT_FAILURE;
   }
 
+  if (with_symbols) {
+    std::ofstream out(argv[4]);
+    symbols.save(out);
+    if (!out) {
+      std::cerr << "Failed to write symbol file" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
   return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -4,54 +4,141 @@
 #include <array>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <filesystem>
 #include <format>
-#include <map>
+#include <iostream>
+#include <optional>
 #include <ostream>
-#include <sstream>
 #include <stack>
 #include <stdexcept>
-#include <streambuf>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
 
 #include "assembler/lib/grammar.hpp"
 #include "assembler/lib/parser.hpp"
+#include "assembler/lib/tokenizer.hpp"
+#include "vm/lib/memory.hpp"
+#include "vm/lib/symbols.hpp"
 
 struct reference {
+  // Words to patch once the tag is declared, where it is used before
   std::vector<std::size_t> locations{};
-  std::array<std::byte, 2> value = {};
+  std::uint16_t address = 0;
 
   // Error-message helpers
-  Node const *declaration = nullptr;
-  Node const *first_usage = nullptr;
+  std::optional<Token> declaration{};
+  std::optional<Token> first_usage{};
 };
 
+// tag_table interns the names of tags, and finds their references by open
+// addressing with linear probing. It is kept at most half full. Tags are
+// kept in the order they first appear in.
+class tag_table {
+ public:
+  struct tag {
+    std::size_t name_offset;  // In names
+    std::size_t name_size;
+    std::uint64_t hash;
+    reference ref;
+  };
+
+  // Reference of the tag, added if it is new. It is only valid until the
+  // next tag is added.
+  reference &operator[](std::string_view name);
+
+  std::string_view name(tag const &t) const {
+    return std::string_view(names).substr(t.name_offset, t.name_size);
+  }
+
+  std::vector<tag> const &all() const noexcept { return tags; }
+
+ private:
+  static constexpr std::uint32_t empty = 0xffffffff;
+
+  // FNV-1a
+  static std::uint64_t hash(std::string_view name) {
+    std::uint64_t h = 0xcbf29ce484222325;
+    for (const char ch : name) {
+      h = (h ^ static_cast<unsigned char>(ch)) * 0x100000001b3;
+    }
+    return h;
+  }
+
+  // Slot of the tag, or the empty slot where it goes
+  std::size_t find(std::string_view name, std::uint64_t h) const;
+  void rehash(std::size_t size);
+
+  std::string names{};
+  std::vector<tag> tags{};
+  std::vector<std::uint32_t> slots = std::vector<std::uint32_t>(64, empty);
+};
+
+// generator emits the code of the terminals of a program, in order, to a
+// buffer reserved up front, at most for a full image. Tags that are already
+// declared are written at once, and the others are patched in when their
+// declaration comes.
 struct generator {
-  std::map<std::string, reference> references{};
+  tag_table tags{};
 
-  std::basic_stringstream<std::byte> os = {};
+  bytestr code{};
   std::size_t write_ptr = 0;
 
-  void process_nonterminal(std::stack<Node const *> &stack, Node const *curr);
-  void generate_literal(Node const *terminal);
+  // Source map: where the first word of every line comes from, only kept
+  // for the symbol table
+  bool source_map = true;
+  bool line_start = true;
+  std::vector<std::string> files{};
+  std::vector<SynacorVM::symbol_table::location> locations{};
+
+  void emit(Token const &token);
+
+  // Reserves room for this many words. Past the size of an image, the
+  // buffer grows as needed instead.
+  void reserve(std::size_t words) {
+    code.reserve(
+        2 * std::min<std::size_t>(words, SynacorVM::Memory::heap_size));
+  }
+
+  void process_nonterminal(SyntaxTree const &tree,
+                           std::stack<Node const *> &stack, Node const *curr);
+  void generate_literal(Token const &token);
+  void write(std::uint16_t word);
+
+  void process_tag_declaration(Token const &token);
+  void process_reference(Token const &token);
+  void process_endline(Token const &token);
 
-  void process_tag_declaration(Node const *n);
-  void process_reference(Node const *n);
-  void process_endline(Node const *n);
+  void locate(Token const &token);
+  SynacorVM::symbol_table symbols() const;
 };
 
-// The first pass traverses the AST depth-first and generates all the code,
-// except where tag references exist. The locations of these references are
-// stored and a place-holder value is written. The tag declarations and their
-// values are also stored.
-generator generate_without_references(Node const &root);
+// The first pass traverses the AST depth-first and generates all the code.
+// References to tags not yet declared are written as a place-holder value,
+// and their locations are stored until the declaration.
+void generate_without_references(SyntaxTree const &tree, generator &g);
 
-// The second pass replaces all reference placeholders with their values.
-bytestr replace_references(generator &);
+// The second pass checks that every tag that is used is declared, and
+// returns the code.
+bytestr check_references(generator &);
 
-std::pair<bytestr, bool> generate(Node const &root) {
+// Both passes, with the errors reported on std::cerr
+template <typename FirstPass>
+std::pair<bytestr, bool> run_passes(FirstPass first_pass,
+                                    SynacorVM::symbol_table *symbols) {
   try {
-    auto g = generate_without_references(root);
-    auto s = replace_references(g);
+    generator g{};
+    g.source_map = symbols != nullptr;
+    if (!first_pass(g)) {
+      return {{}, false};
+    }
+    auto s = check_references(g);
+    if (symbols != nullptr) {
+      *symbols = g.symbols();
+    }
     return {s, true};
   } catch (std::runtime_error &e) {
     std::cerr << e.what() << std::endl;
@@ -62,14 +149,67 @@ std::pair<bytestr, bool> generate(Node const &root) {
   }
 }
 
+std::pair<bytestr, bool> generate(SyntaxTree const &tree,
+                                  SynacorVM::symbol_table *symbols) {
+  return run_passes(
+      [&tree](generator &g) {
+        generate_without_references(tree, g);
+        return true;
+      },
+      symbols);
+}
+
+std::pair<bytestr, bool> assemble(std::string file_name,
+                                  SynacorVM::symbol_table *symbols) {
+  return run_passes(
+      [&file_name](generator &g) {
+        bool tokenized_ok = true;
+        std::string parse_error;
+        const auto emit = [&g](Token const &token) { g.emit(token); };
+        MatchStack<decltype(emit)> stack{.sink = emit};
+
+        // Every word comes from at least one byte of the source
+        std::error_code ec;
+        const auto size = std::filesystem::file_size(file_name, ec);
+        g.reserve(ec ? 0 : size);
+
+        // Tokenization errors are all reported, and a parsing error only if
+        // there are none, as when tokenizing first. Past the first error,
+        // the rest of the source is only tokenized.
+        const auto ok = tokenize(std::move(file_name), [&](Token const &token) {
+          if (token.symbol == Symbol::ERROR) {
+            tokenized_ok = false;
+          }
+          if (!tokenized_ok || !parse_error.empty()) {
+            return true;
+          }
+          bool parsed = parse_token(stack, token, false);
+          if (parsed && token.symbol == Symbol::END && !stack.empty()) {
+            parsed = parse_token(stack, token, false);
+          }
+          if (!parsed) {
+            parse_error = parsing_error(token);
+          }
+          return true;
+        });
+        if (tokenized_ok && !parse_error.empty()) {
+          std::cerr << parse_error;
+        }
+        return ok && tokenized_ok && parse_error.empty();
+      },
+      symbols);
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
 
-generator generate_without_references(Node const &root) {
-  generator g{};
+void generate_without_references(SyntaxTree const &tree, generator &g) {
   std::stack<Node const *> stack = {};
 
-  stack.push(&root);
+  // At most one word per node, but for string literals
+  g.reserve(tree.nodes.size());
+
+  stack.push(&tree.root());
 
   while (true) {
     if (stack.empty()) {
@@ -85,116 +225,197 @@ generator generate_without_references(Node const &root) {
 
     switch (curr->token.symbol) {
       case Symbol::END:
-        return g;
-      case Symbol::EOL:
-        g.process_endline(curr);
-        break;
-      case Symbol::TAG_DECL:
-        g.process_tag_declaration(curr);
-        break;
-      case Symbol::TAG_REF:
-        g.process_reference(curr);
-        break;
-      case Symbol::NUMBER_LITERAL:
-      case Symbol::CHARACTER_LITERAL:
-      case Symbol::STRING_LITERAL:
-      case Symbol::REGISTER:
-      case Symbol::VERB:
-        g.generate_literal(curr);
-        break;
+        return;
       CASE_NONTERMINAL:
-        g.process_nonterminal(stack, curr);
+        g.process_nonterminal(tree, stack, curr);
+        break;
+      default:
+        g.emit(curr->token);
         break;
-      CASE_ERRONEOUS:
-        throw std::runtime_error(
-            std::format("AST contains error token {}", curr->token.fmt()));
     }
   }
 }
 
-#pragma GCC diagnostic pop
+void generator::emit(Token const &token) {
+  switch (token.symbol) {
+    case Symbol::END:
+      break;
+    case Symbol::EOL:
+      process_endline(token);
+      break;
+    case Symbol::TAG_DECL:
+      process_tag_declaration(token);
+      break;
+    case Symbol::TAG_REF:
+      process_reference(token);
+      break;
+    case Symbol::NUMBER_LITERAL:
+    case Symbol::CHARACTER_LITERAL:
+    case Symbol::STRING_LITERAL:
+    case Symbol::REGISTER:
+    case Symbol::VERB:
+      generate_literal(token);
+      break;
+    CASE_NONTERMINAL:
+    CASE_ERRONEOUS:
+      throw std::runtime_error(
+          std::format("AST contains error token {}", token.fmt()));
+  }
+}
 
-bytestr replace_references(generator &g) {
-  bytestr s = std::move(g.os).str();
-  g.os = {};
+#pragma GCC diagnostic pop
 
-  for (auto &kv : g.references) {
-    std::string_view name = kv.first;
-    reference const &ref = kv.second;
-    if (ref.declaration == nullptr) {
+bytestr check_references(generator &g) {
+  for (auto const &t : g.tags.all()) {
+    const auto name = g.tags.name(t);
+    reference const &ref = t.ref;
+    if (!ref.declaration.has_value()) {
       throw std::runtime_error(
           std::format("{}: code generation error: reference {} is undefined.",
-                      ref.first_usage->token.location(), name));
+                      ref.first_usage->location(), name));
     }
 
-    if (ref.locations.empty()) {
+    if (!ref.first_usage.has_value()) {
       std::cerr << std::format("{}: Warning. Reference {} is unused.",
-                               ref.declaration->token.location(), name)
+                               ref.declaration->location(), name)
                 << std::endl;
     }
+  }
+
+  return std::move(g.code);
+}
+
+reference &tag_table::operator[](std::string_view name) {
+  const auto h = hash(name);
+  auto i = find(name, h);
+  if (slots[i] != empty) {
+    return tags[slots[i]].ref;
+  }
 
-    for (const std::size_t loc : ref.locations) {
-      // loc is multiplied by two because loc is the 16-bit
-      // address, but bytestr uses 8-bit addressing.
-      s[loc] = ref.value[0];
-      s[loc + 1] = ref.value[1];
+  if (2 * (tags.size() + 1) > slots.size()) {
+    rehash(2 * slots.size());
+    i = find(name, h);
+  }
+  slots[i] = static_cast<std::uint32_t>(tags.size());
+  tags.push_back({names.size(), name.size(), h, {}});
+  names.append(name);
+  return tags.back().ref;
+}
+
+std::size_t tag_table::find(std::string_view name, std::uint64_t h) const {
+  const auto mask = slots.size() - 1;
+  for (auto i = h & mask;; i = (i + 1) & mask) {
+    if (slots[i] == empty) {
+      return i;
+    }
+    auto const &t = tags[slots[i]];
+    if (t.hash == h && this->name(t) == name) {
+      return i;
     }
   }
+}
 
-  return s;
+void tag_table::rehash(std::size_t size) {
+  slots.assign(size, empty);
+  const auto mask = size - 1;
+  for (std::size_t k = 0; k < tags.size(); ++k) {
+    auto i = tags[k].hash & mask;
+    while (slots[i] != empty) {
+      i = (i + 1) & mask;
+    }
+    slots[i] = static_cast<std::uint32_t>(k);
+  }
 }
 
-void generator::process_nonterminal(std::stack<Node const *> &stack,
+void generator::process_nonterminal(SyntaxTree const &tree,
+                                    std::stack<Node const *> &stack,
                                     Node const *curr) {
-  std::for_each(curr->children.crbegin(), curr->children.crend(),
-                [&stack](auto const &child) { stack.push(child.get()); });
+  const auto children = tree.children(*curr);
+  std::for_each(children.rbegin(), children.rend(),
+                [&stack](Node const &child) { stack.push(&child); });
 }
 
-void generator::generate_literal(Node const *terminal) {
-  std::ranges::copy(terminal->token.data,
-                    std::ostream_iterator<std::byte, std::byte>(os));
+void generator::generate_literal(Token const &token) {
+  locate(token);
 
-  // Ensuring alignment
-  std::size_t len = terminal->token.data.size();
-  if (len % 2 != 0) {
-    os << std::byte(0);
-    ++len;
+  if (token.symbol != Symbol::STRING_LITERAL) {
+    write(token.value);
+    return;
   }
 
-  write_ptr += len / 2;
+  // One word per character
+  token.unescape([this](char c) { write(static_cast<unsigned char>(c)); });
 }
 
-void generator::process_tag_declaration(Node const *n) {
-  assert(n->token.symbol == Symbol::TAG_DECL);
+void generator::write(std::uint16_t word) {
+  const std::byte bytes[] = {std::byte(word & 0xff), std::byte(word >> 8)};
+  code.append(bytes, 2);
+  ++write_ptr;
+}
+
+void generator::process_tag_declaration(Token const &token) {
+  assert(token.symbol == Symbol::TAG_DECL);
 
-  std::string name = n->token.as_str();
-  auto &ref = references[name];
+  auto &ref = tags[token.text];
 
-  if (ref.declaration != nullptr) {
+  if (ref.declaration.has_value()) {
     throw std::runtime_error(std::format(
         "{}: Reference {} declared twice\n  Previous declaration: {}",
-        n->token.fmt(), name, ref.declaration->token.fmt()));
+        token.fmt(), token.text, ref.declaration->fmt()));
   }
 
-  ref.declaration = n;
+  ref.declaration = token;
+  ref.address = static_cast<std::uint16_t>(write_ptr);
 
-  const auto idx = write_ptr;
-  const auto lo = std::byte(idx & 0xff);
-  const auto hi = std::byte((idx >> 8) & 0xff);
-  ref.value = {lo, hi};
+  for (const std::size_t loc : ref.locations) {
+    code[2 * loc] = std::byte(ref.address & 0xff);
+    code[2 * loc + 1] = std::byte(ref.address >> 8);
+  }
+  ref.locations = {};
 }
 
-void generator::process_reference(Node const *n) {
-  assert(n->token.symbol == Symbol::TAG_REF);
-  auto &ref = references[n->token.as_str()];
-  if (ref.first_usage == nullptr) {
-    ref.first_usage = n;
+void generator::process_reference(Token const &token) {
+  assert(token.symbol == Symbol::TAG_REF);
+  locate(token);
+  auto &ref = tags[token.text];
+  if (!ref.first_usage.has_value()) {
+    ref.first_usage = token;
   }
-  ref.locations.push_back(write_ptr * 2);
 
-  // Placeholder value
-  os << std::byte(0xff) << std::byte(0xff);
-  ++write_ptr;
+  if (ref.declaration.has_value()) {
+    write(ref.address);
+    return;
+  }
+
+  // Placeholder value, patched once the tag is declared
+  ref.locations.push_back(write_ptr);
+  write(0xffff);
+}
+
+void generator::process_endline(Token const &) { line_start = true; }
+
+void generator::locate(Token const &token) {
+  if (!source_map || !line_start) {
+    return;
+  }
+  line_start = false;
+
+  const auto file = token.file();
+  auto it = std::ranges::find(files, file);
+  if (it == files.end()) {
+    it = files.insert(it, std::string(file));
+  }
+  locations.push_back({SynacorVM::Word(write_ptr),
+                       std::uint32_t(it - files.begin()), token.row(),
+                       token.col()});
 }
 
-void generator::process_endline(Node const *) {}
+SynacorVM::symbol_table generator::symbols() const {
+  std::vector<SynacorVM::symbol_table::symbol> named;
+  named.reserve(tags.all().size());
+  for (auto const &t : tags.all()) {
+    named.push_back(
+        {SynacorVM::Word(t.ref.address), std::string(tags.name(t))});
+  }
+  return SynacorVM::symbol_table(std::move(named), files, locations);
+}
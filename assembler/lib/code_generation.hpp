@@ -1,9 +1,22 @@
 #include <memory>
 #include <ostream>
+#include <string>
+#include <utility>
 
 #include "grammar.hpp"
 #include "parser.hpp"
+#include "vm/lib/symbols.hpp"
 
 using bytestr = std::basic_string<std::byte>;
 
-std::pair<bytestr, bool> generate(Node const& root);
\ No newline at end of file
+// generate returns the code of the AST, and a success flag. With `symbols`,
+// it also fills in the address of every tag and the source map of the code.
+std::pair<bytestr, bool> generate(SyntaxTree const& tree,
+                                  SynacorVM::symbol_table* symbols = nullptr);
+
+// assemble returns the code of the file, and a success flag, like generate
+// after tokenize and parse. It streams instead: every token is parsed and
+// its code written as soon as it is read, and neither the tokens nor the
+// tree are kept.
+std::pair<bytestr, bool> assemble(std::string file_name,
+                                  SynacorVM::symbol_table* symbols = nullptr);
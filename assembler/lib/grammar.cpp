@@ -1,11 +1,56 @@
 #include "grammar.hpp"
 
 #include <cassert>
+#include <deque>
 #include <format>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <vector>
+
+#include "vm/lib/mapped_file.hpp"
+
+namespace source_files {
+
+namespace {
+
+struct file {
+  std::string name;
+  std::unique_ptr<SynacorVM::mapped_file> contents;
+};
+
+// Id 0 is the file of the tokens made by the parser
+std::vector<file> files(1);
+std::deque<std::string> kept;
+
+}  // namespace
+
+std::uint16_t open(std::string const& file_name) {
+  if (files.size() > 0xffff) {
+    throw std::runtime_error("too many source files");
+  }
+  files.push_back(
+      {file_name, std::make_unique<SynacorVM::mapped_file>(file_name)});
+  return std::uint16_t(files.size() - 1);
+}
+
+std::string_view name(std::uint16_t id) { return files.at(id).name; }
+
+std::string_view text(std::uint16_t id) {
+  auto const& f = files.at(id);
+  if (f.contents == nullptr) {
+    return {};
+  }
+  const auto bytes = f.contents->bytes();
+  return {reinterpret_cast<char const*>(bytes.data()), bytes.size()};
+}
+
+std::string_view keep(std::string s) { return kept.emplace_back(std::move(s)); }
+
+}  // namespace source_files
 
 std::string Token::location() const {
-  return std::format("{}:{}:{}", m_file, m_row, m_col);
+  return std::format("{}:{}:{}", file(), m_row, m_col);
 }
 
 std::string Token::fmt() const {
@@ -37,7 +82,7 @@ std::string Token::fmt() const {
     case Symbol::EOL:
       return "<EOL>";
     case Symbol::REGISTER:
-      return std::format("<REGISTER {}>", data.empty() ? -1 : int(data[0]));
+      return std::format("<REGISTER {}>", int(value & 0x7fff));
     case Symbol::TAG_DECL:
       return std::format("<TAG_DECL {}>", as_str());
     case Symbol::TAG_REF:
@@ -58,27 +103,17 @@ std::string Token::fmt() const {
 }
 
 std::string Token::as_str() const {
-  std::string out;
-  out.reserve(data.size() / 2 + 1);
-  for (std::size_t i = 0; i < data.size(); i += 2) {
-    out.push_back(static_cast<char>(data[i]));
+  if (symbol != Symbol::STRING_LITERAL) {
+    return std::string(text);
   }
 
+  std::string out;
+  out.reserve(text.size());
+  unescape([&out](char ch) { out.push_back(ch); });
   return out;
 }
 
-unsigned Token::as_number() const {
-  unsigned n = 0;
-
-  if (data.size() != 0) {
-    n = static_cast<unsigned>(data[0]);
-  }
-  if (data.size() != 1) {
-    n |= static_cast<unsigned>(data[1]) << 8;
-  }
-
-  return n;
-}
+unsigned Token::as_number() const { return value; }
 
 Verb Token::as_opcode() const {
   assert(symbol == Symbol::VERB);
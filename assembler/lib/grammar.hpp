@@ -1,10 +1,17 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <tuple>
+#include <type_traits>
 #include <vector>
 
 #include "arch/arch.hpp"
+#include "ll1.hpp"
 
 // Check out $root/docs/assembly/assembly.md#grammar
 enum class Symbol : int {
@@ -40,40 +47,117 @@ enum class Symbol : int {
   ERROR,               // Erroneous input
 };
 
+// Text that tokens point into: the files being assembled, and the messages
+// of tokenization errors. It is kept until the program exits, so that tokens
+// own nothing and can be copied freely.
+namespace source_files {
+
+// Maps the file and returns its id. Throws if it cannot be read.
+std::uint16_t open(std::string const& file_name);
+
+std::string_view name(std::uint16_t id);
+std::string_view text(std::uint16_t id);
+
+// Keeps a string that tokens can view, such as an error message
+std::string_view keep(std::string s);
+
+}  // namespace source_files
+
+// Escaped character of string and character literals: \n, \", ...
+constexpr std::optional<char> escape(char ch) {
+  switch (ch) {
+    case '0':
+      return 0;
+    case 'n':
+      return '\n';
+    case 't':
+      return '\t';
+    case 'v':
+      return '\v';
+    case 'b':
+      return '\b';
+    case 'r':
+      return '\r';
+    case 'f':
+      return '\f';
+    case 'a':
+      return '\a';
+    case '\\':
+      return '\\';
+    case '\'':
+      return '\'';
+    case '"':
+      return '\"';
+  }
+
+  return {};
+}
+
+// Token is a small trivially-copyable view of a terminal or a non-terminal.
+// Numbers, characters, registers and verbs keep their value; identifiers
+// view their name and string literals view the text between their quotes in
+// the source, which is only unescaped when needed.
 struct Token {
-  constexpr Token(Symbol symbol = Symbol::NONE,
-                  std::vector<std::byte> data = {})
-      : symbol{symbol}, data{data} {}
+  constexpr Token(Symbol symbol = Symbol::NONE, std::uint16_t value = 0,
+                  std::string_view text = {})
+      : symbol{symbol}, value{value}, text{text} {}
 
-  void set_location(std::string_view file, unsigned row,
-                    unsigned col) noexcept {
+  void set_location(std::uint16_t file, unsigned row, unsigned col) noexcept {
     this->m_file = file;
     this->m_row = row;
     this->m_col = col;
   }
 
   constexpr bool operator==(Token other) const noexcept {
-    return symbol == other.symbol && data == other.data;
+    return symbol == other.symbol && value == other.value &&
+           text == other.text;
   }
 
   std::string as_str() const;
   std::string fmt() const;
   std::string location() const;
 
+  // Calls f with every character of a string literal, unescaped as the
+  // tokenizer read it: a character is only known once the next one shows
+  // it is not escaped.
+  template <typename F>
+  void unescape(F&& f) const {
+    char prev_char = {};
+    for (std::size_t i = 0; i < text.size(); ++i) {
+      if (prev_char == '\\') {
+        prev_char = escape(text[i]).value_or(0);
+        continue;
+      }
+      if (i != 0) {
+        f(prev_char);
+      }
+      prev_char = text[i];
+    }
+    if (!text.empty()) {
+      f(prev_char);
+    }
+  }
+
+  std::string_view file() const { return source_files::name(m_file); }
+  unsigned row() const noexcept { return m_row; }
+  unsigned col() const noexcept { return m_col; }
+
   Verb as_opcode() const;
   unsigned as_number() const;
   char as_char() const;
-  wchar_t as_wchar() const;
 
   Symbol symbol;
-  std::vector<std::byte> data = {};
+  std::uint16_t value = 0;
+  std::string_view text = {};
 
  private:
-  std::string m_file;
-  unsigned m_row;
-  unsigned m_col;
+  std::uint16_t m_file = 0;
+  unsigned m_row = 0;
+  unsigned m_col = 0;
 };
 
+static_assert(std::is_trivially_copyable_v<Token>);
+
 #define CASE_ERRONEOUS             \
   case Symbol::NONE:               \
   case Symbol::UNKNOWN_IDENTIFIER: \
@@ -98,3 +182,137 @@ struct Token {
   case Symbol::TAG_REF:           \
   case Symbol::VERB:              \
   case Symbol::EOL
+
+// The grammar of $root/docs/assembly/assembly.md, as data. The parser runs
+// on the LL(1) table computed from it at compile time. Every verb is a
+// terminal of its own, so that each instruction has its own production.
+namespace assembly_grammar {
+
+using ll1::rule;
+using ll1::symbol;
+
+// Terminals: the verbs, `halt` to `noop`, then the other tokens
+constexpr symbol verbs = ERROR;
+constexpr symbol x = verbs;      // NUMBER_LITERAL
+constexpr symbol c = verbs + 1;  // CHARACTER_LITERAL
+constexpr symbol s = verbs + 2;  // STRING_LITERAL
+constexpr symbol r = verbs + 3;  // REGISTER
+constexpr symbol t = verbs + 4;  // TAG_DECL
+constexpr symbol a = verbs + 5;  // TAG_REF
+constexpr symbol n = verbs + 6;  // EOL
+constexpr symbol end = verbs + 7;
+constexpr symbol terminals = verbs + 8;
+
+// Non-terminals, in the order of Symbol
+constexpr symbol S = terminals;
+constexpr symbol P = terminals + 1;
+constexpr symbol T = terminals + 2;
+constexpr symbol I = terminals + 3;
+constexpr symbol D = terminals + 4;
+constexpr symbol W = terminals + 5;
+constexpr symbol R = terminals + 6;
+constexpr symbol nonterminals = 7;
+
+constexpr symbol none = 0xff;
+
+// Where two productions apply, the first one listed wins: an empty line is
+// P → nP rather than P → DnP with an empty D.
+constexpr auto productions = std::array{
+    rule(S, {P, end}),
+
+    rule(P, {n, P}),
+    rule(P, {T, n, P}),
+    rule(P, {I, n, P}),
+    rule(P, {D, n, P}),
+    rule(P, {end}),
+
+    rule(T, {t}),
+
+    rule(I, {HALT}),
+    rule(I, {SET, R, W}),
+    rule(I, {PUSH, W}),
+    rule(I, {POP, R}),
+    rule(I, {EQ, R, W, W}),
+    rule(I, {GT, R, W, W}),
+    rule(I, {JMP, W}),
+    rule(I, {JT, W, W}),
+    rule(I, {JF, W, W}),
+    rule(I, {ADD, R, W, W}),
+    rule(I, {MULT, R, W, W}),
+    rule(I, {MOD, R, W, W}),
+    rule(I, {AND, R, W, W}),
+    rule(I, {OR, R, W, W}),
+    rule(I, {NOT, R, W}),
+    rule(I, {RMEM, R, W}),
+    rule(I, {WMEM, W, W}),
+    rule(I, {CALL, W}),
+    rule(I, {RET}),
+    rule(I, {OUT, W}),
+    rule(I, {IN, R}),
+    rule(I, {NOOP}),
+
+    rule(D, {x, D}),
+    rule(D, {c, D}),
+    rule(D, {s, D}),
+    rule(D, {r, D}),
+    rule(D, {a, D}),
+    rule(D, {}),
+
+    rule(W, {x}),
+    rule(W, {c}),
+    rule(W, {r}),
+    rule(W, {a}),
+
+    rule(R, {r}),
+};
+
+constexpr auto table = ll1::build<terminals, nonterminals>(productions);
+static_assert(table.conflicts == 1, "only empty lines are ambiguous");
+
+// Grammar symbol of a token, or `none` if it is erroneous
+constexpr symbol symbol_of(Token const& token) {
+  switch (token.symbol) {
+    case Symbol::VERB:
+      return token.value < verbs ? symbol(token.value) : none;
+    case Symbol::NUMBER_LITERAL:
+      return x;
+    case Symbol::CHARACTER_LITERAL:
+      return c;
+    case Symbol::STRING_LITERAL:
+      return s;
+    case Symbol::REGISTER:
+      return r;
+    case Symbol::TAG_DECL:
+      return t;
+    case Symbol::TAG_REF:
+      return a;
+    case Symbol::EOL:
+      return n;
+    case Symbol::END:
+      return end;
+    CASE_NONTERMINAL:
+      return symbol(S + (int(token.symbol) - int(Symbol::Start)));
+    CASE_ERRONEOUS:
+      return none;
+  }
+  return none;
+}
+
+// Token of a node of the syntax tree, before it is matched to the input
+constexpr Token token_of(symbol g) {
+  if (g < verbs) {
+    return {Symbol::VERB, g};
+  }
+  if (g < terminals) {
+    constexpr std::array others = {
+        Symbol::NUMBER_LITERAL, Symbol::CHARACTER_LITERAL,
+        Symbol::STRING_LITERAL, Symbol::REGISTER,
+        Symbol::TAG_DECL,       Symbol::TAG_REF,
+        Symbol::EOL,            Symbol::END,
+    };
+    return others[g - verbs];
+  }
+  return static_cast<Symbol>(int(Symbol::Start) + (g - S));
+}
+
+}  // namespace assembly_grammar
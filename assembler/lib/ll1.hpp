@@ -0,0 +1,123 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+
+// Compile-time construction of LL(1) parse tables. A grammar is an array of
+// productions over numbered symbols: the terminals come first, and the
+// non-terminals follow.
+namespace ll1 {
+
+using symbol = std::uint8_t;
+
+// A set of terminals, with ε as its highest bit
+using terminal_set = std::uint64_t;
+constexpr terminal_set epsilon = terminal_set(1) << 63;
+
+constexpr std::uint8_t no_production = 0xff;
+
+struct production {
+  symbol lhs;
+  std::uint8_t size = 0;
+  std::array<symbol, 4> rhs = {};
+};
+
+constexpr production rule(symbol lhs, std::initializer_list<symbol> rhs) {
+  production p{.lhs = lhs};
+  for (const auto s : rhs) {
+    p.rhs[p.size++] = s;
+  }
+  return p;
+}
+
+template <std::size_t terminals, std::size_t nonterminals>
+struct table {
+  static_assert(terminals < 63, "terminal sets are 64-bit");
+
+  std::array<terminal_set, nonterminals> first = {};
+  std::array<terminal_set, nonterminals> follow = {};
+
+  // Index of the production to apply to a non-terminal for each lookahead
+  std::array<std::array<std::uint8_t, terminals>, nonterminals> parse = {};
+
+  // Entries where more than one production applies. The production listed
+  // first in the grammar is kept.
+  unsigned conflicts = 0;
+
+  static constexpr bool is_terminal(symbol s) { return s < terminals; }
+};
+
+// Computes the FIRST and FOLLOW sets of the non-terminals to a fixed point,
+// and then the parse table.
+template <std::size_t terminals, std::size_t nonterminals, std::size_t n>
+constexpr auto build(std::array<production, n> const& grammar) {
+  static_assert(n < no_production);
+  table<terminals, nonterminals> t;
+
+  // FIRST of the right-hand side of p, from its i-th symbol on
+  const auto first_of = [&](production const& p, std::size_t i) {
+    terminal_set s = epsilon;
+    for (; i < p.size && (s & epsilon) != 0; ++i) {
+      s &= ~epsilon;
+      const auto x = p.rhs[i];
+      s |= t.is_terminal(x) ? terminal_set(1) << x : t.first[x - terminals];
+    }
+    return s;
+  };
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (auto const& p : grammar) {
+      auto& first = t.first[p.lhs - terminals];
+      const auto before = first;
+      first |= first_of(p, 0);
+      changed |= first != before;
+    }
+  }
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (auto const& p : grammar) {
+      for (std::size_t i = 0; i < p.size; ++i) {
+        if (t.is_terminal(p.rhs[i])) {
+          continue;
+        }
+        auto& follow = t.follow[p.rhs[i] - terminals];
+        const auto before = follow;
+        const auto rest = first_of(p, i + 1);
+        follow |= rest & ~epsilon;
+        if ((rest & epsilon) != 0) {
+          follow |= t.follow[p.lhs - terminals];
+        }
+        changed |= follow != before;
+      }
+    }
+  }
+
+  for (auto& row : t.parse) {
+    row.fill(no_production);
+  }
+  for (std::size_t k = 0; k < n; ++k) {
+    auto const& p = grammar[k];
+    auto lookahead = first_of(p, 0);
+    if ((lookahead & epsilon) != 0) {
+      lookahead = (lookahead & ~epsilon) | t.follow[p.lhs - terminals];
+    }
+    for (std::size_t a = 0; a < terminals; ++a) {
+      if ((lookahead >> a & 1) == 0) {
+        continue;
+      }
+      auto& entry = t.parse[p.lhs - terminals][a];
+      if (entry != no_production) {
+        ++t.conflicts;
+        continue;
+      }
+      entry = std::uint8_t(k);
+    }
+  }
+  return t;
+}
+
+}  // namespace ll1
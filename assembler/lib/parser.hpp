@@ -1,23 +1,73 @@
 #pragma once
 
-#include <algorithm>
+#include <cstdint>
 #include <format>
 #include <iostream>
 #include <iterator>
-#include <memory>
-#include <stack>
+#include <span>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "grammar.hpp"
+#include "ll1.hpp"
 
 struct Node {
   Token token;
-  std::vector<std::unique_ptr<Node>> children = {};
 
-  friend std::ostream& operator<<(std::ostream& os, Node const& n);
+  // The children of a node are consecutive in the tree
+  std::uint32_t first_child = 0;
+  std::uint32_t child_count = 0;
+};
+
+// SyntaxTree is the Abstract Syntax Tree, as one array of nodes: the root
+// comes first, and the children of every node follow each other, in the
+// order their production rule was applied. Nodes are freed all at once.
+struct SyntaxTree {
+  std::vector<Node> nodes = {};
+
+  Node const& root() const { return nodes.front(); }
+
+  std::span<Node const> children(Node const& n) const {
+    return std::span(nodes).subspan(n.first_child, n.child_count);
+  }
+
+  friend std::ostream& operator<<(std::ostream& os, SyntaxTree const& tree);
+};
+
+// Symbols still to be matched, as indices of nodes of the tree
+struct ParseStack {
+  SyntaxTree& tree;
+  std::vector<std::uint32_t> symbols = {};
+
+  Node& top() { return tree.nodes[symbols.back()]; }
+
+  bool empty() const { return symbols.empty(); }
+
+  ll1::symbol top_symbol() { return assembly_grammar::symbol_of(top().token); }
+
+  void match(Token const& input) {
+    top().token = input;
+    symbols.pop_back();
+  }
+};
+
+// Symbols still to be matched, without a tree: every terminal goes to the
+// sink as soon as it is matched, in the order of the program. Lines are
+// right-recursive, so the stack never grows deeper than one line.
+template <typename Sink>
+struct MatchStack {
+  Sink sink;
+  std::vector<ll1::symbol> symbols = {assembly_grammar::S};
+
+  bool empty() const { return symbols.empty(); }
 
- private:
-  std::ostream& fmt(std::ostream& os, unsigned depth) const;
+  ll1::symbol top_symbol() const { return symbols.back(); }
+
+  void match(Token const& input) {
+    symbols.pop_back();
+    sink(input);
+  }
 };
 
 template <typename T>
@@ -26,63 +76,77 @@ concept TokenForwardIterator = requires(T t) {
                                  { std::next(t) } -> std::same_as<T>;
                                };
 
-[[nodiscard]] bool production_rule(std::stack<Node*>& stack,
-                                   Token const& input);
+void cout_stack(ParseStack const& stack, Token const& input);
 
-void cout_stack(std::stack<Node*> stack, Token const& input);
+template <typename Sink>
+void cout_stack(MatchStack<Sink> const&, Token const&) {}
 
-template <typename Iterable = std::initializer_list<Token>>
-void apply_production_rule(std::stack<Node*>& stack, Iterable replace) {
-  auto* top = stack.top();
-  stack.pop();
+// Replaces the non-terminal at the top of the stack with the right-hand side
+// of the production, which become its children
+void apply_production_rule(ParseStack& stack, ll1::production const& p);
 
-  // Adding new symbols as children of popped symbol
-  top->children.reserve(top->children.size() + replace.size());
-  const auto rend = top->children.rbegin();
-  std::transform(replace.begin(), replace.end(),
-                 std::back_inserter(top->children), [](Token const& token) {
-                   return std::make_unique<Node>(Node{.token = token});
-                 });
-  const auto rbegin = top->children.rbegin();
-
-  // Adding new symbols to stack (in reverse)
-  std::for_each(rbegin, rend,
-                [&stack](std::unique_ptr<Node>& n) { stack.push(n.get()); });
+template <typename Sink>
+void apply_production_rule(MatchStack<Sink>& stack, ll1::production const& p) {
+  stack.symbols.pop_back();
+  for (auto i = p.size; i > 0; --i) {
+    stack.symbols.push_back(p.rhs[i - 1]);
+  }
 }
 
-// parse returns the root of the Abstract Syntax Tree, and a success flag.
-std::pair<Node, bool> parse(TokenForwardIterator auto begin,
-                            TokenForwardIterator auto end) {
-  Node root{.token = Symbol::Start};
-  std::stack<Node*> stack{};
-  stack.push(&root);
-
-  bool ok = true;
-  auto it = begin;
-  while (it != end) {
-    cout_stack(stack, *it);
-
-    if (ok = (*it).symbol != Symbol::ERROR; !ok) {
-      break;
-    }
-
-    if (Node& top = *stack.top(); *it == top.token) {
-      apply_production_rule(stack, {});
-      it = std::next(it);
-      continue;
+// Message of a parsing error at the input token
+std::string parsing_error(Token const& input);
+
+// parse_token applies productions from the table of assembly_grammar until
+// the input is matched, and returns false on a parsing error, which it
+// prints if `report` is set. The END token is matched twice: it ends the
+// program, and then the start rule.
+template <typename Stack>
+bool parse_token(Stack& stack, Token const& input, bool report = true) {
+  namespace grammar = assembly_grammar;
+
+  const auto lookahead = grammar::symbol_of(input);
+  while (lookahead != grammar::none && !stack.empty()) {
+    cout_stack(stack, input);
+
+    const auto expected = stack.top_symbol();
+    if (grammar::table.is_terminal(expected)) {
+      if (expected != lookahead) {
+        break;
+      }
+      stack.match(input);
+      return true;
     }
 
-    if (ok = production_rule(stack, *it); !ok) {
+    const auto p = grammar::table.parse[expected - grammar::terminals][lookahead];
+    if (p == ll1::no_production) {
       break;
     }
+    apply_production_rule(stack, grammar::productions[p]);
+  }
+
+  if (report) {
+    std::cerr << parsing_error(input);
   }
+  return false;
+}
 
-  if (!ok) {
-    const Token t = *it;
-    std::cerr << std::format("{}: parsing error: unexpected token {}\n",
-                             t.location(), t.fmt());
-    return {std::move(root), false};
+// parse returns the Abstract Syntax Tree, and a success flag
+std::pair<SyntaxTree, bool> parse(TokenForwardIterator auto begin,
+                                  TokenForwardIterator auto end) {
+  SyntaxTree tree;
+  tree.nodes.push_back(Node{.token = Symbol::Start});
+  ParseStack stack{.tree = tree, .symbols = {0}};
+
+  const Token last{Symbol::END};
+  for (auto it = begin; !stack.empty();) {
+    Token const& input = it == end ? last : *it;
+    if (!parse_token(stack, input)) {
+      return {std::move(tree), false};
+    }
+    if (input.symbol != Symbol::END) {
+      it = std::next(it);
+    }
   }
 
-  return {std::move(root), true};
+  return {std::move(tree), true};
 }
@@ -1,36 +1,122 @@
 #include "tokenizer.hpp"
 
+#include <bit>
 #include <cassert>
 #include <cctype>
+#include <cstddef>
 #include <cstdio>
 #include <filesystem>
 #include <format>
-#include <fstream>
-#include <ios>
+#include <functional>
 #include <iostream>
 #include <optional>
 #include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "arch/arch.hpp"
 #include "assembler/lib/grammar.hpp"
+#include "vm/lib/mapped_file.hpp"
+
+namespace {
+
+// Bytes that the tokenizer takes in runs rather than one by one
+enum class run { SPACES, IDENTIFIER, DIGITS, STRING };
+
+constexpr bool in_run(char ch, run r) {
+  switch (r) {
+    case run::SPACES:
+      return ch == ' ';
+    case run::IDENTIFIER:
+      return ('a' <= ch && ch <= 'z') || ('A' <= ch && ch <= 'Z') ||
+             ('0' <= ch && ch <= '9') || ch == '-' || ch == '_' ||
+             ch == ':' || ch == '.';
+    case run::DIGITS:
+      return '0' <= ch && ch <= '9';
+    case run::STRING:
+      return ch != '"' && ch != '\\' && ch != '\n';
+  }
+  return false;
+}
 
-std::vector<std::byte> str_to_bytes(std::string str);
-constexpr std::optional<char> escape(char ch);
+#if defined(__SSE2__)
+// Bytes of x from lo to hi. Bytes above 0x7f are negative, and never match.
+__m128i in_range(__m128i x, char lo, char hi) {
+  return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(char(lo - 1))),
+                       _mm_cmplt_epi8(x, _mm_set1_epi8(char(hi + 1))));
+}
 
-std::pair<std::vector<Token>, bool> tokenize(std::string file_name) {
+__m128i equal(__m128i x, char ch) {
+  return _mm_cmpeq_epi8(x, _mm_set1_epi8(ch));
+}
+
+// in_run for 16 bytes at once: 0xff where the byte is in the run
+__m128i in_run(__m128i x, run r) {
+  switch (r) {
+    case run::SPACES:
+      return equal(x, ' ');
+    case run::IDENTIFIER:
+      return _mm_or_si128(
+          _mm_or_si128(_mm_or_si128(in_range(x, 'a', 'z'), in_range(x, 'A', 'Z')),
+                       _mm_or_si128(in_range(x, '0', '9'), equal(x, '-'))),
+          _mm_or_si128(_mm_or_si128(equal(x, '_'), equal(x, ':')),
+                       equal(x, '.')));
+    case run::DIGITS:
+      return in_range(x, '0', '9');
+    case run::STRING:
+      return _mm_andnot_si128(
+          _mm_or_si128(_mm_or_si128(equal(x, '"'), equal(x, '\\')),
+                       equal(x, '\n')),
+          _mm_set1_epi8(-1));
+  }
+  return _mm_setzero_si128();
+}
+#endif
+
+// Length of the run of r at the start of s, 16 bytes at a time
+std::size_t run_length(std::string_view s, run r) {
+  std::size_t n = 0;
+#if defined(__SSE2__)
+  for (; n + 16 <= s.size(); n += 16) {
+    const auto x =
+        _mm_loadu_si128(reinterpret_cast<__m128i const *>(s.data() + n));
+    const auto mask = unsigned(_mm_movemask_epi8(in_run(x, r)));
+    if (mask != 0xffff) {
+      return n + unsigned(std::countr_one(mask));
+    }
+  }
+#endif
+  while (n < s.size() && in_run(s[n], r)) {
+    ++n;
+  }
+  return n;
+}
+
+}  // namespace
+
+bool tokenize(std::string file_name,
+              std::function<bool(Token const&)> const& sink) {
   if (!std::filesystem::exists(file_name)) {
     std::cerr << std::format("File {} does not exist\n", file_name);
-    return {{}, false};
+    return false;
   }
 
-  std::ifstream f(file_name.c_str(), std::ios::binary);
-  if (!f.good()) {
+  std::uint16_t file = 0;
+  try {
+    file = source_files::open(file_name);
+  } catch (std::runtime_error&) {
     std::cerr << std::format("Could not open file {}\n", file_name);
-    return {{}, false};
+    return false;
   }
+  const auto source = source_files::text(file);
 
-  std::vector<Token> tokenized;
-  TokenParser p{.file_name = std::move(file_name)};
+  TokenParser p{.file = file, .source = source};
+  bool stopped = false;
 
   const auto consume = [&](char ch) -> bool {
     auto token = p.consume(ch);
@@ -38,7 +124,7 @@ std::pair<std::vector<Token>, bool> tokenize(std::string file_name) {
       return true;
     }
 
-    tokenized.push_back(token);
+    stopped = !sink(token);
 
     if (token.symbol == Symbol::ERROR) {
       std::cerr << std::format("{}: tokenization error: {}\n", token.location(),
@@ -50,21 +136,31 @@ std::pair<std::vector<Token>, bool> tokenize(std::string file_name) {
   };
 
   unsigned errcount = 0;
-  while (f) {
-    const auto ch = static_cast<char>(f.get());
-
-    if (ch == EOF) {
-      errcount += consume('\n') ? 0 : 1;
-      break;
+  for (std::size_t i = 0; i < source.size() && !stopped;) {
+    if (const auto n = p.consume_run(source.substr(i)); n != 0) {
+      i += n;
+      continue;
     }
+    errcount += consume(source[i]) ? 0 : 1;
+    ++i;
+  }
 
-    errcount += consume(ch) ? 0 : 1;
+  for (const char ch : {'\n', char(EOF), char(0)}) {
+    if (!stopped) {
+      errcount += consume(ch) ? 0 : 1;
+    }
   }
 
-  errcount += consume(EOF) ? 0 : 1;
-  errcount += consume(0) ? 0 : 1;
+  return errcount == 0 && !stopped;
+}
 
-  return {std::move(tokenized), errcount == 0};
+std::pair<std::vector<Token>, bool> tokenize(std::string file_name) {
+  std::vector<Token> tokenized;
+  const bool ok = tokenize(std::move(file_name), [&](Token const& token) {
+    tokenized.push_back(token);
+    return true;
+  });
+  return {std::move(tokenized), ok};
 }
 
 Token TokenParser::consume(char ch) {
@@ -108,6 +204,7 @@ Token TokenParser::consume(char ch) {
   }
 
   ++len;
+  ++pos;
   if (ch == '\n') {
     ++row;
     col = 1;
@@ -118,7 +215,52 @@ Token TokenParser::consume(char ch) {
   return r;
 }
 
+std::size_t TokenParser::consume_run(std::string_view rest) {
+  std::size_t n = 0;
+  switch (type) {
+    case Symbol::NONE:
+      n = run_length(rest, run::SPACES);
+      start_col += unsigned(n);
+      break;
+    case Symbol::EOL:
+      n = run_length(rest, run::SPACES);
+      break;
+    case Symbol::UNKNOWN_IDENTIFIER:
+      n = run_length(rest, run::IDENTIFIER);
+      break;
+    case Symbol::NUMBER_LITERAL:
+      // Past the prefix, where the base is known
+      if (num_base != 10 || len == 0) {
+        return 0;
+      }
+      n = run_length(rest, run::DIGITS);
+      for (const char ch : rest.substr(0, n)) {
+        value = value * 10 + static_cast<unsigned>(ch - '0');
+      }
+      break;
+    case Symbol::STRING_LITERAL:
+      // Past the opening quote, and not after a backslash
+      if (len <= 0 || prev_char == '\\') {
+        return 0;
+      }
+      n = run_length(rest, run::STRING);
+      if (n == 0) {
+        return 0;
+      }
+      prev_char = rest[n - 1];
+      break;
+    default:
+      return 0;
+  }
+
+  len += int(n);
+  pos += n;
+  col += unsigned(n);
+  return n;
+}
+
 void TokenParser::first_byte(char ch) {
+  start = pos;
   if (ch == EOF) {
     type = Symbol::END;
     return;
@@ -159,7 +301,6 @@ void TokenParser::first_byte(char ch) {
   }
 
   type = Symbol::UNKNOWN_IDENTIFIER;
-  identifier.push_back(ch);
 }
 
 bool TokenParser::consume_EOL(char ch) {
@@ -176,7 +317,6 @@ bool TokenParser::consume_IDENTIFIER(char ch) {
   }
 
   if (std::isalnum(ch)) {
-    identifier.push_back(ch);
     return false;
   }
 
@@ -185,7 +325,6 @@ bool TokenParser::consume_IDENTIFIER(char ch) {
     case '_':
     case ':':
     case '.':
-      identifier.push_back(ch);
       return false;
   }
 
@@ -336,17 +475,11 @@ bool TokenParser::consume_STRING(char ch) {
 
   // End of string
   if (ch == '"') {
-    if (len != 0) {
-      identifier.push_back(prev_char);
-    }
     len = -0xff;
     return false;
   }
 
   // Regular characters
-  if (len != 0) {
-    identifier.push_back(prev_char);
-  }
   prev_char = ch;
   return false;
 }
@@ -373,7 +506,7 @@ Token TokenParser::finalize() {
       case Symbol::UNKNOWN_IDENTIFIER:
         return finalize_IDENTIFIER();
       case Symbol::ERROR:
-        return {Symbol::ERROR, str_to_bytes(identifier)};
+        return {Symbol::ERROR, 0, source_files::keep(std::move(identifier))};
       case Symbol::EOL:
         return {Symbol::EOL};
       case Symbol::END:
@@ -393,7 +526,7 @@ Token TokenParser::finalize() {
     return {Symbol::ERROR};
   }();
 
-  r.set_location(file_name, start_row, start_col);
+  r.set_location(file, start_row, start_col);
   return r;
 }
 
@@ -410,82 +543,34 @@ void TokenParser::clear() {
 
 Token TokenParser::finalize_NUMBER() {
   assert(value <= 0xffff);
-  return {Symbol::NUMBER_LITERAL,
-          {std::byte(value & 0xff), std::byte((value & 0xff00) >> 8)}};
+  return {Symbol::NUMBER_LITERAL, std::uint16_t(value)};
 }
 
 Token TokenParser::finalize_CHARACTER() {
-  return {Symbol::CHARACTER_LITERAL,
-          {std::byte(value & 0xff), std::byte((value & 0xff00) >> 8)}};
+  return {Symbol::CHARACTER_LITERAL, std::uint16_t(value)};
 }
 
 Token TokenParser::finalize_STRING() {
-  return {
-      Symbol::STRING_LITERAL,
-      str_to_bytes(identifier),
-  };
+  // Between the quotes
+  return {Symbol::STRING_LITERAL, 0, source.substr(start + 1, pos - start - 2)};
 }
 
 Token TokenParser::finalize_IDENTIFIER() {
+  const auto identifier = source.substr(start, pos - start);
   if (const auto id = arch::from_string(identifier); id != Verb::ERROR) {
-    return {
-        Symbol::VERB,
-        {std::byte(id & 0xff), std::byte{}},
-    };
+    return {Symbol::VERB, std::uint16_t(id)};
   }
 
   if (identifier.starts_with('r') && identifier.size() == 2 &&
       std::isdigit(identifier[1])) {
-    return {Symbol::REGISTER,
-            {std::byte(identifier[1] - '0'), std::byte(0x80)}};
+    return {Symbol::REGISTER, std::uint16_t(0x8000 + (identifier[1] - '0'))};
   }
 
   if (identifier.ends_with(":")) {
-    identifier.pop_back();
-    return {Symbol::TAG_DECL, str_to_bytes(identifier)};
-  }
-
-  return {Symbol::TAG_REF, str_to_bytes(identifier)};
-}
-
-std::vector<std::byte> str_to_bytes(std::string str) {
-  std::vector<std::byte> out;
-  out.reserve(2 * str.size());
-  for (auto c : str) {
-    out.push_back(std::byte(c));
-    out.push_back(std::byte(0));
+    return {Symbol::TAG_DECL, 0, identifier.substr(0, identifier.size() - 1)};
   }
 
-  return out;
-}
-
-constexpr std::optional<char> escape(char ch) {
-  switch (ch) {
-    case '0':
-      return 0;
-    case 'n':
-      return '\n';
-    case 't':
-      return '\t';
-    case 'v':
-      return '\v';
-    case 'b':
-      return '\b';
-    case 'r':
-      return '\r';
-    case 'f':
-      return '\f';
-    case 'a':
-      return '\a';
-    case '\\':
-      return '\\';
-    case '\'':
-      return '\'';
-    case '"':
-      return '\"';
-  }
-
-  return {};
+  return {Symbol::TAG_REF, 0, identifier};
 }
 
 std::ostream& fmt_tokens(std::ostream& out,
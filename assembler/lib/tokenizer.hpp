@@ -1,7 +1,12 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <iosfwd>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 #include "arch/arch.hpp"
@@ -10,7 +15,10 @@
 namespace {
 
 struct TokenParser {
-  std::string_view file_name;
+  std::uint16_t file = 0;
+  std::string_view source = {};
+  std::size_t pos = 0;    // Of the next byte
+  std::size_t start = 0;  // Of the current token
   unsigned row = 1;
   unsigned col = 1;
 
@@ -26,10 +34,15 @@ struct TokenParser {
 
   // Text helpers
   char prev_char = {};
-  std::string identifier = {};
+  std::string identifier = {};  // Error message
 
   Token consume(char ch);
 
+  // Consumes the longest prefix of `rest` that continues the current token
+  // without ending it, or the spaces between tokens, all at once. Returns
+  // its length, which is zero where consume must look at the next byte.
+  std::size_t consume_run(std::string_view rest);
+
  private:
   bool error(char ch, std::string&& msg) {
     prev_char = ch;
@@ -59,6 +72,13 @@ struct TokenParser {
 
 }  // namespace
 
+// tokenize hands the tokens of the file to `sink` one at a time, as they are
+// read, and stops as soon as it returns false. Returns false on errors, or
+// if the sink stopped it.
+bool tokenize(std::string file_name,
+              std::function<bool(Token const&)> const& sink);
+
+// tokenize returns all the tokens of the file, and a success flag
 std::pair<std::vector<Token>, bool> tokenize(std::string file_name);
 
 std::ostream& fmt_tokens(std::ostream& out,
@@ -2,12 +2,18 @@
 
 #include <doctest/doctest.h>
 
+#include <cstddef>
+#include <format>
 #include <fstream>
+#include <iostream>
 #include <sstream>
+#include <string>
+#include <vector>
 
 #include "lib/code_generation.hpp"
 #include "lib/parser.hpp"
 #include "lib/tokenizer.hpp"
+#include "vm/lib/symbols.hpp"
 #include "testutils/utils.hpp"
 
 inline void test_code_generation(std::string_view test_name,
@@ -21,6 +27,12 @@ inline void test_code_generation(std::string_view test_name,
   REQUIRE_MESSAGE(parsed_ok, "Setup: unsuccessful parsing");
 
   auto [bytecode, success] = generate(root);
+
+  // The same code, in one pass
+  auto [streamed, streamed_ok] =
+      assemble(testutils::fixture_path(test_name));
+  CHECK_EQ(streamed_ok, success);
+
   if (want_success) {
     REQUIRE(success);
   } else {
@@ -29,6 +41,7 @@ inline void test_code_generation(std::string_view test_name,
   }
 
   testutils::check_golden_binary(test_name, bytecode);
+  CHECK(streamed == bytecode);
 }
 
 #define SUBCASE_CG(name, wantSuccess) \
@@ -43,4 +56,101 @@ TEST_CASE("code_generation") {
   SUBCASE_CG("sample", true)
   SUBCASE_CG("sample2", true)
   SUBCASE_CG("undefined_ref", false);
-}
\ No newline at end of file
+}
+
+TEST_CASE("symbols") {
+  auto lock = SET_TEST_DIR();
+
+  auto [tokenized, tokenized_ok] =
+      tokenize(testutils::fixture_path("code_generation/sample"));
+  REQUIRE_MESSAGE(tokenized_ok, "Setup: unsuccessful tokenization");
+
+  auto [root, parsed_ok] = parse(tokenized.begin(), tokenized.end());
+  REQUIRE_MESSAGE(parsed_ok, "Setup: unsuccessful parsing");
+
+  // Tags, and the line of every statement
+  SynacorVM::symbol_table symbols;
+  REQUIRE(generate(root, &symbols).second);
+  CHECK_EQ(symbols.address_of("loop").value().to_uint(), 3u);
+
+  std::stringstream saved;
+  symbols.save(saved);
+  testutils::check_golden("code_generation/sample_symbols", saved.str());
+
+  SynacorVM::symbol_table streamed;
+  REQUIRE(assemble(testutils::fixture_path("code_generation/sample"),
+                   &streamed)
+              .second);
+  std::stringstream streamed_saved;
+  streamed.save(streamed_saved);
+  CHECK_EQ(streamed_saved.str(), saved.str());
+}
+
+TEST_CASE("long programs") {
+  // Every line nests the rest of the program one level deeper
+  constexpr std::size_t lines = 200'000;
+  std::vector<Token> tokens;
+  for (std::size_t i = 0; i < lines; ++i) {
+    tokens.push_back({Symbol::VERB, NOOP});
+    tokens.push_back(Symbol::EOL);
+  }
+  tokens.push_back(Symbol::END);
+
+  auto [tree, parsed_ok] = parse(tokens.begin(), tokens.end());
+  REQUIRE(parsed_ok);
+  CHECK_EQ(tree.nodes.size(), 4 * lines + 4);
+
+  auto [bytecode, success] = generate(tree);
+  REQUIRE(success);
+  CHECK_EQ(bytecode.size(), 2 * lines);
+}
+
+TEST_CASE("many tags") {
+  // Every tag is followed by a jump to its mirror, half of them further down
+  constexpr std::size_t lines = 20'000;
+  std::vector<std::string> names;
+  for (std::size_t i = 0; i < lines; ++i) {
+    names.push_back(std::format("l_{}", i));
+  }
+  std::vector<Token> tokens;
+  for (std::size_t i = 0; i < lines; ++i) {
+    tokens.push_back({Symbol::TAG_DECL, 0, names[i]});
+    tokens.push_back(Symbol::EOL);
+    tokens.push_back({Symbol::VERB, JMP});
+    tokens.push_back({Symbol::TAG_REF, 0, names[lines - 1 - i]});
+    tokens.push_back(Symbol::EOL);
+  }
+  tokens.push_back(Symbol::END);
+
+  auto [tree, parsed_ok] = parse(tokens.begin(), tokens.end());
+  REQUIRE(parsed_ok);
+
+  SynacorVM::symbol_table symbols;
+  auto [bytecode, success] = generate(tree, &symbols);
+  REQUIRE(success);
+  REQUIRE_EQ(bytecode.size(), 4 * lines);
+  std::size_t mirrored = 0;
+  for (std::size_t i = 0; i < lines; ++i) {
+    const auto target = std::to_integer<std::size_t>(bytecode[4 * i + 2]) |
+                        std::to_integer<std::size_t>(bytecode[4 * i + 3]) << 8;
+    mirrored += target == 2 * (lines - 1 - i) ? 1 : 0;
+  }
+  CHECK_EQ(mirrored, lines);
+  CHECK_EQ(symbols.address_of("l_123").value().to_uint(), 246u);
+}
+
+TEST_CASE("error reporting") {
+  auto lock = SET_TEST_DIR();
+
+  // A tokenization error after a parsing error is the one reported, as when
+  // tokenizing first
+  std::stringstream errors;
+  auto *const cerr = std::cerr.rdbuf(errors.rdbuf());
+  auto [bytecode, success] = assemble(
+      testutils::fixture_path("code_generation/late_tokenization_error"));
+  std::cerr.rdbuf(cerr);
+
+  CHECK_FALSE(success);
+  CHECK_NE(errors.str().find(":2:5: tokenization error"), std::string::npos);
+  CHECK_EQ(errors.str().find("parsing error"), std::string::npos);
+}
@@ -34,4 +34,19 @@ TEST_CASE("tokenizer") {
   SUBCASE("numbers") { test_tokenizer("tokenizer/numbers", false); }
   SUBCASE("sample") { test_tokenizer("tokenizer/sample", true); }
   SUBCASE("sample2") { test_tokenizer("tokenizer/sample2", true); }
+  SUBCASE("runs") { test_tokenizer("tokenizer/runs", true); }
+}
+
+TEST_CASE("token locations") {
+  auto lock = SET_TEST_DIR();
+
+  // Runs of spaces and long tokens are skipped over many bytes at a time
+  const auto [got, ok] = tokenize(testutils::fixture_path("tokenizer/runs"));
+  REQUIRE(ok);
+  REQUIRE_GT(got.size(), 10u);
+  CHECK_EQ(got[2].location(), "testdata/fixtures/tokenizer/runs.in:2:41");
+  CHECK_EQ(got[4].location(), "testdata/fixtures/tokenizer/runs.in:2:48");
+  CHECK_EQ(got[6].location(), "testdata/fixtures/tokenizer/runs.in:3:5");
+  CHECK_EQ(got[8].location(), "testdata/fixtures/tokenizer/runs.in:4:5");
+  CHECK_EQ(got[10].location(), "testdata/fixtures/tokenizer/runs.in:4:46");
 }
\ No newline at end of file
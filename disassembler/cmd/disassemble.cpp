@@ -0,0 +1,51 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "lib/disassembler.hpp"
+
+std::basic_string<std::byte> read_image(std::string const &file_name) {
+  std::ifstream f(file_name, std::ios::binary);
+  if (!f) {
+    throw std::runtime_error(std::format("could not read {}", file_name));
+  }
+  std::string s((std::istreambuf_iterator<char>(f)),
+                std::istreambuf_iterator<char>());
+  return {reinterpret_cast<std::byte const *>(s.data()), s.size()};
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2 && argc != 3) {
+    std::cerr << "Usage: disassemble <BINARY> [OUTPUT]\n";
+    return EXIT_FAILURE;
+  }
+
+  try {
+    const auto image = read_image(argv[1]);
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto l = disasm::listing::analyze(image);
+    const std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    if (argc == 3) {
+      std::ofstream out(argv[2]);
+      l.write_source(out);
+    } else {
+      l.write_source(std::cout);
+    }
+
+    std::cerr << std::format("{} instructions and {} words in {:.1f} ms\n",
+                             l.instruction_count(), l.words().size(),
+                             elapsed.count());
+  } catch (std::exception &e) {
+    std::cerr << std::format("disassemble: {}\n", e.what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
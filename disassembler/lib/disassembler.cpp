@@ -0,0 +1,262 @@
+#include "disassembler.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arch/arch.hpp"
+#include "vm/lib/control_flow.hpp"
+#include "vm/lib/memory.hpp"
+
+namespace disasm {
+
+namespace {
+
+constexpr std::uint16_t first_register = 0x8000;
+constexpr std::uint16_t register_count = 8;
+
+// Data lines are split in strings and in lines of numbers
+constexpr std::size_t numbers_per_line = 8;
+constexpr std::size_t min_string = 4;
+
+bool is_register(std::uint16_t w) {
+  return w >= first_register && w < first_register + register_count;
+}
+
+// Characters that can be written in string literals as they are
+bool printable(std::uint16_t w) {
+  return w >= ' ' && w <= '~' && w != '"' && w != '\\';
+}
+
+} // namespace
+
+bool listing::explore(code_map &map, std::vector<std::size_t> pending,
+                      bool strict) {
+  const auto size = m_words.size();
+  const auto follow = [&](std::uint32_t destination, target kind) {
+    if (destination >= size) {
+      return false;
+    }
+    if (map.targets[destination] != target::CALL) {
+      map.targets[destination] = kind;
+    }
+    pending.push_back(destination);
+    return true;
+  };
+
+  // Follows the blocks of a path until it ends or reaches known code. Fails
+  // when the path runs into data or into the middle of an instruction.
+  const auto walk = [&](std::size_t address) {
+    while (true) {
+      if (address >= size || map.roles[address] == role::OPERAND) {
+        return false;
+      }
+      if (map.roles[address] == role::INSTRUCTION) {
+        return true;
+      }
+
+      const auto b = graph->at(std::uint32_t(address));
+      while (address < b.end) {
+        if (address >= size || map.roles[address] != role::DATA) {
+          return address < size && map.roles[address] == role::INSTRUCTION;
+        }
+        const auto i = SynacorVM::decode(*memory, std::uint32_t(address));
+        if (i.verb == ERROR || address + i.length > size) {
+          return false;
+        }
+
+        // Instructions overlapping known code are left as data
+        for (unsigned n = 1; n < i.length; ++n) {
+          if (map.roles[address + n] != role::DATA) {
+            return false;
+          }
+        }
+
+        map.roles[address] = role::INSTRUCTION;
+        for (unsigned n = 1; n < i.length; ++n) {
+          map.roles[address + n] = role::OPERAND;
+        }
+        ++map.instructions;
+        address += i.length;
+      }
+
+      if (b.destination != SynacorVM::control_flow_graph::none &&
+          !follow(b.destination,
+                  b.exit == CALL ? target::CALL : target::JUMP) &&
+          strict) {
+        return false;
+      }
+      if (b.next == SynacorVM::control_flow_graph::none) {
+        return true;
+      }
+      address = b.next;
+    }
+  };
+
+  while (!pending.empty()) {
+    const auto address = pending.back();
+    pending.pop_back();
+    if (!walk(address) && strict) {
+      return false;
+    }
+  }
+  return true;
+}
+
+listing listing::analyze(std::basic_string_view<std::byte> image,
+                         std::vector<std::uint16_t> const &entries) {
+  if (image.size() % 2 != 0) {
+    throw std::runtime_error("the image has an odd number of bytes");
+  }
+  if (image.size() > 2 * SynacorVM::Memory::heap_size) {
+    throw std::runtime_error("the image is larger than the heap");
+  }
+
+  listing l;
+  l.m_words.resize(image.size() / 2);
+  for (std::size_t a = 0; a < l.m_words.size(); ++a) {
+    l.m_words[a] = static_cast<std::uint16_t>(
+        std::to_integer<unsigned>(image[2 * a]) |
+        (std::to_integer<unsigned>(image[2 * a + 1]) << 8));
+  }
+  l.memory = std::make_unique<SynacorVM::Memory>();
+  l.memory->load(std::basic_string<std::byte>(image));
+  l.graph = std::make_unique<SynacorVM::control_flow_graph>(*l.memory);
+
+  l.map.roles.assign(l.m_words.size(), role::DATA);
+  l.map.targets.assign(l.m_words.size(), target::NONE);
+  l.explore(l.map, {entries.begin(), entries.end()}, false);
+
+  // Function pointers: addresses loaded with set, such as the target of a
+  // later `call r0`, are code if every path from them decodes. Any path
+  // into data discards the guess. Zeros decode as halt, and are taken as
+  // data.
+  std::vector<bool> tried(l.m_words.size(), false);
+  for (bool found = true; found;) {
+    found = false;
+    for (std::size_t a = 0; a < l.m_words.size(); ++a) {
+      if (l.map.roles[a] != role::INSTRUCTION || l.m_words[a] != SET) {
+        continue;
+      }
+      const auto value = l.m_words[a + 2];
+      if (value >= l.m_words.size() || tried[value] ||
+          l.map.roles[value] != role::DATA || l.m_words[value] == HALT) {
+        continue;
+      }
+      tried[value] = true;
+
+      auto guess = l.map;
+      guess.targets[value] = target::CALL;
+      if (l.explore(guess, {value}, true)) {
+        l.map = std::move(guess);
+        found = true;
+      }
+    }
+  }
+
+  return l;
+}
+
+std::optional<std::string> listing::label(std::size_t address) const {
+  if (address >= map.targets.size() || map.targets[address] == target::NONE ||
+      map.roles[address] == role::OPERAND) {
+    return std::nullopt;
+  }
+  return std::format("{}_{:04x}",
+                     map.targets[address] == target::CALL ? "sub" : "loc",
+                     address);
+}
+
+std::string listing::operand(SynacorVM::instruction const &i, unsigned n) const {
+  const auto w = i.operands[n];
+  if (is_register(w)) {
+    return std::format("r{}", w - first_register);
+  }
+
+  const bool destination = ((i.verb == JMP || i.verb == CALL) && n == 0) ||
+                           ((i.verb == JT || i.verb == JF) && n == 1);
+  if (destination) {
+    if (auto l = label(w); l.has_value()) {
+      return *l;
+    }
+  }
+
+  if (i.verb == OUT) {
+    if (w == '\n') {
+      return "'\\n'";
+    }
+    if (w > ' ' && w <= '~' && w != '\'' && w != '\\') {
+      return std::format("'{}'", static_cast<char>(w));
+    }
+  }
+  return std::format("0x{:04x}", w);
+}
+
+void listing::write_source(std::ostream &out) const {
+  const auto size = m_words.size();
+  std::size_t address = 0;
+  while (address < size) {
+    if (const auto l = label(address); l.has_value()) {
+      out << std::format("{}{}:\n", address == 0 ? "" : "\n", *l);
+    }
+
+    if (map.roles[address] == role::INSTRUCTION) {
+      const auto i = SynacorVM::decode(*memory, std::uint32_t(address));
+      std::string line = std::format("    {}", arch::to_string(i.verb));
+      for (unsigned n = 0; n + 1 < i.length; ++n) {
+        line += ' ';
+        line += operand(i, n);
+      }
+      out << line << '\n';
+      address += i.length;
+      continue;
+    }
+
+    // Data up to the next label or instruction
+    auto end = address + 1;
+    while (end < size && map.roles[end] == role::DATA && !label(end).has_value()) {
+      ++end;
+    }
+
+    while (address < end) {
+      auto text = address;
+      while (text < end && printable(m_words[text])) {
+        ++text;
+      }
+
+      if (text - address >= min_string) {
+        std::string s;
+        for (; address < text; ++address) {
+          s += static_cast<char>(m_words[address]);
+        }
+        out << std::format("    \"{}\"\n", s);
+        continue;
+      }
+
+      std::string line = "   ";
+      for (std::size_t n = 0; n < numbers_per_line && address < end; ++n) {
+        // Stop before a string long enough to be written as one
+        auto run = address;
+        while (run < end && printable(m_words[run])) {
+          ++run;
+        }
+        if (n > 0 && run - address >= min_string) {
+          break;
+        }
+        line += std::format(" 0x{:04x}", m_words[address]);
+        ++address;
+      }
+      out << line << '\n';
+    }
+  }
+}
+
+} // namespace disasm
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arch/arch.hpp"
+#include "vm/lib/control_flow.hpp"
+#include "vm/lib/memory.hpp"
+
+namespace disasm {
+
+// listing tells code from data in an image. Code is found by following the
+// edges of the control flow graph from the entry points: fall-through, and
+// the literal targets of jmp, jt, jf and call. Addresses loaded with set are
+// code as well when every path from them decodes, unless they hold a zero.
+// Everything else is data.
+class listing {
+public:
+  enum class role : std::uint8_t {
+    DATA,
+    INSTRUCTION, // First word of an instruction
+    OPERAND,
+  };
+
+  // Images of an odd number of bytes cannot be assembled back, and images
+  // larger than the heap cannot be loaded
+  static listing analyze(std::basic_string_view<std::byte> image,
+                         std::vector<std::uint16_t> const &entries = {0});
+
+  std::span<std::uint16_t const> words() const noexcept { return m_words; }
+  role at(std::size_t address) const noexcept { return map.roles[address]; }
+
+  std::size_t instruction_count() const noexcept { return map.instructions; }
+
+  // Name of the label at `address`, if code jumps or calls there
+  std::optional<std::string> label(std::size_t address) const;
+
+  // Assembly source that `assemble` turns back into the same image
+  void write_source(std::ostream &out) const;
+
+private:
+  enum class target : std::uint8_t { NONE, JUMP, CALL };
+
+  // What is known of every word
+  struct code_map {
+    std::vector<role> roles;
+    std::vector<target> targets;
+    std::size_t instructions = 0;
+  };
+
+  // Follows the code from the given addresses. When strict, fails on paths
+  // that run into data or into the middle of an instruction.
+  bool explore(code_map &map, std::vector<std::size_t> pending, bool strict);
+
+  std::string operand(SynacorVM::instruction const &i, unsigned n) const;
+
+  std::vector<std::uint16_t> m_words;
+  std::unique_ptr<SynacorVM::Memory> memory;
+  std::unique_ptr<SynacorVM::control_flow_graph> graph;
+  code_map map;
+};
+
+} // namespace disasm
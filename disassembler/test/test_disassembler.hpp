@@ -0,0 +1,68 @@
+#pragma once
+
+#include <doctest/doctest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "assembler/lib/code_generation.hpp"
+#include "assembler/lib/parser.hpp"
+#include "assembler/lib/tokenizer.hpp"
+#include "disassembler/lib/disassembler.hpp"
+#include "testutils/utils.hpp"
+
+// Assembles the source and returns the binary
+inline std::basic_string<std::byte> reassemble(std::string const &source) {
+  const std::string file = "reassembled.as";
+  {
+    std::ofstream f(file);
+    f << source;
+  }
+
+  auto [tokens, tokenized] = tokenize(file);
+  std::remove(file.c_str());
+  REQUIRE(tokenized);
+  auto [root, parsed] = parse(tokens.begin(), tokens.end());
+  REQUIRE(parsed);
+  auto [code, generated] = generate(root);
+  REQUIRE(generated);
+  return code;
+}
+
+inline void check_round_trip(std::string const &binary) {
+  const auto image = testutils::read_binary(binary);
+  const auto l = disasm::listing::analyze(image);
+
+  std::stringstream source;
+  l.write_source(source);
+  CHECK(reassemble(source.str()) == image);
+}
+
+TEST_CASE("disassemble") {
+  auto lock = SET_TEST_DIR();
+
+  SUBCASE("listing") {
+    const auto image =
+        testutils::read_binary(testutils::fixture_path("disassemble/calls"));
+    const auto l = disasm::listing::analyze(image);
+
+    // The string is data, and the indirect call does not hide anything
+    CHECK_EQ(l.instruction_count(), 13u);
+    CHECK_EQ(l.at(2), disasm::listing::role::DATA);
+    CHECK_EQ(l.label(0x10).value(), "loc_0010");
+    CHECK_FALSE(l.label(2).has_value());
+
+    std::stringstream source;
+    l.write_source(source);
+    testutils::check_golden("disassemble/calls", source.str());
+    CHECK(reassemble(source.str()) == image);
+  }
+
+  SUBCASE("round trip") {
+    check_round_trip(testutils::fixture_path("disassemble/calls"));
+    check_round_trip("../../example-programs/hello-world.syn");
+    check_round_trip("../../docs/spec/challenge");
+  }
+}
@@ -0,0 +1,21 @@
+jmp main
+
+greeting:
+    "Hello, world" 10 0
+
+main:
+    set r0 3
+    call countdown
+    set r1 countdown
+    set r0 2
+    call r1
+    out 'A'
+    out '\n'
+    halt
+
+countdown:
+    jf r0 done
+    add r0 r0 32767
+    call countdown
+done:
+    ret
@@ -0,0 +1,82 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "lib/recompiler.hpp"
+#include "vm/lib/coverage.hpp"
+#include "vm/lib/memory.hpp"
+#include "vm/lib/self_modification.hpp"
+
+std::basic_string<std::byte> read_image(std::string const &file_name) {
+  std::ifstream f(file_name, std::ios::binary);
+  if (!f) {
+    throw std::runtime_error(std::format("could not read {}", file_name));
+  }
+  std::string s((std::istreambuf_iterator<char>(f)),
+                std::istreambuf_iterator<char>());
+  return {reinterpret_cast<std::byte const *>(s.data()), s.size()};
+}
+
+int main(int argc, char **argv) {
+  recompiler::options opts;
+  bool usage = argc < 3 || argc % 2 != 1;
+  std::string coverage;
+  std::string pages;
+  for (int i = 3; !usage && i < argc; i += 2) {
+    const std::string_view option = argv[i];
+    if (option == "--coverage") {
+      coverage = argv[i + 1];
+    } else if (option == "--pages") {
+      pages = argv[i + 1];
+    } else {
+      usage = true;
+    }
+  }
+  if (usage) {
+    std::cerr << "Usage: recompile <BINARY> <OUTPUT> [--coverage <REPORT>] "
+                 "[--pages <MAP>]\n";
+    return EXIT_FAILURE;
+  }
+
+  try {
+    const auto image = read_image(argv[1]);
+    opts.name = std::filesystem::path(argv[1]).filename().string();
+    if (!pages.empty()) {
+      opts.pages = SynacorVM::page_map::load(pages);
+    }
+    if (!coverage.empty()) {
+      const auto report = SynacorVM::coverage_report::load(coverage);
+      for (auto a = 0u; a < SynacorVM::Memory::heap_size; ++a) {
+        if (report.blocks[a]) {
+          opts.entries.push_back(std::uint16_t(a));
+        }
+      }
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    std::ofstream out(argv[2]);
+    const auto stats = recompiler::translate(image, opts, out);
+    if (!out) {
+      throw std::runtime_error(std::format("could not write {}", argv[2]));
+    }
+    const std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    std::cerr << std::format(
+        "{} blocks of {} instructions in {:.1f} ms: {} check their pages, "
+        "{} left to the interpreter\n",
+        stats.blocks, stats.instructions, elapsed.count(), stats.checked,
+        stats.skipped);
+  } catch (std::exception &e) {
+    std::cerr << std::format("recompile: {}\n", e.what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,335 @@
+#include "recompiler.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arch/arch.hpp"
+#include "disassembler/lib/disassembler.hpp"
+#include "vm/lib/control_flow.hpp"
+#include "vm/lib/memory.hpp"
+#include "vm/lib/self_modification.hpp"
+
+namespace recompiler {
+
+namespace {
+
+using SynacorVM::control_flow_graph;
+using SynacorVM::Memory;
+
+constexpr std::uint16_t first_register = 0x8000;
+constexpr std::size_t words_per_line = 12;
+
+std::string operand(std::uint16_t w) {
+  if (w >= first_register) {
+    return std::format("r{}", w - first_register);
+  }
+  return std::format("0x{:04x}", w);
+}
+
+// Writes the body of the translated function, block by block
+class writer {
+public:
+  writer(Memory const &memory, std::bitset<Memory::heap_size> const &leaders,
+         std::ostream &out)
+      : memory(memory), leaders(leaders), out(out) {}
+
+  void block(control_flow_graph::block const &b, bool checked) {
+    first = b.first;
+    last = std::uint16_t(b.end - 1);
+    this->checked = checked;
+
+    out << std::format("\nb_{:04x}:\n", b.first);
+    if (checked) {
+      out << std::format("  if (m.stale(0x{:04x}, 0x{:04x})) {{\n"
+                         "    ip = 0x{:04x};\n"
+                         "    goto fallback;\n"
+                         "  }}\n",
+                         first, last, first);
+    }
+
+    for (std::uint32_t a = b.first; a < b.end;) {
+      const auto i = SynacorVM::decode(memory, a);
+      instruction(i);
+      a += i.length;
+    }
+
+    switch (b.exit) {
+    case JT:
+    case JF:
+    case CALL:
+      out << "  " << jump(b.next) << '\n';
+      break;
+    case HALT:
+    case JMP:
+    case RET:
+    case ERROR:
+      break;
+    default:
+      // Runs off the end of the heap
+      out << std::format("  ip = 0x{:04x};\n  goto fallback;\n", b.end);
+      break;
+    }
+  }
+
+private:
+  // Goes to a literal address
+  std::string jump(std::uint32_t address) const {
+    if (address < Memory::heap_size && leaders[address]) {
+      return std::format("goto b_{:04x};", address);
+    }
+    return std::format("ip = 0x{:04x};\n  goto fallback;", address);
+  }
+
+  // Goes to an address in a register or a literal
+  std::string jump_to(std::uint16_t w) const {
+    if (w >= first_register) {
+      return std::format("ip = {};\n  goto dispatch;", operand(w));
+    }
+    return jump(w);
+  }
+
+  // Lets the interpreter run the instruction, and report its errors
+  std::string interpret(std::uint32_t address) const {
+    return std::format("ip = 0x{:04x};\n  goto fallback;", address);
+  }
+
+  void instruction(SynacorVM::instruction const &i) {
+    std::string comment(arch::to_string(i.verb));
+    for (unsigned n = 0; n + 1 < i.length; ++n) {
+      comment += ' ' + operand(i.operands[n]);
+    }
+    out << std::format("  // 0x{:04x}: {}\n", i.address, comment);
+
+    const auto a = operand(i.operands[0]);
+    const auto b = operand(i.operands[1]);
+    const auto c = operand(i.operands[2]);
+    const auto next = std::uint32_t(i.address + i.length);
+    std::string code;
+    switch (i.verb) {
+    case HALT:
+      code = "ip = SynacorVM::native::halted;\n  goto fallback;";
+      break;
+    case SET:
+      code = std::format("{} = {};", a, b);
+      break;
+    case PUSH:
+      code = std::format("m.push({});", a);
+      break;
+    case POP:
+      code = std::format("if (m.stack_empty()) {{\n    {}\n  }}\n  {} = m.pop();",
+                         indent(interpret(i.address)), a);
+      break;
+    case EQ:
+      code = std::format("{} = {} == {};", a, b, c);
+      break;
+    case GT:
+      code = std::format("{} = {} > {};", a, b, c);
+      break;
+    case JMP:
+      code = jump_to(i.operands[0]);
+      break;
+    case JT:
+    case JF:
+      code = std::format("if ({} {} 0) {{\n    {}\n  }}", a,
+                         i.verb == JT ? "!=" : "==",
+                         indent(jump_to(i.operands[1])));
+      break;
+    case ADD:
+      code = std::format("{} = std::uint16_t(({} + {}) % 0x8000);", a, b, c);
+      break;
+    case MULT:
+      code = std::format(
+          "{} = std::uint16_t((std::uint32_t({}) * {}) % 0x8000);", a, b, c);
+      break;
+    case MOD:
+      // Division by zero is left to the interpreter
+      code = i.operands[2] == 0
+                 ? interpret(i.address)
+                 : std::format("{} = std::uint16_t({} % {});", a, b, c);
+      break;
+    case AND:
+      code = std::format("{} = std::uint16_t({} & {});", a, b, c);
+      break;
+    case OR:
+      code = std::format("{} = std::uint16_t({} | {});", a, b, c);
+      break;
+    case NOT:
+      code = std::format("{} = std::uint16_t(~{} & 0x7fff);", a, b);
+      break;
+    case RMEM:
+      // Registers have addresses too, but they are in locals
+      code = std::format("{} = m.read({});", a, b);
+      if (i.operands[1] >= first_register) {
+        code = std::format("if ({} >= 0x8000) {{\n    {}\n  }}\n  {}", b,
+                           indent(interpret(i.address)), code);
+      }
+      break;
+    case WMEM:
+      code = std::format("m.write({}, {});", a, b);
+      if (i.operands[0] >= first_register) {
+        code = std::format("if ({} >= 0x8000) {{\n    {}\n  }}\n  {}", a,
+                           indent(interpret(i.address)), code);
+      }
+      if (checked) {
+        // The block may have written itself
+        code += std::format("\n  if (m.stale(0x{:04x}, 0x{:04x})) {{\n    {}\n  }}",
+                            first, last, indent(interpret(next)));
+      }
+      break;
+    case CALL:
+      code = std::format("m.push(0x{:04x});\n  {}", next,
+                         jump_to(i.operands[0]));
+      break;
+    case RET:
+      code = std::format("if (m.stack_empty()) {{\n    {}\n  }}\n"
+                         "  ip = m.pop();\n  goto dispatch;",
+                         indent(interpret(i.address)));
+      break;
+    case OUT:
+      code = std::format("m.out({});", a);
+      break;
+    case IN:
+      code = std::format("{} = m.in();", a);
+      break;
+    case NOOP:
+      break;
+    case ERROR:
+      code = interpret(i.address);
+      break;
+    }
+    if (!code.empty()) {
+      out << "  " << code << '\n';
+    }
+  }
+
+  static std::string indent(std::string s) {
+    for (auto n = s.find('\n'); n != std::string::npos;
+         n = s.find('\n', n + 1)) {
+      s.insert(n + 1, "  ");
+    }
+    return s;
+  }
+
+  Memory const &memory;
+  std::bitset<Memory::heap_size> const &leaders;
+  std::ostream &out;
+
+  // Current block
+  std::uint16_t first = 0;
+  std::uint16_t last = 0;
+  bool checked = true;
+};
+
+} // namespace
+
+statistics translate(std::basic_string_view<std::byte> image,
+                     options const &opts, std::ostream &out) {
+  // Code is what the disassembler finds, and the blocks of the control flow
+  // graph reachable from there
+  std::vector<std::uint16_t> entries = {0};
+  entries.insert(entries.end(), opts.entries.begin(), opts.entries.end());
+  const auto l = disasm::listing::analyze(image, entries);
+  for (std::size_t a = 0; a < l.words().size(); ++a) {
+    if (l.at(a) == disasm::listing::role::INSTRUCTION &&
+        l.label(a).has_value()) {
+      entries.push_back(std::uint16_t(a));
+    }
+  }
+
+  Memory memory;
+  memory.load(std::basic_string<std::byte>(image));
+  control_flow_graph graph(memory);
+  graph.explore(entries);
+
+  statistics stats;
+  std::vector<control_flow_graph::block> blocks;
+  std::bitset<Memory::heap_size> leaders;
+  for (auto const &b : graph.blocks()) {
+    if (opts.pages.has_value() && !opts.pages->stable(b.first, b.end - 1)) {
+      ++stats.skipped;
+      continue;
+    }
+    blocks.push_back(b);
+    leaders.set(b.first);
+  }
+
+  out << std::format("// Translated from {} by recompile\n", opts.name)
+      << "#include <array>\n"
+         "#include <cstdint>\n"
+         "\n"
+         "#include \"lib/native.hpp\"\n"
+         "\n"
+         "namespace {\n"
+         "\n";
+
+  const auto words = l.words();
+  out << std::format("constexpr std::array<std::uint16_t, {}> image = {{",
+                     words.size());
+  for (std::size_t a = 0; a < words.size(); ++a) {
+    out << (a % words_per_line == 0 ? "\n   " : "")
+        << std::format(" 0x{:04x},", words[a]);
+  }
+  out << "\n};\n\n";
+
+  out << std::format(
+      "constexpr std::array<SynacorVM::native::block, {}> blocks = {{",
+      blocks.size());
+  for (auto const &b : blocks) {
+    out << std::format("\n    SynacorVM::native::block{{0x{:04x}, 0x{:04x}}},",
+                       b.first, b.end);
+  }
+  out << "\n};\n\n";
+
+  out << "std::uint32_t translated(SynacorVM::native &m, std::uint32_t ip) {\n";
+  for (unsigned r = 0; r < Memory::register_count; ++r) {
+    out << std::format("  std::uint16_t r{} = m.get_register({});\n", r, r);
+  }
+  out << "  goto dispatch;\n"
+         "\n"
+         "dispatch:\n"
+         "  switch (ip) {\n";
+  for (auto const &b : blocks) {
+    out << std::format("  case 0x{:04x}:\n    goto b_{:04x};\n", b.first,
+                       b.first);
+  }
+  out << "  default:\n"
+         "    goto fallback;\n"
+         "  }\n";
+
+  writer w(memory, leaders, out);
+  for (auto const &b : blocks) {
+    const bool checked = !opts.pages.has_value();
+    w.block(b, checked);
+
+    ++stats.blocks;
+    stats.checked += checked ? 1 : 0;
+    for (std::uint32_t a = b.first; a < b.end;
+         a += SynacorVM::decode(memory, a).length) {
+      ++stats.instructions;
+    }
+  }
+
+  out << "\nfallback:\n";
+  for (unsigned r = 0; r < Memory::register_count; ++r) {
+    out << std::format("  m.set_register({}, r{});\n", r, r);
+  }
+  out << "  return ip;\n"
+         "}\n"
+         "\n"
+         "} // namespace\n"
+         "\n"
+         "int main() {\n"
+         "  static SynacorVM::native machine(image, blocks);\n"
+         "  return machine.run(translated);\n"
+         "}\n";
+  return stats;
+}
+
+} // namespace recompiler
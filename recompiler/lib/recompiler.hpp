@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "vm/lib/self_modification.hpp"
+
+namespace recompiler {
+
+struct options {
+  // Where code starts, besides address 0: the leaders of a coverage report
+  // find the code that only indirect jumps reach.
+  std::vector<std::uint16_t> entries = {};
+
+  // Pages of a run of the program. Blocks in modified pages are left to the
+  // interpreter, and blocks in the other pages are trusted not to change.
+  // Without it, every block checks its pages before it runs.
+  std::optional<SynacorVM::page_map> pages = std::nullopt;
+
+  // Name of the image, for the header of the output
+  std::string name = "image";
+};
+
+struct statistics {
+  std::size_t blocks = 0;
+  std::size_t instructions = 0;
+  std::size_t checked = 0; // Blocks that check their pages
+  std::size_t skipped = 0; // Blocks left to the interpreter
+};
+
+// Writes a C++ program that runs the image as `runvm` does. The code found by
+// disassembly is translated block by block into one function, with the
+// registers in locals and a switch for the indirect jumps. The program links
+// with libvm, whose interpreter runs the rest.
+statistics translate(std::basic_string_view<std::byte> image,
+                     options const &opts, std::ostream &out);
+
+} // namespace recompiler
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <doctest/doctest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "recompiler/lib/recompiler.hpp"
+#include "testutils/utils.hpp"
+#include "vm/lib/cpu.hpp"
+#include "vm/lib/memory.hpp"
+#include "vm/lib/self_modification.hpp"
+
+inline std::string read_text(std::string const &file_name) {
+  std::ifstream f(file_name, std::ios::binary);
+  std::stringstream ss;
+  ss << f.rdbuf();
+  return ss.str();
+}
+
+// What runvm prints for the input
+inline std::string interpret(std::string const &binary,
+                             std::string const &input) {
+  std::stringstream in(read_text(input));
+  std::stringstream out;
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out, .stdIn = &in};
+  ram.load(testutils::read_binary(binary));
+  vm.Run();
+  return out.str();
+}
+
+// What a translated program built by the tests prints for the input
+inline std::string run_native(std::string const &name,
+                              std::string const &input) {
+  const std::string output = "native.out";
+  const auto command =
+      std::format("{}/{} < {} > {}", NATIVE_DIR, name, input, output);
+  REQUIRE_EQ(std::system(command.c_str()), 0);
+  const auto text = read_text(output);
+  std::remove(output.c_str());
+  return text;
+}
+
+TEST_CASE("recompile") {
+  auto lock = SET_TEST_DIR();
+  const auto mix = testutils::fixture_path("recompile/mix");
+  const auto mix_input = "testdata/fixtures/recompile/mix.stdin";
+  const auto challenge = "../../docs/spec/challenge";
+  const auto challenge_input = "testdata/fixtures/recompile/challenge.stdin";
+
+  SUBCASE("translation") {
+    const auto image = testutils::read_binary(mix);
+    std::stringstream source;
+    const auto stats = recompiler::translate(image, {.name = "mix"}, source);
+    CHECK_EQ(stats.blocks, 9u);
+    CHECK_EQ(stats.instructions, 57u);
+    CHECK_EQ(stats.checked, 9u);
+    CHECK_EQ(stats.skipped, 0u);
+    testutils::check_golden("recompile/mix", source.str());
+
+    // Pages that the program modifies are left to the interpreter
+    SynacorVM::page_map pages;
+    pages.pages[0] = SynacorVM::page_kind::MODIFIED_CODE;
+    std::stringstream none;
+    const auto skipped =
+        recompiler::translate(image, {.pages = pages, .name = "mix"}, none);
+    CHECK_EQ(skipped.blocks, 0u);
+    CHECK_EQ(skipped.skipped, 9u);
+  }
+
+  // The programs are built with the tests, from the same fixtures
+  SUBCASE("native") {
+    CHECK_EQ(run_native("native_mix", mix_input), interpret(mix, mix_input));
+
+    const auto expected = interpret(challenge, challenge_input);
+    CHECK_NE(expected.find("What do you do?"), std::string::npos);
+    CHECK_EQ(run_native("native_challenge", challenge_input), expected);
+    CHECK_EQ(run_native("native_challenge_trusted", challenge_input),
+             expected);
+  }
+}
@@ -0,0 +1,65 @@
+    jmp main
+
+cell:
+    0
+
+main:
+    set r0 0
+    set r1 0
+outer:
+    add r1 r1 1
+inner:
+    add r0 r0 1
+    jt r0 inner
+    eq r2 r1 20
+    jf r2 outer
+    out 'L'
+    out '\n'
+
+    set r3 7
+    mult r4 r3 r3
+    mod r4 r4 10
+    add r4 r4 '0'
+    out r4
+    and r5 r4 0x0f
+    or r5 r5 0x40
+    out r5
+    not r6 0
+    gt r7 r6 10
+    add r7 r7 '0'
+    out r7
+    out '\n'
+
+    push 'P'
+    pop r0
+    out r0
+    wmem cell 'M'
+    rmem r0 cell
+    out r0
+    set r1 cell
+    wmem r1 'N'
+    rmem r2 r1
+    out r2
+    set r1 say
+    call r1
+    in r0
+    out r0
+    in r0
+    out r0
+    out '\n'
+
+    set r0 again
+    add r0 r0 1
+    wmem r0 'Z'
+again:
+    out 'W'
+    set r0 say
+    add r0 r0 1
+    wmem r0 'b'
+    call say
+    out '\n'
+    halt
+
+say:
+    out 'a'
+    ret
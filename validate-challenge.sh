@@ -28,7 +28,7 @@ validate() {
 }
 
 tmp=$(mktemp)
-./build/Release/vm/cmd/vmctl docs/spec/challenge < solution.txt | tee "$tmp"
+./build/Release/vm/cmd/vmctl docs/spec/challenge --script solution.txt | tee "$tmp"
 
 echo "---"
 
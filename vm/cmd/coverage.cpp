@@ -0,0 +1,113 @@
+#include <csignal>
+#include <cstdlib>
+#include <exception>
+#include <format>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "lib/control_flow.hpp"
+#include "lib/coverage.hpp"
+#include "lib/cpu.hpp"
+#include "lib/memory.hpp"
+#include "lib/self_modification.hpp"
+
+#include "helpers.hpp"
+
+volatile std::sig_atomic_t interrupted = 0;
+
+int merge(int argc, char **argv) {
+  try {
+    auto merged = SynacorVM::coverage_report::load(argv[3]);
+    for (int i = 4; i < argc; ++i) {
+      merged |= SynacorVM::coverage_report::load(argv[i]);
+    }
+    merged.save(argv[2]);
+    std::cerr << merged.summary() << std::flush;
+  } catch (std::exception &e) {
+    std::cerr << std::format("coverage: {}\n", e.what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+  if (argc >= 4 && std::string_view(argv[1]) == "--merge") {
+    return merge(argc, argv);
+  }
+
+  std::string report;
+  std::string pages;
+  bool usage = argc < 2 || argc % 2 != 0;
+  for (int i = 2; !usage && i < argc; i += 2) {
+    const std::string_view option = argv[i];
+    if (option == "--report") {
+      report = argv[i + 1];
+    } else if (option == "--pages") {
+      pages = argv[i + 1];
+    } else {
+      usage = true;
+    }
+  }
+  if (usage) {
+    std::cerr
+        << "Usage: coverage <BINARY> [--report <FILE>] [--pages <FILE>]\n"
+           "       coverage --merge <OUT> <REPORT>...\n";
+    exit(EXIT_FAILURE);
+  }
+
+  // Interrupting stops the machine, and the coverage so far is reported. No
+  // SA_RESTART, so that a pending read of input fails.
+  struct sigaction on_interrupt {};
+  on_interrupt.sa_handler = [](int) { interrupted = 1; };
+  ::sigaction(SIGINT, &on_interrupt, nullptr);
+
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram};
+  ram.load(read_binary(argv[1]));
+
+  // Both passes share the blocks of one graph
+  SynacorVM::control_flow_graph graph(ram);
+  SynacorVM::coverage cov(vm, graph);
+  vm.observers = {&graph, &cov};
+
+  // The static pass adds the writes of the code that does not run
+  std::optional<SynacorVM::page_map> written;
+  SynacorVM::self_modification smc(vm, graph);
+  if (!pages.empty()) {
+    written = SynacorVM::page_map::analyze(vm);
+    vm.observers.push_back(&smc);
+  }
+
+  try {
+    while (interrupted == 0 && vm.Step()) {
+    }
+  } catch (std::exception &e) {
+    if (interrupted == 0) {
+      std::cout << "\nFATAL ERROR\n" << e.what() << std::endl;
+    }
+  }
+  std::cout << std::flush;
+
+  std::cerr << cov.report().summary() << std::flush;
+  try {
+    if (!report.empty()) {
+      cov.report().save(report);
+    }
+    if (!pages.empty()) {
+      auto map = smc.map();
+      if (written.has_value()) {
+        map |= *written;
+      }
+      map.save(pages);
+      std::cerr << map.summary() << std::flush;
+    }
+  } catch (std::exception &e) {
+    std::cerr << std::format("coverage: {}\n", e.what());
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
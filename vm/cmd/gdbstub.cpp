@@ -0,0 +1,569 @@
+#include "gdbstub.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "arch/arch.hpp"
+#include "lib/cpu.hpp"
+#include "lib/debug.hpp"
+#include "lib/memory.hpp"
+#include "lib/word.hpp"
+
+namespace {
+
+constexpr unsigned pc_register = SynacorVM::Memory::register_count;
+constexpr unsigned memory_bytes = 2 * SynacorVM::Memory::heap_size;
+
+constexpr std::string_view target_xml =
+    R"(<?xml version="1.0"?>)"
+    R"(<!DOCTYPE target SYSTEM "gdb-target.dtd">)"
+    R"(<target version="1.0"><feature name="org.synacor.core">)"
+    R"(<reg name="r0" bitsize="16" type="uint16" regnum="0"/>)"
+    R"(<reg name="r1" bitsize="16" type="uint16"/>)"
+    R"(<reg name="r2" bitsize="16" type="uint16"/>)"
+    R"(<reg name="r3" bitsize="16" type="uint16"/>)"
+    R"(<reg name="r4" bitsize="16" type="uint16"/>)"
+    R"(<reg name="r5" bitsize="16" type="uint16"/>)"
+    R"(<reg name="r6" bitsize="16" type="uint16"/>)"
+    R"(<reg name="r7" bitsize="16" type="uint16"/>)"
+    R"(<reg name="pc" bitsize="16" type="code_ptr"/>)"
+    R"(</feature></target>)";
+
+[[noreturn]] void fail(std::string_view what) {
+  throw std::system_error(errno, std::generic_category(), std::string(what));
+}
+
+unsigned parse_hex(std::string_view s) {
+  unsigned v = 0;
+  const auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), v, 16);
+  if (ec != std::errc() || end != s.data() + s.size() || s.empty()) {
+    throw std::runtime_error(std::format("invalid number {}", s));
+  }
+  return v;
+}
+
+// Splits "a,b" or "a,b:c" style arguments at the first separator
+std::pair<std::string_view, std::string_view> split(std::string_view s,
+                                                    char separator) {
+  const auto i = s.find(separator);
+  if (i == std::string_view::npos) {
+    return {s, {}};
+  }
+  return {s.substr(0, i), s.substr(i + 1)};
+}
+
+void append_byte(std::string &out, unsigned b) {
+  out += std::format("{:02x}", b & 0xff);
+}
+
+// Registers and memory words are sent little-endian
+void append_word(std::string &out, SynacorVM::Word w) {
+  append_byte(out, w.to_uint());
+  append_byte(out, w.to_uint() >> 8);
+}
+
+SynacorVM::Word parse_word(std::string_view hex) {
+  if (hex.size() != 4) {
+    throw std::runtime_error(std::format("invalid register value {}", hex));
+  }
+  return SynacorVM::Word(parse_hex(hex.substr(0, 2)) |
+                         (parse_hex(hex.substr(2, 2)) << 8));
+}
+
+std::string checksum(std::string_view payload) {
+  unsigned sum = 0;
+  for (char c : payload) {
+    sum += static_cast<unsigned char>(c);
+  }
+  return std::format("{:02x}", sum & 0xff);
+}
+
+} // namespace
+
+gdb_stub::gdb_stub(int fd) : fd(fd) {}
+
+gdb_stub::~gdb_stub() {
+  if (fd >= 0) {
+    ::close(fd);
+  }
+}
+
+int gdb_stub::accept_client(std::string const &address) {
+  int server = -1;
+  if (address.starts_with("unix:")) {
+    const std::string path = address.substr(5);
+    sockaddr_un addr{};
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+      throw std::runtime_error(std::format("invalid socket path {}", path));
+    }
+    addr.sun_family = AF_UNIX;
+    std::ranges::copy(path, addr.sun_path);
+
+    server = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) {
+      fail("socket");
+    }
+    ::unlink(path.c_str());
+    if (::bind(server, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) <
+        0) {
+      fail(std::format("cannot bind {}", path));
+    }
+  } else {
+    const auto port = std::stoul(address);
+    if (port == 0 || port > 0xffff) {
+      throw std::runtime_error(std::format("invalid port {}", address));
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<std::uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    server = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (server < 0) {
+      fail("socket");
+    }
+    const int yes = 1;
+    ::setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (::bind(server, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) <
+        0) {
+      fail(std::format("cannot bind port {}", port));
+    }
+  }
+
+  if (::listen(server, 1) < 0) {
+    fail("listen");
+  }
+  const int client = ::accept(server, nullptr, nullptr);
+  ::close(server);
+  if (client < 0) {
+    fail("accept");
+  }
+
+  // Packets are small and answered one at a time
+  const int yes = 1;
+  ::setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+  return client;
+}
+
+void gdb_stub::install(SynacorVM::CPU &target) {
+  cpu = &target;
+  traps.at_instruction = 0;
+  step_target = 0;
+  stopped_at_start = true;
+
+  target.traps = &traps;
+  target.pre_exec_hook = [this](SynacorVM::execution_state es) { hook(es); };
+}
+
+void gdb_stub::finish() {
+  if (!attached) {
+    return;
+  }
+  send_packet("W00");
+  detach();
+}
+
+void gdb_stub::detach() {
+  attached = false;
+  traps = SynacorVM::trap_set{};
+  std::ignore = watches.take_hits();
+  if (cpu != nullptr) {
+    std::erase(cpu->observers, &watches);
+  }
+}
+
+bool gdb_stub::interrupt_pending() {
+  pollfd p{.fd = fd, .events = POLLIN, .revents = 0};
+  if (::poll(&p, 1, 0) <= 0) {
+    return false;
+  }
+
+  char c = 0;
+  if (::recv(fd, &c, 1, MSG_PEEK) <= 0) {
+    return true; // The client is gone: stop so that the read detaches
+  }
+  if (c == '\x03') {
+    std::ignore = ::recv(fd, &c, 1, 0);
+    return true;
+  }
+  return false;
+}
+
+std::string gdb_stub::stop_reason(SynacorVM::execution_state es) {
+  const auto count = cpu->instruction_count;
+  if (stopped_at_start) {
+    stopped_at_start = false;
+    return "S05";
+  }
+
+  if (traps.pending) {
+    traps.pending = false;
+    const auto hits = watches.take_hits();
+    if (!hits.empty()) {
+      const auto &h = hits.front();
+      const auto kind = h.kind == SynacorVM::watchpoints::READ ? "rwatch"
+                                                               : "watch";
+      return std::format("T05{}:{:x};", kind, 2 * h.address.to_uint());
+    }
+  }
+
+  if (count == step_target || traps.addresses[es.instruction_ptr.to_uint()]) {
+    return "S05";
+  }
+
+  if (count == next_poll && interrupt_pending()) {
+    return "S02";
+  }
+  return {};
+}
+
+void gdb_stub::hook(SynacorVM::execution_state es) {
+  if (!attached) {
+    return;
+  }
+
+  const bool initial = stopped_at_start;
+  const auto reason = stop_reason(es);
+  if (reason.empty()) {
+    next_poll = cpu->instruction_count + poll_interval;
+    traps.at_instruction = std::min(step_target, next_poll);
+    return;
+  }
+
+  // The client asks for the stop reason of the initial stop itself
+  if (!initial) {
+    send_packet(reason);
+  }
+
+  std::string packet;
+  bool resume = false;
+  while (!resume) {
+    if (!read_packet(packet)) {
+      detach();
+      return;
+    }
+    std::string reply;
+    try {
+      reply = handle(packet, es, resume);
+    } catch (std::exception &) {
+      reply = "E01";
+    }
+    if (!resume) {
+      send_packet(reply);
+    }
+  }
+
+  if (!attached) {
+    return;
+  }
+  next_poll = cpu->instruction_count + poll_interval;
+  traps.at_instruction = std::min(step_target, next_poll);
+}
+
+std::string gdb_stub::handle(std::string_view packet,
+                             SynacorVM::execution_state es, bool &resume) {
+  if (packet.empty()) {
+    return {};
+  }
+
+  const char verb = packet[0];
+  const auto args = packet.substr(1);
+  switch (verb) {
+  case '?':
+    return "S05";
+
+  case 'g':
+    return read_registers(es);
+
+  case 'G': {
+    if (args.size() != 4 * (pc_register + 1)) {
+      return "E01";
+    }
+    const auto pc = parse_word(args.substr(4 * pc_register, 4));
+    if (pc.to_uint() >= SynacorVM::Memory::heap_size) {
+      return "E01";
+    }
+    for (unsigned r = 0; r < pc_register; ++r) {
+      es.registers[r] = parse_word(args.substr(4 * r, 4));
+    }
+    cpu->instruction_pointer = SynacorVM::Number(pc);
+    return "OK";
+  }
+
+  case 'p': {
+    const auto r = parse_hex(args);
+    if (r > pc_register) {
+      return "E01";
+    }
+    std::string out;
+    append_word(out, r == pc_register
+                         ? SynacorVM::Word(cpu->instruction_pointer)
+                         : es.registers[r]);
+    return out;
+  }
+
+  case 'P': {
+    const auto [reg, value] = split(args, '=');
+    const auto r = parse_hex(reg);
+    const auto w = parse_word(value);
+    if (r > pc_register ||
+        (r == pc_register && w.to_uint() >= SynacorVM::Memory::heap_size)) {
+      return "E01";
+    }
+    if (r == pc_register) {
+      cpu->instruction_pointer = SynacorVM::Number(w);
+    } else {
+      es.registers[r] = w;
+    }
+    return "OK";
+  }
+
+  case 'm':
+    return read_memory(args);
+
+  case 'M':
+    return write_memory(args);
+
+  case 'Z':
+  case 'z':
+    return set_point(args, verb == 'Z');
+
+  case 'c':
+  case 's':
+    if (!args.empty()) {
+      const auto address = parse_hex(args) / 2;
+      if (address >= SynacorVM::Memory::heap_size) {
+        return "E01";
+      }
+      cpu->instruction_pointer = SynacorVM::Number(address);
+    }
+    step_target = verb == 's' ? cpu->instruction_count + 1
+                              : SynacorVM::trap_set::never;
+    resume = true;
+    return {};
+
+  case 'k':
+    // Same as !exit in vmctl
+    es.heap[cpu->instruction_pointer.to_uint()] =
+        SynacorVM::Word(static_cast<unsigned>(Verb::HALT));
+    detach();
+    resume = true;
+    return {};
+
+  case 'D':
+    send_packet("OK");
+    detach();
+    resume = true;
+    return {};
+
+  case 'H':
+    return "OK";
+
+  case 'q':
+    if (args.starts_with("Supported")) {
+      return "PacketSize=4000;qXfer:features:read+";
+    }
+    if (args == "Attached") {
+      return "1";
+    }
+    if (args == "C") {
+      return "QC1";
+    }
+    if (args == "fThreadInfo") {
+      return "m1";
+    }
+    if (args == "sThreadInfo") {
+      return "l";
+    }
+    if (constexpr std::string_view xfer = "Xfer:features:read:target.xml:";
+        args.starts_with(xfer)) {
+      return target_description(args.substr(xfer.size()));
+    }
+    return {};
+
+  default:
+    return {};
+  }
+}
+
+std::string gdb_stub::read_registers(SynacorVM::execution_state es) const {
+  std::string out;
+  for (unsigned r = 0; r < pc_register; ++r) {
+    append_word(out, es.registers[r]);
+  }
+  append_word(out, SynacorVM::Word(cpu->instruction_pointer));
+  return out;
+}
+
+std::string gdb_stub::read_memory(std::string_view args) const {
+  const auto [a, l] = split(args, ',');
+  const auto address = parse_hex(a);
+  const auto length = parse_hex(l);
+  if (address > memory_bytes || length > memory_bytes - address) {
+    return "E01";
+  }
+
+  std::string out;
+  out.reserve(2 * length);
+  for (unsigned b = address; b < address + length; ++b) {
+    const auto w = cpu->memory[SynacorVM::Number(b / 2)].to_uint();
+    append_byte(out, (b % 2) == 0 ? w : w >> 8);
+  }
+  return out;
+}
+
+std::string gdb_stub::write_memory(std::string_view args) {
+  const auto [range, data] = split(args, ':');
+  const auto [a, l] = split(range, ',');
+  const auto address = parse_hex(a);
+  const auto length = parse_hex(l);
+  if (address > memory_bytes || length > memory_bytes - address ||
+      data.size() != 2 * length) {
+    return "E01";
+  }
+
+  for (unsigned i = 0; i < length; ++i) {
+    const auto b = address + i;
+    const auto v = parse_hex(data.substr(2 * i, 2));
+    auto &w = cpu->memory[SynacorVM::Number(b / 2)];
+    const auto old = w.to_uint();
+    w = SynacorVM::Word((b % 2) == 0 ? (old & 0xff00) | v
+                                     : (old & 0x00ff) | (v << 8));
+  }
+  return "OK";
+}
+
+// Z0/Z1 are breakpoints, Z2/Z3/Z4 write/read/access watchpoints on the
+// words covering the byte range
+std::string gdb_stub::set_point(std::string_view args, bool insert) {
+  const auto [type, rest] = split(args, ',');
+  const auto [a, k] = split(rest, ',');
+  const auto address = parse_hex(a);
+  const auto length = std::max(parse_hex(k), 1u);
+  if (address >= memory_bytes || length > memory_bytes - address) {
+    return "E01";
+  }
+
+  const auto first = address / 2;
+  const auto last = (address + length - 1) / 2;
+  const auto t = parse_hex(type);
+  switch (t) {
+  case 0:
+  case 1:
+    traps.addresses[first] = insert;
+    return "OK";
+  case 2:
+  case 3:
+  case 4: {
+    const auto kind = t == 2   ? SynacorVM::watchpoints::WRITE
+                      : t == 3 ? SynacorVM::watchpoints::READ
+                               : SynacorVM::watchpoints::READ_WRITE;
+    for (auto w = first; w <= last; ++w) {
+      const SynacorVM::Word word(w);
+      const auto current = watches.get(word);
+      watches.set(word, SynacorVM::watchpoints::access(
+                            insert ? current | kind : current & ~kind));
+    }
+
+    // Watchpoints are only notified while some address is watched
+    std::erase(cpu->observers, &watches);
+    if (!watches.empty()) {
+      cpu->observers.push_back(&watches);
+    }
+    return "OK";
+  }
+  default:
+    return {};
+  }
+}
+
+std::string gdb_stub::target_description(std::string_view args) const {
+  const auto [o, l] = split(args, ',');
+  const auto offset = parse_hex(o);
+  const auto length = parse_hex(l);
+  if (offset >= target_xml.size()) {
+    return "l";
+  }
+  const auto chunk = target_xml.substr(offset, length);
+  return std::format("{}{}", offset + chunk.size() < target_xml.size() ? 'm'
+                                                                        : 'l',
+                     chunk);
+}
+
+bool gdb_stub::read_packet(std::string &packet) {
+  packet.clear();
+  char c = 0;
+
+  // Skip acknowledgements and stray interrupts up to the packet start
+  do {
+    if (::recv(fd, &c, 1, 0) <= 0) {
+      return false;
+    }
+  } while (c != '$');
+
+  while (true) {
+    if (::recv(fd, &c, 1, 0) <= 0) {
+      return false;
+    }
+    if (c == '#') {
+      break;
+    }
+    packet += c;
+  }
+
+  char sum[2];
+  for (char &s : sum) {
+    if (::recv(fd, &s, 1, 0) <= 0) {
+      return false;
+    }
+  }
+
+  const bool valid = checksum(packet) == std::string_view(sum, 2);
+  const char ack = valid ? '+' : '-';
+  if (::send(fd, &ack, 1, MSG_NOSIGNAL) != 1) {
+    return false;
+  }
+  return valid || read_packet(packet);
+}
+
+void gdb_stub::send_packet(std::string_view payload) {
+  const auto framed = std::format("${}#{}", payload, checksum(payload));
+
+  // Resend until acknowledged
+  while (true) {
+    std::size_t sent = 0;
+    while (sent < framed.size()) {
+      const auto n = ::send(fd, framed.data() + sent, framed.size() - sent,
+                            MSG_NOSIGNAL);
+      if (n <= 0) {
+        return;
+      }
+      sent += std::size_t(n);
+    }
+
+    char ack = 0;
+    do {
+      if (::recv(fd, &ack, 1, 0) <= 0) {
+        return;
+      }
+    } while (ack != '+' && ack != '-');
+    if (ack == '+') {
+      return;
+    }
+  }
+}
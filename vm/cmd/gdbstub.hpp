@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "lib/cpu.hpp"
+#include "lib/debug.hpp"
+#include "lib/memory.hpp"
+
+// gdb_stub lets a client speaking the GDB remote serial protocol drive the
+// machine. Registers are r0-r7 followed by pc, all 16 bits wide. Memory is
+// byte addressed: heap word w is at bytes 2w (low) and 2w+1 (high), as in
+// the binary image.
+//
+// Breakpoints are kept in the trap bitmap, so the machine runs at full speed
+// between them. The connection is polled for interrupts (Ctrl-C) every
+// poll_interval instructions.
+class gdb_stub {
+public:
+  constexpr static std::uint64_t poll_interval = 1 << 16;
+
+  // Takes ownership of a connected stream socket
+  explicit gdb_stub(int fd);
+  ~gdb_stub();
+
+  gdb_stub(gdb_stub const &) = delete;
+  gdb_stub &operator=(gdb_stub const &) = delete;
+
+  // Listens on a TCP port of localhost, or on unix:PATH, and waits for a
+  // client to connect. Returns the connected socket.
+  static int accept_client(std::string const &address);
+
+  // The machine stops before its first instruction and waits for the client
+  void install(SynacorVM::CPU &target);
+
+  // Reports the end of the program to the client, if still attached
+  void finish();
+
+  // Handles one packet and returns the reply, which is empty for unsupported
+  // packets. Returns nothing when the machine must resume.
+  std::string handle(std::string_view packet, SynacorVM::execution_state es,
+                     bool &resume);
+
+private:
+  void hook(SynacorVM::execution_state es);
+  std::string stop_reason(SynacorVM::execution_state es);
+  void detach();
+
+  bool read_packet(std::string &packet);
+  void send_packet(std::string_view payload);
+  bool interrupt_pending();
+
+  std::string read_registers(SynacorVM::execution_state es) const;
+  std::string read_memory(std::string_view args) const;
+  std::string write_memory(std::string_view args);
+  std::string set_point(std::string_view args, bool insert);
+  std::string target_description(std::string_view args) const;
+
+  int fd;
+  bool attached = true;
+  bool stopped_at_start = false;
+
+  SynacorVM::CPU *cpu = nullptr;
+  SynacorVM::trap_set traps;
+  SynacorVM::watchpoints watches{traps};
+
+  std::uint64_t step_target = SynacorVM::trap_set::never;
+  std::uint64_t next_poll = SynacorVM::trap_set::never;
+};
@@ -0,0 +1,52 @@
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <limits>
+#include <string>
+
+#include "lib/cpu.hpp"
+#include "lib/memory.hpp"
+#include "lib/session.hpp"
+
+#include "helpers.hpp"
+
+int main(int argc, char **argv) {
+  if (argc != 3 && argc != 4) {
+    std::cerr << "Usage: replay <BINARY> <LOG> [INSTRUCTION]\n";
+    exit(EXIT_FAILURE);
+  }
+
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram};
+  ram.load(read_binary(argv[1]));
+
+  try {
+    SynacorVM::session_replayer replayer(vm,
+                                         SynacorVM::session_log::load(argv[2]));
+
+    if (argc == 3) {
+      replayer.run_until(SynacorVM::session_replayer::forever);
+    } else {
+      replayer.seek(std::stoull(argv[3], nullptr, 0));
+    }
+
+    SynacorVM::execution_state es(vm);
+    std::cerr << std::format("\nStopped after {} instructions at 0x{:04x} "
+                             "({} checkpoints verified)\nRegisters:",
+                             vm.instruction_count, es.instruction_ptr.to_uint(),
+                             replayer.verified_checkpoints());
+    for (auto const &r : es.registers) {
+      std::cerr << std::format(" {:04x}", r.to_uint());
+    }
+    std::cerr << std::format("\nStack depth: {}\n", es.stack.size());
+  } catch (SynacorVM::replay_divergence &e) {
+    std::cerr << std::format("\nReplay diverged: {}\n", e.what());
+    return EXIT_FAILURE;
+  } catch (std::exception &e) {
+    std::cerr << std::format("\nReplay failed: {}\n", e.what());
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -1,4 +1,5 @@
 #include <array>
+#include <exception>
 #include <cstdlib>
 #include <format>
 #include <fstream>
@@ -6,28 +7,74 @@
 #include <ios>
 #include <iostream>
 #include <istream>
+#include <memory>
+#include <string>
+#include <string_view>
 
+#include "lib/control_flow.hpp"
 #include "lib/cpu.hpp"
 #include "lib/memory.hpp"
+#include "lib/profiler.hpp"
+#include "lib/symbols.hpp"
 
 #include "helpers.hpp"
 
 std::basic_string<std::byte> read_binary(std::string file_name);
 
 int main(int argc, char **argv) {
-  if (argc != 2) {
-    std::cerr << "Argc should be 2\n";
+  std::string folded_file;
+  std::string symbols_file;
+  bool usage = argc < 2 || argc % 2 != 0;
+  for (int i = 2; !usage && i < argc; i += 2) {
+    const std::string_view flag = argv[i];
+    if (flag == "--profile") {
+      folded_file = argv[i + 1];
+    } else if (flag == "--symbols") {
+      symbols_file = argv[i + 1];
+    } else {
+      usage = true;
+    }
+  }
+  const bool profile = !folded_file.empty();
+  if (usage || (!symbols_file.empty() && !profile)) {
+    std::cerr
+        << "Usage: runvm <BINARY> [--profile <FOLDED> [--symbols <FILE>]]\n";
     exit(EXIT_FAILURE);
   }
 
+  SynacorVM::symbol_table symbols;
+  if (!symbols_file.empty()) {
+    try {
+      symbols = SynacorVM::symbol_table::load(symbols_file);
+    } catch (std::exception &e) {
+      std::cerr << std::format("Invalid symbols {}: {}\n", symbols_file,
+                               e.what());
+      exit(EXIT_FAILURE);
+    }
+  }
+
   SynacorVM::Memory ram;
 
   SynacorVM::CPU vm{.memory = ram};
 
   ram.load(read_binary(argv[1]));
 
+  std::unique_ptr<SynacorVM::control_flow_graph> graph;
+  std::unique_ptr<SynacorVM::profiler> prof;
+  if (profile) {
+    graph = std::make_unique<SynacorVM::control_flow_graph>(ram);
+    prof = std::make_unique<SynacorVM::profiler>(*graph);
+    vm.observers = {graph.get(), prof.get()};
+  }
+
   vm.Run();
 
+  if (profile) {
+    std::ofstream folded(folded_file);
+    prof->write_folded(folded, symbols);
+    std::cerr << std::format("\nFolded stacks written to {}\n{}", folded_file,
+                             prof->report(20, symbols));
+  }
+
   return 0;
 }
-
@@ -0,0 +1,47 @@
+#include "script.hpp"
+
+#include <format>
+#include <istream>
+#include <string>
+#include <string_view>
+
+script script::parse(std::istream &in) {
+  script s;
+  std::string buff;
+  for (std::size_t number = 1; std::getline(in, buff); ++number) {
+    if (buff.starts_with("!!")) {
+      s.lines.push_back({number, false, buff.substr(1)});
+    } else {
+      s.lines.push_back({number, buff.starts_with("!"), buff});
+    }
+  }
+  return s;
+}
+
+std::string json_escape(std::string_view s) {
+  std::string out;
+  out.reserve(s.size());
+  for (char ch : s) {
+    switch (ch) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(ch) < 0x20) {
+        out += std::format("\\u{:04x}", static_cast<unsigned>(ch));
+      } else {
+        out += ch;
+      }
+    }
+  }
+  return out;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// script is a vmctl session read up front: the lines of input for the machine
+// and the debugger commands between them, in order.
+struct script {
+  struct line {
+    std::size_t number;
+    bool is_command;
+    std::string text; // With the escaping ! of input lines removed
+  };
+
+  // Outcome of one of the commands, once it ran
+  struct result {
+    std::size_t line;
+    std::string command;
+    std::uint64_t instruction;
+    std::string error; // Empty on success
+  };
+
+  std::vector<line> lines;
+  std::size_t next = 0;
+  std::vector<result> results = {};
+
+  static script parse(std::istream &in);
+};
+
+// Escapes s to be written inside the quotes of a JSON string.
+std::string json_escape(std::string_view s);
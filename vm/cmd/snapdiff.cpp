@@ -0,0 +1,25 @@
+#include <exception>
+#include <format>
+#include <iostream>
+
+#include "lib/snapshot.hpp"
+
+// Compares two snapshot files written by vmctl's !snap. Like diff, it exits
+// with 0 if they are the same, 1 if they differ and 2 on errors.
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: snapdiff <A.snap> <B.snap>\n";
+    return 2;
+  }
+
+  try {
+    const auto a = SynacorVM::snapshot::load(argv[1]);
+    const auto b = SynacorVM::snapshot::load(argv[2]);
+    const auto d = SynacorVM::snapshot_diff::compare(a, b);
+    std::cout << d.report(a, b) << std::flush;
+    return d.empty() ? 0 : 1;
+  } catch (std::exception &e) {
+    std::cerr << std::format("snapdiff: {}\n", e.what());
+    return 2;
+  }
+}
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "lib/cpu.hpp"
+#include "lib/lockstep.hpp"
+#include "lib/memory.hpp"
+#include "lib/snapshot.hpp"
+
+#include "helpers.hpp"
+
+// Runs a copy of the machine on the regular interpreter, for comparison.
+SynacorVM::lockstep::lane_result run_scalar(SynacorVM::snapshot const &start,
+                                            std::string const &input,
+                                            SynacorVM::Word r7,
+                                            std::uint64_t budget) {
+  std::istringstream in(input);
+  std::ostringstream out;
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out, .stdIn = &in};
+  start.restore(vm);
+  ram[SynacorVM::Word(0x8007)] = r7;
+
+  bool running = true;
+  try {
+    while (running && vm.instruction_count < budget) {
+      running = vm.Step();
+    }
+  } catch (std::exception &e) {
+    out << "\nFATAL ERROR\n" << e.what() << std::endl;
+    running = false;
+  }
+
+  return {
+      .state = SynacorVM::snapshot::take(vm),
+      .output = out.str(),
+      .halted = !running,
+  };
+}
+
+std::string_view last_line(std::string_view s) {
+  while (!s.empty() && s.back() == '\n') {
+    s.remove_suffix(1);
+  }
+  if (const auto nl = s.rfind('\n'); nl != std::string_view::npos) {
+    s.remove_prefix(nl + 1);
+  }
+  return s.substr(0, 60);
+}
+
+int main(int argc, char **argv) {
+  const bool scalar = argc == 8 && std::string_view(argv[7]) == "--scalar";
+  if (argc != 7 && !scalar) {
+    std::cerr << "Usage: sweep <BINARY> <INPUT> <START> <BUDGET> <FIRST> "
+                 "<LAST> [--scalar]\n\n"
+                 "Runs BINARY with INPUT as stdin for START instructions, and "
+                 "then once for\nevery value of r7 in [FIRST, LAST] until it "
+                 "halts or reaches BUDGET\ninstructions. Prints the last line "
+                 "of output of every run.\n";
+    exit(EXIT_FAILURE);
+  }
+
+  try {
+    std::ifstream f(argv[2]);
+    const std::string input{std::istreambuf_iterator<char>(f), {}};
+    const auto start_at = std::stoull(argv[3], nullptr, 0);
+    const auto budget = std::stoull(argv[4], nullptr, 0);
+    const auto first = std::stoul(argv[5], nullptr, 0);
+    const auto last = std::stoul(argv[6], nullptr, 0);
+    if (first > last || last > 0x7fff) {
+      throw std::runtime_error("r7 range must be within [0, 0x7fff]");
+    }
+
+    // Common prefix of every run
+    std::istringstream in(input);
+    std::ostringstream out;
+    SynacorVM::Memory ram;
+    SynacorVM::CPU vm{.memory = ram, .stdOut = &out, .stdIn = &in};
+    ram.load(read_binary(argv[1]));
+    while (vm.instruction_count < start_at && vm.Step()) {
+    }
+    const auto start = SynacorVM::snapshot::take(vm);
+    const auto rest = input.substr(std::size_t(in.tellg()));
+
+    const auto t0 = std::chrono::steady_clock::now();
+    std::vector<SynacorVM::lockstep::lane_result> results;
+    for (auto batch = first; batch <= last;
+         batch += SynacorVM::lockstep::lanes) {
+      if (scalar) {
+        for (auto r7 = batch; r7 <= std::min(last, batch + 15); ++r7) {
+          results.push_back(
+              run_scalar(start, rest, SynacorVM::Word(unsigned(r7)), budget));
+        }
+        continue;
+      }
+
+      SynacorVM::lockstep engine(start, rest);
+      for (auto l = 0u; l < SynacorVM::lockstep::lanes; ++l) {
+        const auto r7 = std::min(last, batch + l);
+        engine.set_register(l, 7, SynacorVM::Word(unsigned(r7)));
+      }
+      auto got = engine.run(budget);
+      got.resize(std::min<std::size_t>(got.size(), last - batch + 1));
+      std::move(got.begin(), got.end(), std::back_inserter(results));
+    }
+    const auto t1 = std::chrono::steady_clock::now();
+
+    for (auto i = 0u; i < results.size(); ++i) {
+      auto const &r = results[i];
+      std::cout << std::format(
+          "r7=0x{:04x} {: <7} {: >10} instructions ({: >8} in lockstep) | {}\n",
+          first + i, r.halted ? "halted" : "running",
+          r.state.instruction_count, r.lockstep_instructions,
+          last_line(r.output));
+    }
+
+    std::cerr << std::format(
+        "Swept {} values in {:.1f} ms ({})\n", results.size(),
+        std::chrono::duration<double, std::milli>(t1 - t0).count(),
+        scalar ? "scalar" : "lockstep");
+  } catch (std::exception &e) {
+    std::cerr << std::format("Sweep failed: {}\n", e.what());
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,78 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <format>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <string>
+
+#include "arch/arch.hpp"
+#include "lib/mapped_file.hpp"
+#include "lib/trace.hpp"
+
+#include "vmctl.hpp"
+
+// Appends a line in the style of !instr, followed by the effects of the
+// instruction.
+void print(std::string &out, SynacorVM::trace_record const &r) {
+  auto it = std::back_inserter(out);
+
+  std::format_to(it, "{:>10} 0x{:04x} | {: <4}", r.instruction, r.ip.to_uint(),
+                 arch::to_string(r.opcode));
+
+  const auto argc = arch::argument_count(r.opcode);
+  for (auto i = 0; i < argc; ++i) {
+    std::format_to(it, " {: >4}", parse_value(r.operands[unsigned(i)]));
+  }
+  for (auto i = argc; i < 3; ++i) {
+    std::format_to(it, "     ");
+  }
+
+  out += " |";
+  if (r.wrote) {
+    std::format_to(it, " {} <- {:04x}", parse_address(r.address),
+                   r.value.to_uint());
+  }
+  if (r.opcode == PUSH) {
+    std::format_to(it, " push {:04x}", r.pushed.to_uint());
+  }
+  out += '\n';
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 4) {
+    std::cerr << "Usage: tracedump <TRACE> [FIRST [LAST]]\n";
+    exit(EXIT_FAILURE);
+  }
+
+  try {
+    const std::uint64_t first = argc > 2 ? std::stoull(argv[2], nullptr, 0) : 0;
+    const std::uint64_t last = argc > 3
+                                   ? std::stoull(argv[3], nullptr, 0)
+                                   : std::numeric_limits<std::uint64_t>::max();
+
+    SynacorVM::mapped_file file(argv[1]);
+    SynacorVM::trace_reader reader(file.bytes());
+
+    std::string out;
+    SynacorVM::trace_record r;
+    while (reader.next(r) && r.instruction <= last) {
+      if (r.instruction < first) {
+        continue;
+      }
+      print(out, r);
+      if (out.size() >= (1 << 20)) {
+        std::fwrite(out.data(), out.size(), 1, stdout);
+        out.clear();
+      }
+    }
+    std::fwrite(out.data(), out.size(), 1, stdout);
+  } catch (std::exception &e) {
+    std::cerr << std::format("tracedump: {}\n", e.what());
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
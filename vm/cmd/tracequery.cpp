@@ -0,0 +1,122 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "lib/trace_index.hpp"
+#include "lib/word.hpp"
+
+#include "vmctl.hpp"
+
+void usage() {
+  std::cerr << "Usage: tracequery <TRACE> <QUERY>\n"
+               "Queries:\n"
+               "  writes <ADDR>          Every write to ADDR (or r0 to r7)\n"
+               "  last-write <ADDR> <N>  Last write to ADDR before instruction "
+               "N\n"
+               "  calls <ADDR>           Every call to ADDR with its "
+               "registers\n"
+               "  stack <N>              Calls in progress at instruction N\n"
+               "The index is built next to the trace (TRACE.idx) the first "
+               "time.\n";
+  exit(EXIT_FAILURE);
+}
+
+SynacorVM::Word read_address(std::string const &s) {
+  if (s.size() == 2 && s[0] == 'r' && s[1] >= '0' && s[1] <= '7') {
+    return SynacorVM::Word(0x8000 + (s[1] - '0'));
+  }
+  const auto a = std::stoul(s, nullptr, 0);
+  if (a >= SynacorVM::trace_index::address_count) {
+    throw std::runtime_error(std::format("Address {} is out of range", s));
+  }
+  return SynacorVM::Word(a);
+}
+
+void print_call(SynacorVM::trace_index const &index, std::uint64_t i) {
+  auto const &c = index.calls()[i];
+  std::cout << std::format("{:>10} {:04x} -> {:04x} depth {:>3} |", c.begin,
+                           c.caller, c.target, c.depth);
+  for (auto r : c.registers) {
+    std::cout << std::format("  {:04x}", r);
+  }
+  if (c.end == SynacorVM::trace_index::none) {
+    std::cout << " | never returned\n";
+  } else {
+    std::cout << std::format(" | returned at {}\n", c.end);
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 4) {
+    usage();
+  }
+
+  const std::string trace = argv[1];
+  const std::string query = argv[2];
+  const std::string index_file = trace + ".idx";
+
+  using clock = std::chrono::steady_clock;
+  const auto ms = [](auto d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  };
+
+  try {
+    const auto trace_size = std::filesystem::file_size(trace);
+
+    auto t0 = clock::now();
+    bool fresh = false;
+    if (!std::filesystem::exists(index_file) ||
+        std::filesystem::last_write_time(index_file) <
+            std::filesystem::last_write_time(trace)) {
+      SynacorVM::trace_index::build(
+          trace, index_file, std::max(1u, std::thread::hardware_concurrency()));
+      fresh = true;
+    }
+    SynacorVM::trace_index index(index_file, trace_size);
+    auto t1 = clock::now();
+
+    if (query == "writes" && argc == 4) {
+      const auto address = read_address(argv[3]);
+      for (auto const &w : index.writes(address)) {
+        std::cout << std::format("{:>10} {} <- {:04x}\n", w.instruction,
+                                 parse_address(address), w.value.to_uint());
+      }
+    } else if (query == "last-write" && argc == 5) {
+      const auto address = read_address(argv[3]);
+      const auto w = index.last_write(address, std::stoull(argv[4], nullptr, 0));
+      if (w.has_value()) {
+        std::cout << std::format("{:>10} {} <- {:04x}\n", w->instruction,
+                                 parse_address(address), w->value.to_uint());
+      } else {
+        std::cout << "Never written\n";
+      }
+    } else if (query == "calls" && argc == 4) {
+      for (auto i : index.calls_to(read_address(argv[3]))) {
+        print_call(index, i);
+      }
+    } else if (query == "stack" && argc == 4) {
+      for (auto i : index.stack_at(std::stoull(argv[3], nullptr, 0))) {
+        print_call(index, i);
+      }
+    } else {
+      usage();
+    }
+    auto t2 = clock::now();
+
+    std::cerr << std::format("{} index in {:.1f} ms, answered in {:.3f} ms\n",
+                             fresh ? "Built" : "Loaded", ms(t1 - t0),
+                             ms(t2 - t1));
+  } catch (std::exception &e) {
+    std::cerr << std::format("tracequery: {}\n", e.what());
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
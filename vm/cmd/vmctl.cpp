@@ -1,102 +1,435 @@
-#include <csignal>
-#include <cstdlib>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <format>
+#include <fstream>
 #include <memory>
+#include <optional>
 #include <ostream>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <utility>
 
 #include "arch/arch.hpp"
+#include "lib/control_flow.hpp"
 #include "lib/cpu.hpp"
+#include "lib/history.hpp"
 #include "lib/memory.hpp"
+#include "lib/profiler.hpp"
+#include "lib/session.hpp"
+#include "lib/snapshot.hpp"
+#include "lib/trace.hpp"
 #include "lib/word.hpp"
 
 #include "helpers.hpp"
 #include "vmctl.hpp"
 
-std::unique_ptr<coverage> cov(nullptr);
+void command_preprocessor::toggle_hook(
+    std::string const &name,
+    std::function<void(SynacorVM::execution_state)> &&f) {
+  if (auto it = other_prehooks.find(name); it != other_prehooks.end()) {
+    other_prehooks.erase(it);
+    update_traps();
+    std::cerr << std::format("Disabled {}\n", name) << std::flush;
+    return;
+  }
 
-int main(int argc, char **argv) {
-  if (argc != 2) {
-    std::cerr << "Argc should be 2\n";
-    exit(EXIT_FAILURE);
+  other_prehooks[name] = std::forward<decltype(f) &&>(f);
+  update_traps();
+  std::cerr << std::format("Enabled {}\n", name) << std::flush;
+  return;
+}
+
+void command_preprocessor::update_traps() {
+  // Input is always trapped so that it can be intercepted for commands
+  traps.opcodes = instr_breakpoints | (std::uint32_t(1) << unsigned(Verb::IN));
+  traps.every_instruction = !other_prehooks.empty();
+}
+
+void command_preprocessor::poke(SynacorVM::Word address,
+                                SynacorVM::Word value) {
+  cpu->memory[address] = value;
+  if (recorder != nullptr) {
+    recorder->patch(address, value);
   }
+}
 
-  ::signal(SIGINT, [](int) {
-    std::cout << std::endl;
-    std::cerr << std::endl;
+SynacorVM::control_flow_graph &command_preprocessor::shared_graph() {
+  if (graph == nullptr) {
+    graph = std::make_unique<SynacorVM::control_flow_graph>(cpu->memory);
+    attach(graph.get(), true);
+  }
+  return *graph;
+}
 
-    if (cov.get() != nullptr) {
-      std::cerr << cov->summary() << std::flush;
-    }
-    exit(EXIT_FAILURE);
-  });
+void command_preprocessor::attach(SynacorVM::observer *o, bool attached) {
+  auto &obs = cpu->observers;
+  const auto it = std::find(obs.begin(), obs.end(), o);
+  if (!attached && it != obs.end()) {
+    obs.erase(it);
+  } else if (attached && it == obs.end()) {
+    obs.push_back(o);
+  }
+}
 
-  SynacorVM::Memory ram;
-  SynacorVM::CPU vm{.memory = ram};
+void command_preprocessor::set_watchpoint(
+    SynacorVM::Word address, SynacorVM::watchpoints::access a) {
+  watches.set(address, a);
 
-  command_preprocessor p(std::cin, cov);
-  p.install(vm);
+  // The observer is only attached while a watchpoint is armed
+  attach(&watches, !watches.empty());
+}
 
-  ram.load(read_binary(argv[1]));
+void command_preprocessor::toggle_history() {
+  if (past != nullptr) {
+    attach(past.get(), false);
+    past.reset();
+    std::cerr << "Disabled execution history\n" << std::flush;
+    return;
+  }
 
-  vm.Run();
+  past = std::make_unique<SynacorVM::history>(*cpu);
+  attach(past.get(), true);
+  std::cerr << "Enabled execution history\n" << std::flush;
+}
 
-  if (cov.get() != nullptr) {
-    std::cerr << cov->summary() << std::flush;
+void command_preprocessor::toggle_trace(std::string const &file_name) {
+  if (tracer != nullptr) {
+    attach(tracer.get(), false);
+    tracer.reset();
+    std::cerr << "Stopped tracing\n" << std::flush;
+    return;
   }
-  return 0;
+
+  tracer = std::make_unique<SynacorVM::trace_writer>(*cpu, file_name);
+  attach(tracer.get(), true);
+  std::cerr << std::format("Tracing into {}\n", file_name) << std::flush;
 }
 
-void command_preprocessor::toggle_hook(
-    std::string const &name,
-    std::function<void(SynacorVM::execution_state)> &&f) {
-  if (auto it = other_prehooks.find(name); it != other_prehooks.end()) {
-    other_prehooks.erase(it);
-    std::cerr << std::format("Disabled {}\n", name) << std::flush;
+void command_preprocessor::toggle_profiler(std::string const &file_name) {
+  if (prof == nullptr) {
+    prof = std::make_unique<SynacorVM::profiler>(shared_graph());
+    profile_file = file_name;
+    attach(prof.get(), true);
+    std::cerr << "Enabled profiler\n" << std::flush;
     return;
   }
 
-  other_prehooks[name] = std::forward<decltype(f) &&>(f);
-  std::cerr << std::format("Enabled {}\n", name) << std::flush;
-  return;
+  attach(prof.get(), false);
+  std::ofstream folded(profile_file);
+  prof->write_folded(folded, symbols);
+  std::cerr << std::format("Folded stacks written to {}\n{}", profile_file,
+                           prof->report(20, symbols))
+            << std::flush;
+  prof.reset();
+}
+
+void command_preprocessor::toggle_call_stack(bool enable) {
+  if (enable == (calls != nullptr)) {
+    return;
+  }
+
+  if (enable) {
+    calls = std::make_unique<SynacorVM::call_stack>(*cpu);
+    attach(calls.get(), true);
+    std::cerr << "Tracking calls from now on\n" << std::flush;
+    return;
+  }
+
+  attach(calls.get(), false);
+  calls.reset();
+  std::cerr << "Stopped tracking calls\n" << std::flush;
+}
+
+// Number in any base, or nothing if `word` is not entirely a number
+static std::optional<unsigned long> parse_number(std::string const &word) {
+  std::size_t end = 0;
+  try {
+    const auto n = std::stoul(word, &end, 0);
+    if (end == word.size()) {
+      return n;
+    }
+  } catch (std::logic_error &) {
+  }
+  return std::nullopt;
+}
+
+unsigned long command_preprocessor::address_of(std::string const &word) const {
+  if (const auto n = parse_number(word); n.has_value()) {
+    return *n;
+  }
+
+  const auto plus = word.find('+');
+  const auto label = word.substr(0, plus);
+  const auto a = symbols.address_of(label);
+  if (!a.has_value()) {
+    throw std::runtime_error(std::format("unknown label '{}'", label));
+  }
+  if (plus == std::string::npos) {
+    return a->to_uint();
+  }
+
+  const auto offset = parse_number(word.substr(plus + 1));
+  if (!offset.has_value()) {
+    throw std::runtime_error(std::format("invalid offset in '{}'", word));
+  }
+  return a->to_uint() + *offset;
+}
+
+std::string command_preprocessor::backtrace() const {
+  const auto &frames = calls->frames();
+
+  // Without symbols, addresses are given relative to the function they are in
+  const auto describe = [&](SynacorVM::Word address, std::size_t depth) {
+    if (!symbols.empty()) {
+      return symbols.describe(address);
+    }
+    if (depth == 0) {
+      return std::string("start");
+    }
+    const auto entry = frames[depth - 1].target.to_int();
+    return std::format("0x{:04x}{:+}", entry, address.to_int() - entry);
+  };
+
+  // With a source map, the line of the source follows
+  const auto at = [&](SynacorVM::Word address) {
+    const auto where = symbols.where(address);
+    return where.empty() ? where : " at " + where;
+  };
+
+  std::string out;
+  const SynacorVM::Word ip(cpu->instruction_pointer);
+  out += std::format("#0  0x{:04x} in {}{}\n", ip.to_uint(),
+                     describe(ip, frames.size()), at(ip));
+  for (std::size_t i = frames.size(); i > 0; --i) {
+    const SynacorVM::Word site(frames[i - 1].call_site);
+    out += std::format("#{:<2} 0x{:04x} in {}{}\n", frames.size() - i + 1,
+                       site.to_uint(), describe(site, i - 1), at(site));
+  }
+  return out;
+}
+
+void command_preprocessor::take_snapshot(std::string const &name) {
+  auto s = SynacorVM::snapshot::take(*cpu);
+  const auto file_name = std::format("{}.snap", name);
+  s.save(file_name);
+  snapshots.insert_or_assign(name, std::move(s));
+  std::cerr << std::format("Snapshot {} saved to {}\n", name, file_name)
+            << std::flush;
+}
+
+SynacorVM::snapshot const &
+command_preprocessor::find_snapshot(std::string const &name) {
+  if (const auto it = snapshots.find(name); it != snapshots.end()) {
+    return it->second;
+  }
+  return snapshots.insert_or_assign(name, SynacorVM::snapshot::load(name))
+      .first->second;
+}
+
+void command_preprocessor::finish() {
+  if (prof != nullptr) {
+    toggle_profiler(profile_file);
+  }
+}
+
+void command_preprocessor::rewind(std::uint64_t instruction) {
+  if (past == nullptr) {
+    throw std::runtime_error("Enable the execution history with !history");
+  }
+  if (recorder != nullptr) {
+    throw std::runtime_error("Cannot go back while recording a session");
+  }
+  if (tracer != nullptr) {
+    throw std::runtime_error("Cannot go back while tracing");
+  }
+
+  queued_chars += past->rewind(instruction);
+
+  // A pending !step or !skip would otherwise stop again where it already did
+  traps.at_instruction = SynacorVM::trap_set::never;
+}
+
+void command_preprocessor::forget_calls() {
+  // The history does not know about calls: start over from here
+  if (calls != nullptr) {
+    calls->clear();
+    std::cerr << "Tracking calls from here on\n" << std::flush;
+  }
+}
+
+void command_preprocessor::reverse_continue() {
+  if (past == nullptr) {
+    throw std::runtime_error("Enable the execution history with !history");
+  }
+
+  const auto start = cpu->instruction_count;
+  while (true) {
+    if (cpu->instruction_count == past->oldest()) {
+      std::cerr << "Reached the start of the history\n" << std::flush;
+      break;
+    }
+    rewind(cpu->instruction_count - 1);
+
+    SynacorVM::execution_state es(*cpu);
+    const auto ip = es.instruction_ptr.to_uint();
+    const auto opcode = es.heap[ip].to_uint();
+    if (traps.addresses.test(ip) && breakpoint_condition_holds(es)) {
+      std::cerr << std::format("Stopped at breakpoint {:04x}\n", ip)
+                << std::flush;
+      break;
+    }
+    if (opcode < 32 && ((instr_breakpoints >> opcode) & 1) != 0) {
+      std::cerr << std::format("Stopped at instruction {}\n",
+                               arch::to_string(Verb(opcode)))
+                << std::flush;
+      break;
+    }
+  }
+
+  if (cpu->instruction_count != start) {
+    forget_calls();
+  }
+}
+
+bool command_preprocessor::breakpoint_condition_holds(
+    SynacorVM::execution_state es) const {
+  const auto it = conditions.find(es.instruction_ptr.to_uint());
+  return it == conditions.end() || it->second.evaluate(es);
+}
+
+bool command_preprocessor::stop_if_interrupted(SynacorVM::execution_state es) {
+  if (interrupted == 0) {
+    return false;
+  }
+
+  // Same as !exit, so that the recording ends here as well
+  poke(SynacorVM::Word(es.instruction_ptr),
+       SynacorVM::Word(static_cast<unsigned>(Verb::HALT)));
+  std::cerr << "\nInterrupted\n" << std::flush;
+  return true;
 }
 
 bool command_preprocessor::command(std::string cmd,
                                    SynacorVM::execution_state es) {
   std::stringstream ss{cmd};
+  last_error.clear();
   try {
     auto verb = next_word(ss);
     auto it = commands.find(verb);
     if (it == commands.end()) {
-      std::cerr << std::format("Unkown instruction {}\n", verb) << std::flush;
+      last_error = std::format("Unkown instruction {}", verb);
+      std::cerr << last_error << '\n' << std::flush;
       return false;
     }
 
     return it->second.f(es, ss);
 
   } catch (std::exception &e) {
+    last_error = e.what();
     std::cerr << std::format("Failed to execute command '{}': {}\n", cmd,
                              e.what())
               << std::flush;
     return false;
   } catch (...) {
+    last_error = "Unknown error";
     std::cerr << std::format("Failed to execute command '{}'\n", cmd)
               << std::flush;
     return false;
   }
 }
 
+bool command_preprocessor::next_line(std::string &buff, bool &is_command) {
+  if (batch.has_value()) {
+    if (batch->next == batch->lines.size()) {
+      return false;
+    }
+    auto const &line = batch->lines[batch->next++];
+    buff = line.text;
+    is_command = line.is_command;
+    return true;
+  }
+
+  if (in.eof()) {
+    return false;
+  }
+
+  std::getline(in, buff);
+  is_command = buff.starts_with("!");
+  if (is_command && buff.starts_with("!!")) {
+    is_command = false;
+    buff = std::string{buff.begin() + 1, buff.end()};
+  }
+  return true;
+}
+
+void command_preprocessor::load_script(script s) {
+  for (auto const &line : s.lines) {
+    if (!line.is_command) {
+      continue;
+    }
+    std::stringstream ss{line.text};
+    const auto verb = next_word(ss);
+    if (!commands.contains(verb)) {
+      throw std::runtime_error(
+          std::format("line {}: unknown command {}", line.number, verb));
+    }
+  }
+  batch = std::move(s);
+}
+
+void command_preprocessor::write_report(std::ostream &report,
+                                        std::string_view output,
+                                        double elapsed_ms) const {
+  SynacorVM::execution_state es(*cpu);
+
+  report << "{\n"
+         << std::format("  \"instructions\": {},\n", cpu->instruction_count)
+         << std::format("  \"elapsed_ms\": {:.3f},\n", elapsed_ms)
+         << std::format("  \"instruction_pointer\": {},\n",
+                        es.instruction_ptr.to_uint())
+         << "  \"registers\": [";
+  for (auto i = 0u; i < es.registers.size(); ++i) {
+    report << (i == 0 ? "" : ", ") << es.registers[i].to_uint();
+  }
+  report << "],\n  \"commands\": [";
+
+  if (batch.has_value()) {
+    for (auto i = 0u; i < batch->results.size(); ++i) {
+      auto const &r = batch->results[i];
+      report << (i == 0 ? "\n" : ",\n")
+             << std::format("    {{\"line\": {}, \"command\": \"{}\", "
+                            "\"instruction\": {}, \"ok\": {}",
+                            r.line, json_escape(r.command), r.instruction,
+                            r.error.empty());
+      if (!r.error.empty()) {
+        report << std::format(", \"error\": \"{}\"", json_escape(r.error));
+      }
+      report << "}";
+    }
+  }
+
+  report << "\n  ],\n"
+         << std::format("  \"output\": \"{}\"\n", json_escape(output))
+         << "}\n";
+}
+
 void command_preprocessor::install(SynacorVM::CPU &target) {
   assert(cpu == nullptr);
 
   cpu = &target;
   cpu->stdIn = &out;
   cpu->pre_exec_hook = [this](auto state) { this->pre_exec_hook(state); };
+  cpu->traps = &traps;
+  traps.signalled = &interrupted;
+  update_traps();
 }
 
 void command_preprocessor::pre_exec_hook(SynacorVM::execution_state es) {
-  const auto lock = defer([this]() { sleep = sleep < 0 ? sleep : sleep - 1; });
+  if (stop_if_interrupted(es)) {
+    return;
+  }
 
   for (auto const &hook : other_prehooks) {
     hook.second(es);
@@ -105,11 +438,15 @@ void command_preprocessor::pre_exec_hook(SynacorVM::execution_state es) {
   auto opcode = es.heap[es.instruction_ptr.to_uint()].to_uint();
 
   const bool addr_breakpoint =
-      addr_breakpoints.contains(es.instruction_ptr.to_uint());
-  const bool instr_breakpoint = instr_breakpoints.contains(opcode);
-
-  if (opcode != Verb::IN && sleep != 0 && !addr_breakpoint &&
-      !instr_breakpoint) {
+      traps.addresses.test(es.instruction_ptr.to_uint()) &&
+      breakpoint_condition_holds(es);
+  const bool instr_breakpoint =
+      opcode < 32 && ((instr_breakpoints >> opcode) & 1) != 0;
+  const bool wake_up = cpu->instruction_count == traps.at_instruction;
+  const bool watch_hit = std::exchange(traps.pending, false);
+
+  if (opcode != Verb::IN && !wake_up && !addr_breakpoint &&
+      !instr_breakpoint && !watch_hit) {
     return;
   }
 
@@ -117,7 +454,8 @@ void command_preprocessor::pre_exec_hook(SynacorVM::execution_state es) {
     queued_chars = queued_chars == 0 ? 0 : queued_chars - 1;
   }
 
-  if (queued_chars > 0 && sleep != 0 && !addr_breakpoint && !instr_breakpoint) {
+  if (queued_chars > 0 && !wake_up && !addr_breakpoint && !instr_breakpoint &&
+      !watch_hit) {
     return;
   }
 
@@ -126,6 +464,22 @@ void command_preprocessor::pre_exec_hook(SynacorVM::execution_state es) {
               << "Use !help for help and !cont to continue running the VM\n"
               << std::flush;
     first_instruction = false;
+  } else if (watch_hit) {
+    for (auto const &h : watches.take_hits()) {
+      if (h.kind == SynacorVM::watchpoints::READ) {
+        std::cerr << std::format(
+            "\nWatchpoint: {:04x} read {} (value {:04x})",
+            h.ip.to_uint(), parse_address(h.address), h.value.to_uint());
+      } else {
+        std::cerr << std::format(
+            "\nWatchpoint: {:04x} wrote {} ({:04x} -> {:04x})",
+            h.ip.to_uint(), parse_address(h.address), h.old_value.to_uint(),
+            h.value.to_uint());
+      }
+    }
+    std::cerr << std::format("\nStopped at {:04x}\n",
+                             es.instruction_ptr.to_uint())
+              << std::flush;
   } else if (addr_breakpoint) {
     std::cerr << std::format("\nStopped at breakpoint {:04x}\n",
                              es.instruction_ptr.to_uint())
@@ -138,35 +492,51 @@ void command_preprocessor::pre_exec_hook(SynacorVM::execution_state es) {
 
   while (queued_chars == 0 || opcode != Verb::IN) {
     std::string buff;
+    bool is_command = false;
 
-    if (in.eof()) {
+    if (!next_line(buff, is_command)) {
       enqueue(std::char_traits<char>::eof());
       return;
     }
 
-    std::getline(in, buff);
-
-    bool is_command = buff.starts_with("!");
-    if (is_command && buff.starts_with("!!")) {
-      is_command = false;
-      buff = std::string{buff.begin() + 1, buff.end()};
+    // Commands such as !rstep move the machine
+    SynacorVM::execution_state now(*cpu);
+    if (stop_if_interrupted(now)) {
+      return;
     }
 
     if (!is_command) {
       // Not a command
       out << buff << '\n';
-      queued_chars = buff.size() + 1;
+      queued_chars += buff.size() + 1;
       return;
     }
 
-    if (const bool cont = command(buff, es); cont && opcode != Verb::IN) {
+    const auto at = cpu->instruction_count;
+    const bool cont = command(buff, now);
+    if (batch.has_value()) {
+      batch->results.push_back({
+          .line = batch->lines[batch->next - 1].number,
+          .command = buff,
+          .instruction = at,
+          .error = last_error,
+      });
+    }
+    opcode = cpu->memory[cpu->instruction_pointer].to_uint();
+    if (cont && opcode != Verb::IN) {
       return;
-    } else {
-      continue;
     }
   }
 }
 
+std::string parse_address(SynacorVM::Word w) {
+  const auto v = w.to_uint();
+  if (v >= 0x8000 && v < 0x8008) {
+    return std::format("r{}", static_cast<int>(v - 0x8000));
+  }
+  return std::format("{:04x}", v);
+}
+
 std::string parse_value(SynacorVM::Word w) {
   const auto v = w.to_uint();
   if (v >= 0x8000 && v < 0x8008) {
@@ -2,19 +2,35 @@
 
 #include "arch/arch.hpp"
 #include "helpers.hpp"
+#include "script.hpp"
+#include "lib/call_stack.hpp"
+#include "lib/condition.hpp"
+#include "lib/control_flow.hpp"
+#include "lib/coverage.hpp"
 #include "lib/cpu.hpp"
+#include "lib/debug.hpp"
+#include "lib/history.hpp"
 #include "lib/memory.hpp"
+#include "lib/profiler.hpp"
+#include "lib/session.hpp"
+#include "lib/snapshot.hpp"
+#include "lib/symbols.hpp"
+#include "lib/trace.hpp"
 
+#include <algorithm>
 #include <concepts>
+#include <csignal>
+#include <cstdint>
 #include <cstdio>
 #include <format>
 #include <map>
 #include <memory>
+#include <optional>
 #include <ostream>
-#include <set>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
 
 struct command_preprocessor;
 
@@ -28,41 +44,9 @@ struct cmd {
 };
 
 std::string parse_value(SynacorVM::Word w);
+std::string parse_address(SynacorVM::Word w);
 std::string peek_instruction(SynacorVM::execution_state es);
 
-struct coverage {
-  std::array<bool, SynacorVM::Memory::heap_size> visited{};
-
-  [[nodiscard]] auto pre_exec_hook() {
-    return [this](SynacorVM::execution_state es) { this->update_coverage(es); };
-  }
-
-  [[nodiscard]] std::string summary() {
-    auto visit_count = std::count(visited.begin(), visited.end(), 0);
-    std::stringstream ss;
-    ss << "\n-------------\n"
-       << std::format("Covered {} addresses ({:.2} %)", visit_count,
-                      float(visit_count) / float(0x8000));
-    ss << "\n-------------\n";
-    return ss.str();
-  }
-
-private:
-  void update_coverage(SynacorVM::execution_state es) {
-    const SynacorVM::Word verb = es.heap[es.instruction_ptr.to_uint()];
-    const auto v = static_cast<Verb>(verb.to_uint());
-    const auto argc = arch::argument_count(v);
-    if (argc < 0) {
-      std::cerr << std::format("UNKNOWN {:x}\n", verb.to_uint());
-      return;
-    }
-
-    const auto begin = visited.begin() + es.instruction_ptr.to_uint();
-    const auto end = begin + 1 + argc;
-    std::fill(begin, end, true);
-  }
-};
-
 inline auto next_word(std::stringstream &ss) -> std::string {
   std::string v;
   ss >> v;
@@ -70,13 +54,17 @@ inline auto next_word(std::stringstream &ss) -> std::string {
 };
 
 struct command_preprocessor {
-  command_preprocessor(std::istream &in, std::unique_ptr<coverage> &cover)
+  command_preprocessor(std::istream &in,
+                       std::unique_ptr<SynacorVM::coverage> &cover)
       : in(in), commands{
                     cmd_setr(*this),   cmd_rmem(*this),       cmd_wmem(*this),
                     cmd_skipn(*this),  cmd_step(*this),       cmd_abreak(*this),
                     cmd_ibreak(*this), cmd_peek(*this),       cmd_instr(*this),
                     cmd_exit(*this),   cmd_cov(*this, cover), cmd_help(*this),
-                    cmd_cont(*this),   cmd_dump(*this)} {}
+                    cmd_cont(*this),   cmd_dump(*this),       cmd_watch(*this),
+                    cmd_history(*this), cmd_rstep(*this),     cmd_rcont(*this),
+                    cmd_trace(*this),  cmd_profile(*this),    cmd_bt(*this),
+                    cmd_snap(*this),   cmd_diff(*this)} {}
 
   void install(SynacorVM::CPU &target);
 
@@ -93,20 +81,50 @@ struct command_preprocessor {
     ++queued_chars;
   }
 
-  void set_sleep(long x) { sleep = x; }
+  // Stops after x more instructions. Negative values never stop.
+  void set_sleep(long x) {
+    traps.at_instruction = x < 0 ? SynacorVM::trap_set::never
+                                 : cpu->instruction_count +
+                                       static_cast<std::uint64_t>(x);
+  }
+
+  void set_recorder(SynacorVM::session_recorder *r) { recorder = r; }
+
+  // Labels used to describe addresses, e.g. in backtraces
+  void set_symbols(SynacorVM::symbol_table s) { symbols = std::move(s); }
+
+  // Address given as a number, or as "label" or "label+offset" if symbols
+  // were loaded
+  unsigned long address_of(std::string const &word) const;
+
+  // Writes to the heap or to a register (addresses 0x8000 to 0x8007) on
+  // behalf of the user. Recorded sessions replay these writes.
+  void poke(SynacorVM::Word address, SynacorVM::Word value);
+
+  // Control flow graph shared by the coverage and the profiler. It is
+  // attached on first use and stays attached: a graph that missed writes
+  // would keep stale blocks.
+  SynacorVM::control_flow_graph &shared_graph();
 
   bool toggle_addr_breakpoint(unsigned long x) {
-    if (x > SynacorVM::Memory::heap_size) {
+    if (x >= SynacorVM::Memory::heap_size) {
       throw std::runtime_error("cannot set debug point outside memory range");
     }
 
-    const auto u = unsigned(x);
-    if (addr_breakpoints.contains(u)) {
-      addr_breakpoints.erase(u);
-      return false;
+    conditions.erase(unsigned(x));
+    traps.addresses.flip(x);
+    return traps.addresses.test(x);
+  }
+
+  // Sets a breakpoint that only stops if the condition holds. The condition
+  // is only evaluated when the breakpoint's address is reached.
+  void set_conditional_breakpoint(unsigned long x, SynacorVM::condition c) {
+    if (x >= SynacorVM::Memory::heap_size) {
+      throw std::runtime_error("cannot set debug point outside memory range");
     }
-    addr_breakpoints.emplace(u);
-    return true;
+
+    conditions.insert_or_assign(unsigned(x), std::move(c));
+    traps.addresses.set(x);
   }
 
   bool toggle_instr_breakpoint(Verb v) {
@@ -115,17 +133,62 @@ struct command_preprocessor {
           "cannot set debug point outside instruction range");
     }
 
-    const auto u = unsigned(v);
-    if (instr_breakpoints.contains(u)) {
-      instr_breakpoints.erase(u);
-      return false;
-    }
-    instr_breakpoints.emplace(u);
-    return true;
+    instr_breakpoints ^= std::uint32_t(1) << unsigned(v);
+    update_traps();
+    return (instr_breakpoints >> unsigned(v)) & 1;
   }
 
+  void set_watchpoint(SynacorVM::Word address,
+                      SynacorVM::watchpoints::access a);
+
+  void toggle_history();
+
+  // Starts writing a binary trace to file_name, or stops the current one.
+  void toggle_trace(std::string const &file_name);
+
+  // Starts profiling, or stops and writes the folded stacks to file_name.
+  void toggle_profiler(std::string const &file_name);
+
+  // Starts tracking calls for backtraces, or stops.
+  void toggle_call_stack(bool enable);
+
+  // One line per call in progress, innermost first, starting with the
+  // instruction about to run.
+  std::string backtrace() const;
+
+  // Keeps the state of the machine under `name`, and saves it to NAME.snap.
+  void take_snapshot(std::string const &name);
+
+  // Snapshot taken with take_snapshot, or else read from a snapshot file.
+  SynacorVM::snapshot const &find_snapshot(std::string const &name);
+
+  // Wraps up whatever is still running once the machine has stopped.
+  void finish();
+
+  // Reads commands and input from s instead of the input stream. Throws if
+  // it has unknown commands.
+  void load_script(script s);
+
+  // Results of a script in JSON, with the output of the machine.
+  void write_report(std::ostream &report, std::string_view output,
+                    double elapsed_ms) const;
+
+  // Moves the machine back to its state after `instruction` instructions.
+  void rewind(std::uint64_t instruction);
+
+  // Runs backwards until the previous breakpoint.
+  void reverse_continue();
+
+  // Restarts the call stack after going back, once per command.
+  void forget_calls();
+
+  // Set from the SIGINT handler. The machine halts before the next
+  // instruction.
+  static inline volatile std::sig_atomic_t interrupted = 0;
+
 private:
-  SynacorVM::CPU *cpu;
+  SynacorVM::CPU *cpu = nullptr;
+  SynacorVM::session_recorder *recorder = nullptr;
 
   std::map<std::string, std::function<void(SynacorVM::execution_state)>>
       other_prehooks;
@@ -138,26 +201,49 @@ private:
 
   bool first_instruction = true;
 
-  long sleep = 0;
-  std::set<unsigned> addr_breakpoints;
-  std::set<unsigned> instr_breakpoints;
+  std::optional<script> batch;
+  std::string last_error;
+
+  // The CPU only calls pre_exec_hook where one of these traps hits. The very
+  // first instruction is trapped to let the user pre-populate the input.
+  SynacorVM::trap_set traps{.at_instruction = 0};
+  std::uint32_t instr_breakpoints = 0;
+  std::map<unsigned, SynacorVM::condition> conditions;
+  SynacorVM::watchpoints watches{traps};
+  std::unique_ptr<SynacorVM::history> past;
+  std::unique_ptr<SynacorVM::trace_writer> tracer;
+  std::unique_ptr<SynacorVM::control_flow_graph> graph;
+  std::unique_ptr<SynacorVM::profiler> prof;
+  std::string profile_file;
+  std::unique_ptr<SynacorVM::call_stack> calls;
+  std::map<std::string, SynacorVM::snapshot> snapshots;
+  SynacorVM::symbol_table symbols;
 
   bool command(std::string cmd, SynacorVM::execution_state es);
+  bool next_line(std::string &buff, bool &is_command);
   void pre_exec_hook(SynacorVM::execution_state es);
+  bool stop_if_interrupted(SynacorVM::execution_state es);
+  bool breakpoint_condition_holds(SynacorVM::execution_state es) const;
+  void attach(SynacorVM::observer *o, bool attached);
+  void update_traps();
 
-  static std::pair<std::string, cmd> cmd_setr(command_preprocessor &) {
+  static std::pair<std::string, cmd> cmd_setr(command_preprocessor &p) {
     cmd command{
         .name = "!setr",
         .usage = "!setr <REG> <VALUE>",
         .help = "sets register REG to VALUE",
-        .f = [&](auto es, auto &argstream) -> bool {
+        .f = [&](auto, auto &argstream) -> bool {
           const auto reg = std::stoul(next_word(argstream), nullptr, 0);
           const auto value = std::stoul(next_word(argstream), nullptr, 0);
           if (value > 0xffff) {
             throw std::runtime_error(
                 "The value must be in the range [0, 0xfff]");
           }
-          es.registers.at(reg) = SynacorVM::Word(value);
+          if (reg >= SynacorVM::Memory::register_count) {
+            throw std::runtime_error("Invalid register");
+          }
+          p.poke(SynacorVM::Word(SynacorVM::Memory::heap_size + reg),
+                 SynacorVM::Word(value));
           std::cerr << std::format("Set register {} to 0x{:04x}\n", reg, value)
                     << std::flush;
           return false;
@@ -201,19 +287,22 @@ private:
                 }};
     return {command.name, command};
   }
-  static std::pair<std::string, cmd> cmd_wmem(command_preprocessor &) {
+  static std::pair<std::string, cmd> cmd_wmem(command_preprocessor &p) {
     cmd command{
         .name = "!wmem",
         .usage = "!wmem <ADDR> <VALUE>",
         .help = "writes value VALUE into memeory address ADDR.",
-        .f = [&](auto es, auto &argstream) -> bool {
+        .f = [&](auto, auto &argstream) -> bool {
           const auto addr = std::stoul(next_word(argstream), nullptr, 0);
           const auto value = std::stoul(next_word(argstream), nullptr, 0);
           if (value > 0xffff) {
             throw std::runtime_error(
                 "The value must be in the range [0, 0xfff]");
           }
-          es.heap.at(addr) = SynacorVM::Word(value);
+          if (addr >= SynacorVM::Memory::heap_size) {
+            throw std::runtime_error("Address out of range");
+          }
+          p.poke(SynacorVM::Word(addr), SynacorVM::Word(value));
           std::cerr << std::format("Set memory address 0x{:04x} to 0x{:04x}\n",
                                    addr, value)
                     << std::flush;
@@ -247,24 +336,214 @@ private:
                 }};
     return {command.name, command};
   }
-  static std::pair<std::string, cmd> cmd_abreak(command_preprocessor &p) {
-    cmd command{.name = "!abreak",
-                .usage = "!abreak <ADDRESS>",
-                .help = "Toggles a breakpoint at the specified address.",
+  static std::pair<std::string, cmd> cmd_history(command_preprocessor &p) {
+    cmd command{.name = "!history",
+                .usage = "!history",
+                .help = "Toggles recording the execution history needed to "
+                        "run backwards with !rstep and !rcont",
+                .f = [&](auto, auto &) -> bool {
+                  p.toggle_history();
+                  return false;
+                }};
+    return {command.name, command};
+  }
+  static std::pair<std::string, cmd> cmd_rstep(command_preprocessor &p) {
+    cmd command{
+        .name = "!rstep",
+        .usage = "!rstep [N]",
+        .help = "Goes back N instructions (1 by default). Output is not "
+                "taken back, but input is read again.",
+        .f = [&](auto, auto &argstream) -> bool {
+          const auto word = next_word(argstream);
+          const auto n = word.empty() ? 1 : std::stoull(word, nullptr, 0);
+          const auto now = p.cpu->instruction_count;
+          p.rewind(n > now ? 0 : now - n);
+          p.forget_calls();
+          std::cerr << peek_instruction(SynacorVM::execution_state(*p.cpu))
+                    << std::flush;
+          return false;
+        }};
+    return {command.name, command};
+  }
+  static std::pair<std::string, cmd> cmd_rcont(command_preprocessor &p) {
+    cmd command{.name = "!rcont",
+                .usage = "!rcont",
+                .help = "Runs backwards until the previous breakpoint",
+                .f = [&](auto, auto &) -> bool {
+                  p.reverse_continue();
+                  std::cerr << peek_instruction(
+                                   SynacorVM::execution_state(*p.cpu))
+                            << std::flush;
+                  return false;
+                }};
+    return {command.name, command};
+  }
+  static std::pair<std::string, cmd> cmd_trace(command_preprocessor &p) {
+    cmd command{.name = "!trace",
+                .usage = "!trace [FILE]",
+                .help = "Toggles writing a binary execution trace to FILE "
+                        "(trace.bin by default). Read it with tracedump",
                 .f = [&](auto, auto &argstream) -> bool {
-                  const auto s = std::stoul(next_word(argstream), nullptr, 0);
-                  if (p.toggle_addr_breakpoint(s)) {
-                    std::cerr << std::format("Added breakpoint at {:04x}\n", s)
-                              << std::flush;
-                  } else {
-                    std::cerr
-                        << std::format("Removed breakpoint at {:04x}\n", s)
-                        << std::flush;
+                  const auto file = next_word(argstream);
+                  p.toggle_trace(file.empty() ? "trace.bin" : file);
+                  return false;
+                }};
+    return {command.name, command};
+  }
+  static std::pair<std::string, cmd> cmd_profile(command_preprocessor &p) {
+    cmd command{.name = "!profile",
+                .usage = "!profile [FILE]",
+                .help = "Toggles the profiler. When stopped, it prints the "
+                        "hottest functions and addresses and writes folded "
+                        "stacks to FILE (profile.folded by default)",
+                .f = [&](auto, auto &argstream) -> bool {
+                  const auto file = next_word(argstream);
+                  p.toggle_profiler(file.empty() ? "profile.folded" : file);
+                  return false;
+                }};
+    return {command.name, command};
+  }
+  static std::pair<std::string, cmd> cmd_bt(command_preprocessor &p) {
+    cmd command{.name = "!bt",
+                .usage = "!bt [off]",
+                .help = "Prints the calls in progress, with labels if symbols "
+                        "were loaded. Calls are tracked from the first !bt "
+                        "on, until '!bt off'",
+                .f = [&](auto, auto &argstream) -> bool {
+                  const auto word = next_word(argstream);
+                  if (word == "off") {
+                    p.toggle_call_stack(false);
+                    return false;
                   }
+                  if (!word.empty()) {
+                    throw std::runtime_error("expected nothing or 'off'");
+                  }
+                  p.toggle_call_stack(true);
+                  std::cerr << p.backtrace() << std::flush;
                   return false;
                 }};
     return {command.name, command};
   }
+  static std::pair<std::string, cmd> cmd_snap(command_preprocessor &p) {
+    cmd command{.name = "!snap",
+                .usage = "!snap <NAME>",
+                .help = "Takes a snapshot of the machine called NAME, and "
+                        "saves it to NAME.snap",
+                .f = [&](auto, auto &argstream) -> bool {
+                  const auto name = next_word(argstream);
+                  if (name.empty()) {
+                    throw std::runtime_error("Missing snapshot name");
+                  }
+                  p.take_snapshot(name);
+                  return false;
+                }};
+    return {command.name, command};
+  }
+  static std::pair<std::string, cmd> cmd_diff(command_preprocessor &p) {
+    cmd command{
+        .name = "!diff",
+        .usage = "!diff <A> [B]",
+        .help = "Shows the words that differ between snapshots (or snapshot "
+                "files) A and B, by runs of addresses. B is the current "
+                "state of the machine by default",
+        .f = [&](auto, auto &argstream) -> bool {
+          const auto a = next_word(argstream);
+          const auto b = next_word(argstream);
+          if (a.empty()) {
+            throw std::runtime_error("Missing snapshot name");
+          }
+          const auto &from = p.find_snapshot(a);
+          const auto to = b.empty() ? SynacorVM::snapshot::take(*p.cpu)
+                                    : p.find_snapshot(b);
+          const auto d = SynacorVM::snapshot_diff::compare(from, to);
+          std::cerr << d.report(from, to) << std::flush;
+          return false;
+        }};
+    return {command.name, command};
+  }
+  static std::pair<std::string, cmd> cmd_abreak(command_preprocessor &p) {
+    cmd command{
+        .name = "!abreak",
+        .usage = "!abreak <A> [if <C>]",
+        .help = "Toggles a breakpoint at address or label A. With a "
+                "condition C, such as 'r0 == 6 && mem[0x0aac] > 3 && depth > "
+                "10', it sets a breakpoint that only stops if C holds.",
+        .f = [&](auto, auto &argstream) -> bool {
+          const auto s = p.address_of(next_word(argstream));
+
+          const auto keyword = next_word(argstream);
+          if (keyword == "if") {
+            std::string text;
+            std::getline(argstream, text);
+            p.set_conditional_breakpoint(s, SynacorVM::condition::parse(text));
+            std::cerr << std::format("Added breakpoint at {:04x} if{}\n", s,
+                                     text)
+                      << std::flush;
+            return false;
+          }
+          if (!keyword.empty()) {
+            throw std::runtime_error("expected 'if' after the address");
+          }
+
+          if (p.toggle_addr_breakpoint(s)) {
+            std::cerr << std::format("Added breakpoint at {:04x}\n", s)
+                      << std::flush;
+          } else {
+            std::cerr << std::format("Removed breakpoint at {:04x}\n", s)
+                      << std::flush;
+          }
+          return false;
+        }};
+    return {command.name, command};
+  }
+
+  static std::pair<std::string, cmd> cmd_watch(command_preprocessor &p) {
+    cmd command{
+        .name = "!watch",
+        .usage = "!watch <ADDR> [MODE]",
+        .help = "Stops after an instruction accesses ADDR (or register r0 "
+                "to r7). MODE is r, w (default), rw or off.",
+        .f = [&](auto, auto &argstream) -> bool {
+          const auto target = next_word(argstream);
+          auto address = 0ul;
+          if (target.size() == 2 && target[0] == 'r' && target[1] >= '0' &&
+              target[1] < '8') {
+            address = SynacorVM::Memory::heap_size +
+                      static_cast<unsigned long>(target[1] - '0');
+          } else {
+            address = p.address_of(target);
+          }
+
+          const auto mode = next_word(argstream);
+          auto a = SynacorVM::watchpoints::WRITE;
+          if (mode == "r") {
+            a = SynacorVM::watchpoints::READ;
+          } else if (mode == "rw") {
+            a = SynacorVM::watchpoints::READ_WRITE;
+          } else if (mode == "off") {
+            a = SynacorVM::watchpoints::NONE;
+          } else if (!mode.empty() && mode != "w") {
+            throw std::runtime_error("Access must be one of r, w, rw, off");
+          }
+
+          if (address > 0xffff) {
+            throw std::runtime_error("Address out of range");
+          }
+          p.set_watchpoint(SynacorVM::Word(unsigned(address)), a);
+          if (a == SynacorVM::watchpoints::NONE) {
+            std::cerr << std::format("Removed watchpoint at {}\n",
+                                     parse_address(SynacorVM::Word(address)))
+                      << std::flush;
+          } else {
+            std::cerr << std::format("Watching {} ({})\n",
+                                     parse_address(SynacorVM::Word(address)),
+                                     mode.empty() ? "w" : mode)
+                      << std::flush;
+          }
+          return false;
+        }};
+    return {command.name, command};
+  }
 
   static std::pair<std::string, cmd> cmd_ibreak(command_preprocessor &p) {
     cmd command{.name = "!ibreak",
@@ -319,24 +598,31 @@ private:
                 .help = "Stops the machine by overwriting a HALT at the "
                         "current position pointed by the instruction pointer",
                 .f = [&](auto es, auto &) -> bool {
-                  es.heap[es.instruction_ptr.to_uint()] =
-                      SynacorVM::Word(static_cast<unsigned>(Verb::HALT));
+                  p.poke(SynacorVM::Word(es.instruction_ptr),
+                         SynacorVM::Word(static_cast<unsigned>(Verb::HALT)));
                   std::cerr << "Exiting\n" << std::flush;
                   p.enqueue(std::char_traits<char>::eof());
                   return true;
                 }};
     return {command.name, command};
   }
-  static std::pair<std::string, cmd> cmd_cov(command_preprocessor &p,
-                                             std::unique_ptr<coverage> &cov) {
+  static std::pair<std::string, cmd>
+  cmd_cov(command_preprocessor &p, std::unique_ptr<SynacorVM::coverage> &cov) {
     cmd command{.name = "!cov",
                 .usage = "!cov",
                 .help = "Toggle coverage profiling",
                 .f = [&](auto, auto &) -> bool {
                   if (cov.get() == nullptr) {
-                    cov = std::make_unique<coverage>();
+                    cov = std::make_unique<SynacorVM::coverage>(
+                        *p.cpu, p.shared_graph());
                   }
-                  p.toggle_hook("compute coverage", cov->pre_exec_hook());
+                  const auto &obs = p.cpu->observers;
+                  const bool enable =
+                      std::find(obs.begin(), obs.end(), cov.get()) == obs.end();
+                  p.attach(cov.get(), enable);
+                  std::cerr << (enable ? "Enabled coverage\n"
+                                       : "Disabled coverage\n")
+                            << std::flush;
                   return false;
                 }};
     return {command.name, command};
@@ -0,0 +1,174 @@
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <exception>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include "lib/coverage.hpp"
+#include "lib/cpu.hpp"
+#include "lib/memory.hpp"
+#include "lib/session.hpp"
+#include "lib/symbols.hpp"
+
+#include "gdbstub.hpp"
+#include "helpers.hpp"
+#include "vmctl.hpp"
+
+std::unique_ptr<SynacorVM::coverage> cov(nullptr);
+std::unique_ptr<SynacorVM::session_recorder> recorder(nullptr);
+std::string record_file;
+
+void save_recording() {
+  if (recorder.get() == nullptr) {
+    return;
+  }
+  recorder->finish();
+  recorder->log().save(record_file);
+  std::cerr << std::format("Session recorded to {}\n", record_file)
+            << std::flush;
+}
+
+[[noreturn]] void usage() {
+  std::cerr << "Usage: vmctl <BINARY> [--record <LOG>] [--symbols <FILE>] "
+               "[--script <FILE> [--report <JSON>] | "
+               "--gdb <PORT|unix:PATH>]\n";
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc % 2 != 0) {
+    usage();
+  }
+
+  std::string script_file;
+  std::string report_file;
+  std::string gdb_address;
+  std::string symbols_file;
+  for (int i = 2; i < argc; i += 2) {
+    const std::string_view flag = argv[i];
+    if (flag == "--record") {
+      record_file = argv[i + 1];
+    } else if (flag == "--script") {
+      script_file = argv[i + 1];
+    } else if (flag == "--report") {
+      report_file = argv[i + 1];
+    } else if (flag == "--symbols") {
+      symbols_file = argv[i + 1];
+    } else if (flag == "--gdb") {
+      gdb_address = argv[i + 1];
+    } else {
+      usage();
+    }
+  }
+  if ((!report_file.empty() && script_file.empty()) ||
+      (!gdb_address.empty() && !script_file.empty())) {
+    usage();
+  }
+
+  // While recording, the session is saved once the machine halts before its
+  // next instruction: saving from within the signal handler is not safe.
+  // Interrupting the debugger again quits without saving.
+  struct sigaction on_interrupt {};
+  on_interrupt.sa_handler = [](int) {
+    if (recorder.get() != nullptr && command_preprocessor::interrupted == 0) {
+      command_preprocessor::interrupted = 1;
+      return;
+    }
+
+    std::cout << std::endl;
+    std::cerr << std::endl;
+
+    if (cov.get() != nullptr) {
+      std::cerr << cov->report().summary() << std::flush;
+    }
+    exit(EXIT_FAILURE);
+  };
+  // No SA_RESTART: a pending read of a command must be interrupted
+  ::sigaction(SIGINT, &on_interrupt, nullptr);
+
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram};
+
+  ram.load(read_binary(argv[1]));
+
+  command_preprocessor p(std::cin, cov);
+  if (!symbols_file.empty()) {
+    try {
+      p.set_symbols(SynacorVM::symbol_table::load(symbols_file));
+    } catch (std::exception &e) {
+      std::cerr << std::format("Invalid symbols {}: {}\n", symbols_file,
+                               e.what());
+      exit(EXIT_FAILURE);
+    }
+  }
+  std::unique_ptr<gdb_stub> gdb(nullptr);
+  if (gdb_address.empty()) {
+    p.install(vm);
+  } else {
+    // The remote debugger replaces the commands: stdin is the program's input
+    std::cerr << std::format("Waiting for a debugger on {}\n", gdb_address)
+              << std::flush;
+    try {
+      gdb = std::make_unique<gdb_stub>(gdb_stub::accept_client(gdb_address));
+    } catch (std::exception &e) {
+      std::cerr << std::format("Could not serve the debugger: {}\n",
+                               e.what());
+      exit(EXIT_FAILURE);
+    }
+    gdb->install(vm);
+  }
+
+  // Scripts run in batch: the output is kept for the report
+  std::stringstream output;
+  if (!script_file.empty()) {
+    std::ifstream f(script_file);
+    if (!f) {
+      std::cerr << std::format("Could not open script {}\n", script_file);
+      exit(EXIT_FAILURE);
+    }
+    try {
+      p.load_script(script::parse(f));
+    } catch (std::exception &e) {
+      std::cerr << std::format("Invalid script {}: {}\n", script_file,
+                               e.what());
+      exit(EXIT_FAILURE);
+    }
+    vm.stdOut = &output;
+  }
+
+  if (!record_file.empty()) {
+    recorder = std::make_unique<SynacorVM::session_recorder>(vm);
+    recorder->install();
+    p.set_recorder(recorder.get());
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  vm.Run();
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  p.finish();
+  if (gdb.get() != nullptr) {
+    gdb->finish();
+  }
+
+  if (!script_file.empty()) {
+    std::cout << output.str() << std::flush;
+    if (!report_file.empty()) {
+      std::ofstream report(report_file);
+      p.write_report(report, output.str(), elapsed.count());
+    }
+  }
+
+  if (cov.get() != nullptr) {
+    std::cerr << cov->report().summary() << std::flush;
+  }
+  save_recording();
+  return 0;
+}
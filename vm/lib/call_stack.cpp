@@ -0,0 +1,36 @@
+#include "call_stack.hpp"
+
+#include "arch/arch.hpp"
+#include "memory.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+void call_stack::on_instruction(Number ip) {
+  calling = cpu.memory[ip] == Word(static_cast<unsigned>(CALL));
+  if (!calling) {
+    return;
+  }
+
+  // The target is known before CALL pushes the return address
+  const Word a = cpu.memory[Number((ip.to_uint() + 1) % Memory::heap_size)];
+  pending.call_site = ip;
+  pending.target = a < Memory::heap_size ? a : cpu.memory[a];
+}
+
+void call_stack::on_push(Word) {
+  if (!calling) {
+    return;
+  }
+  calling = false;
+  pending.depth = cpu.memory.stack_ptr() + 1;
+  stack.push_back(pending);
+}
+
+void call_stack::on_pop(Word) {
+  if (!stack.empty() && stack.back().depth > cpu.memory.stack_ptr()) {
+    stack.pop_back();
+  }
+}
+
+} // namespace SynacorVM
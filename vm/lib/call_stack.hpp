@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "cpu.hpp"
+#include "observer.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+// call_stack follows CALL and RET to keep a shadow of the guest's call stack,
+// which the data stack alone does not tell apart from other values. It is an
+// observer, so it costs nothing unless attached.
+//
+// A frame ends when its return address leaves the data stack, whether by RET
+// or by POP, so that programs that unwind by hand do not leave stale frames.
+class call_stack : public observer {
+public:
+  struct frame {
+    Number call_site; // Address of the CALL instruction
+    Word target;      // Function called
+    std::size_t depth; // Size of the data stack with the return address
+
+    Word return_address() const noexcept {
+      return Word(call_site.to_uint() + 2);
+    }
+  };
+
+  explicit call_stack(CPU &cpu) : cpu(cpu) {}
+
+  // Outermost call first
+  std::vector<frame> const &frames() const noexcept { return stack; }
+
+  // Forgets every frame, e.g. after the machine's state has been replaced
+  void clear() noexcept { stack.clear(); }
+
+  void on_instruction(Number ip) override;
+  void on_push(Word value) override;
+  void on_pop(Word value) override;
+
+private:
+  CPU &cpu;
+  std::vector<frame> stack;
+
+  bool calling = false;
+  frame pending = {Number(0), Word(0), 0};
+};
+
+} // namespace SynacorVM
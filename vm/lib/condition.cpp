@@ -0,0 +1,308 @@
+#include "condition.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+// Precedence climbing parser emitting postfix bytecode
+class condition_parser {
+public:
+  explicit condition_parser(std::string_view text) : text(text) {}
+
+  condition parse() {
+    condition c;
+    c.m_text = std::string(text);
+    out = &c;
+
+    expression(0);
+    skip_space();
+    if (pos != text.size()) {
+      fail("unexpected trailing input");
+    }
+
+    c.stack_size = max_depth;
+    return c;
+  }
+
+private:
+  using op = condition::op;
+
+  struct binary_op {
+    std::string_view symbol;
+    int precedence;
+    op code;
+  };
+
+  // Longer symbols first so that "<=" is not read as "<"
+  constexpr static binary_op binary_ops[] = {
+      {"||", 1, op::OR},    {"&&", 2, op::AND},    {"==", 5, op::EQ},
+      {"!=", 5, op::NE},    {"<=", 6, op::LE},     {">=", 6, op::GE},
+      {"|", 3, op::BIT_OR}, {"&", 4, op::BIT_AND}, {"<", 6, op::LT},
+      {">", 6, op::GT},     {"+", 7, op::ADD},     {"-", 7, op::SUB},
+      {"*", 8, op::MUL},    {"/", 8, op::DIV},     {"%", 8, op::MOD},
+  };
+
+  std::string_view text;
+  std::size_t pos = 0;
+  condition *out = nullptr;
+  std::size_t depth = 0;
+  std::size_t max_depth = 0;
+
+  [[noreturn]] void fail(std::string_view what) const {
+    throw std::runtime_error(
+        std::format("{} at column {} of condition '{}'", what, pos + 1, text));
+  }
+
+  void emit(op code, std::int64_t arg = 0) {
+    switch (code) {
+    case op::CONST:
+    case op::REG:
+    case op::DEPTH:
+    case op::IP:
+      max_depth = std::max(max_depth, ++depth);
+      break;
+    case op::MEM:
+    case op::NOT:
+    case op::COMPL:
+    case op::NEG:
+      break;
+    default:
+      --depth;
+    }
+    out->code.push_back({code, arg});
+  }
+
+  void skip_space() {
+    while (pos < text.size() &&
+           std::isspace(static_cast<unsigned char>(text[pos]))) {
+      ++pos;
+    }
+  }
+
+  bool accept(std::string_view symbol) {
+    skip_space();
+    if (text.substr(pos).starts_with(symbol)) {
+      pos += symbol.size();
+      return true;
+    }
+    return false;
+  }
+
+  std::string_view identifier() {
+    skip_space();
+    const auto begin = pos;
+    while (pos < text.size() &&
+           (std::isalnum(static_cast<unsigned char>(text[pos])) ||
+            text[pos] == '_')) {
+      ++pos;
+    }
+    return text.substr(begin, pos - begin);
+  }
+
+  void expression(int min_precedence) {
+    unary();
+    while (true) {
+      skip_space();
+      binary_op const *found = nullptr;
+      for (auto const &b : binary_ops) {
+        if (text.substr(pos).starts_with(b.symbol)) {
+          found = &b;
+          break;
+        }
+      }
+      if (found == nullptr || found->precedence < min_precedence) {
+        return;
+      }
+      pos += found->symbol.size();
+      expression(found->precedence + 1);
+      emit(found->code);
+    }
+  }
+
+  void unary() {
+    if (accept("!")) {
+      unary();
+      emit(op::NOT);
+    } else if (accept("~")) {
+      unary();
+      emit(op::COMPL);
+    } else if (accept("-")) {
+      unary();
+      emit(op::NEG);
+    } else {
+      primary();
+    }
+  }
+
+  void primary() {
+    if (accept("(")) {
+      expression(0);
+      if (!accept(")")) {
+        fail("expected ')'");
+      }
+      return;
+    }
+
+    const auto word = identifier();
+    if (word.empty()) {
+      fail("expected an operand");
+    }
+
+    if (std::isdigit(static_cast<unsigned char>(word[0]))) {
+      const auto s = std::string(word);
+      std::size_t used = 0;
+      unsigned long v = 0;
+      try {
+        v = std::stoul(s, &used, 0);
+      } catch (std::exception &) {
+        used = 0;
+      }
+      if (used != s.size()) {
+        fail(std::format("invalid number '{}'", word));
+      }
+      emit(op::CONST, static_cast<std::int64_t>(v));
+    } else if (word.size() == 2 && word[0] == 'r' && word[1] >= '0' &&
+               word[1] < '8') {
+      emit(op::REG, word[1] - '0');
+    } else if (word == "depth") {
+      emit(op::DEPTH);
+    } else if (word == "ip") {
+      emit(op::IP);
+    } else if (word == "mem") {
+      if (!accept("[")) {
+        fail("expected '[' after mem");
+      }
+      expression(0);
+      if (!accept("]")) {
+        fail("expected ']'");
+      }
+      emit(op::MEM);
+    } else {
+      fail(std::format("unknown operand '{}'", word));
+    }
+  }
+};
+
+condition condition::parse(std::string_view text) {
+  return condition_parser(text).parse();
+}
+
+bool condition::evaluate(execution_state const &es) const {
+  // Conditions are short: avoid allocating for the common case
+  constexpr std::size_t small = 32;
+  std::int64_t small_stack[small] = {};
+  std::vector<std::int64_t> big_stack;
+  std::int64_t *stack = small_stack;
+  if (stack_size > small) {
+    big_stack.resize(stack_size);
+    stack = big_stack.data();
+  }
+
+  std::size_t top = 0; // Number of values in the stack
+  const auto bin = [&](auto f) {
+    --top;
+    stack[top - 1] = static_cast<std::int64_t>(f(stack[top - 1], stack[top]));
+  };
+
+  for (auto const &ins : code) {
+    switch (ins.code) {
+    case op::CONST:
+      stack[top++] = ins.arg;
+      break;
+    case op::REG:
+      stack[top++] = es.registers[std::size_t(ins.arg)].to_int();
+      break;
+    case op::DEPTH:
+      stack[top++] = static_cast<std::int64_t>(es.stack.size());
+      break;
+    case op::IP:
+      stack[top++] = es.instruction_ptr.to_int();
+      break;
+    case op::MEM: {
+      // Addresses outside the heap and registers read as 0
+      constexpr std::int64_t heap = Memory::heap_size;
+      constexpr std::int64_t registers = Memory::register_count;
+      const auto a = stack[top - 1];
+      if (a >= 0 && a < heap) {
+        stack[top - 1] = es.heap[std::size_t(a)].to_int();
+      } else if (a >= heap && a < heap + registers) {
+        stack[top - 1] = es.registers[std::size_t(a - heap)].to_int();
+      } else {
+        stack[top - 1] = 0;
+      }
+      break;
+    }
+    case op::NOT:
+      stack[top - 1] = stack[top - 1] == 0 ? 1 : 0;
+      break;
+    case op::COMPL:
+      stack[top - 1] = ~stack[top - 1];
+      break;
+    case op::NEG:
+      stack[top - 1] = -stack[top - 1];
+      break;
+    case op::MUL:
+      bin([](std::int64_t a, std::int64_t b) { return a * b; });
+      break;
+    case op::DIV:
+      bin([](std::int64_t a, std::int64_t b) { return b == 0 ? 0 : a / b; });
+      break;
+    case op::MOD:
+      bin([](std::int64_t a, std::int64_t b) { return b == 0 ? 0 : a % b; });
+      break;
+    case op::ADD:
+      bin([](std::int64_t a, std::int64_t b) { return a + b; });
+      break;
+    case op::SUB:
+      bin([](std::int64_t a, std::int64_t b) { return a - b; });
+      break;
+    case op::LT:
+      bin([](std::int64_t a, std::int64_t b) { return a < b; });
+      break;
+    case op::LE:
+      bin([](std::int64_t a, std::int64_t b) { return a <= b; });
+      break;
+    case op::GT:
+      bin([](std::int64_t a, std::int64_t b) { return a > b; });
+      break;
+    case op::GE:
+      bin([](std::int64_t a, std::int64_t b) { return a >= b; });
+      break;
+    case op::EQ:
+      bin([](std::int64_t a, std::int64_t b) { return a == b; });
+      break;
+    case op::NE:
+      bin([](std::int64_t a, std::int64_t b) { return a != b; });
+      break;
+    case op::BIT_AND:
+      bin([](std::int64_t a, std::int64_t b) { return a & b; });
+      break;
+    case op::BIT_OR:
+      bin([](std::int64_t a, std::int64_t b) { return a | b; });
+      break;
+    case op::AND:
+      bin([](std::int64_t a, std::int64_t b) { return a != 0 && b != 0; });
+      break;
+    case op::OR:
+      bin([](std::int64_t a, std::int64_t b) { return a != 0 || b != 0; });
+      break;
+    }
+  }
+
+  return stack[0] != 0;
+}
+
+} // namespace SynacorVM
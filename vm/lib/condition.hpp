@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cpu.hpp"
+
+namespace SynacorVM {
+
+// condition is a boolean expression over the state of the machine, such as
+//
+//    r0 == 6 && mem[0x0aac] > 3 && depth > 10
+//
+// It is compiled once into a small stack-machine bytecode so that evaluating
+// it does not involve any parsing or allocation.
+//
+// Operands are numbers (decimal, 0x-hex or 0-octal), registers r0 to r7,
+// mem[EXPR] (heap or register address), depth (stack size) and ip. Operators
+// follow C precedence: unary ! ~ -, then * / %, + -, < <= > >=, == !=, &, |,
+// && and ||. Arithmetic uses 64-bit signed integers; division by zero is 0.
+class condition {
+public:
+  // Throws std::runtime_error on syntax errors.
+  static condition parse(std::string_view text);
+
+  bool evaluate(execution_state const &es) const;
+
+  std::string const &text() const noexcept { return m_text; }
+
+private:
+  enum class op : std::uint8_t {
+    CONST,
+    REG,
+    MEM,
+    DEPTH,
+    IP,
+    NOT,
+    COMPL,
+    NEG,
+    MUL,
+    DIV,
+    MOD,
+    ADD,
+    SUB,
+    LT,
+    LE,
+    GT,
+    GE,
+    EQ,
+    NE,
+    BIT_AND,
+    BIT_OR,
+    AND,
+    OR,
+  };
+
+  struct instruction {
+    op code;
+    std::int64_t arg = 0;
+  };
+
+  friend class condition_parser;
+
+  std::string m_text;
+  std::vector<instruction> code = {};
+  std::size_t stack_size = 0;
+};
+
+} // namespace SynacorVM
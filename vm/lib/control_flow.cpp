@@ -0,0 +1,218 @@
+#include "control_flow.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "arch/arch.hpp"
+#include "memory.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+namespace {
+
+constexpr std::uint32_t first_register = Memory::heap_size;
+constexpr std::uint32_t last_register =
+    Memory::heap_size + Memory::register_count - 1;
+
+// Instructions whose first operand is written
+bool writes_first_operand(Verb v) {
+  switch (v) {
+  case SET:
+  case POP:
+  case EQ:
+  case GT:
+  case ADD:
+  case MULT:
+  case MOD:
+  case AND:
+  case OR:
+  case NOT:
+  case RMEM:
+  case IN:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool ends_block(Verb v) {
+  switch (v) {
+  case HALT:
+  case JMP:
+  case JT:
+  case JF:
+  case CALL:
+  case RET:
+  case ERROR:
+    return true;
+  default:
+    return false;
+  }
+}
+
+} // namespace
+
+instruction decode(Memory const &memory, std::uint32_t address) noexcept {
+  const instruction error{.address = std::uint16_t(address),
+                          .verb = ERROR,
+                          .length = 1,
+                          .operands = {0, 0, 0}};
+
+  const auto op = memory[Number(address)].to_uint();
+  if (op >= ERROR) {
+    return error;
+  }
+
+  instruction i = error;
+  i.verb = Verb(op);
+  const auto argc = std::uint32_t(arch::argument_count(i.verb));
+  if (address + argc >= Memory::heap_size) {
+    return error;
+  }
+
+  for (std::uint32_t n = 0; n < argc; ++n) {
+    const auto w = memory[Number(address + 1 + n)].to_uint();
+    if (w > last_register) {
+      return error;
+    }
+    i.operands[n] = std::uint16_t(w);
+  }
+  if (writes_first_operand(i.verb) && i.operands[0] < first_register) {
+    return error;
+  }
+
+  i.length = std::uint16_t(1 + argc);
+  return i;
+}
+
+control_flow_graph::control_flow_graph(Memory const &memory)
+    : memory(memory), cache(Memory::heap_size),
+      code(Memory::heap_size, 0), calls(Memory::heap_size, 0),
+      returns(Memory::heap_size, 0) {}
+
+control_flow_graph::block const &control_flow_graph::at(std::uint32_t leader) {
+  auto &b = cache[leader];
+  if (b.end != 0) {
+    return b;
+  }
+
+  auto a = leader;
+  instruction i = decode(memory, a);
+  while (true) {
+    for (auto w = a; w < a + i.length; ++w) {
+      ++code[w];
+    }
+    if (ends_block(i.verb) || a + i.length >= Memory::heap_size) {
+      break;
+    }
+    a += i.length;
+    i = decode(memory, a);
+  }
+
+  b = block{.first = std::uint16_t(leader),
+            .last = std::uint16_t(a),
+            .end = a + i.length,
+            .exit = i.verb,
+            .id = next_id++};
+
+  const auto literal = [](std::uint16_t w) {
+    return w < first_register ? std::uint32_t(w) : none;
+  };
+  switch (i.verb) {
+  case JMP:
+    b.destination = literal(i.operands[0]);
+    break;
+  case JT:
+  case JF:
+    b.destination = literal(i.operands[1]);
+    b.next = b.end;
+    break;
+  case CALL:
+    b.destination = literal(i.operands[0]);
+    b.next = b.end;
+    break;
+  case HALT:
+  case RET:
+  case ERROR:
+    break;
+  default:
+    // The block runs to the end of the heap
+    b.next = b.end;
+    break;
+  }
+  if (b.next >= Memory::heap_size) {
+    b.next = none;
+  }
+
+  if (i.verb == CALL) {
+    if (b.destination != none) {
+      ++calls[b.destination];
+    }
+    if (b.next != none) {
+      ++returns[b.next];
+    }
+  }
+  longest = std::max(longest, b.end - leader);
+  return b;
+}
+
+void control_flow_graph::explore(std::vector<std::uint16_t> const &entries) {
+  std::vector<bool> seen(Memory::heap_size, false);
+  std::vector<std::uint32_t> pending(entries.begin(), entries.end());
+  while (!pending.empty()) {
+    const auto leader = pending.back();
+    pending.pop_back();
+    if (leader >= Memory::heap_size || seen[leader]) {
+      continue;
+    }
+    seen[leader] = true;
+
+    const auto &b = at(leader);
+    pending.push_back(b.next);
+    pending.push_back(b.destination);
+  }
+}
+
+std::vector<control_flow_graph::block> control_flow_graph::blocks() const {
+  std::vector<block> known;
+  for (auto const &b : cache) {
+    if (b.end != 0) {
+      known.push_back(b);
+    }
+  }
+  return known;
+}
+
+void control_flow_graph::drop(std::uint32_t leader) {
+  auto &b = cache[leader];
+  for (auto w = leader; w < b.end; ++w) {
+    --code[w];
+  }
+  if (b.exit == CALL) {
+    if (b.destination != none) {
+      --calls[b.destination];
+    }
+    if (b.next != none) {
+      --returns[b.next];
+    }
+  }
+  b = block{};
+}
+
+void control_flow_graph::invalidate(std::uint32_t address) {
+  if (trusted[address / Memory::page_size] || code[address] == 0) {
+    return;
+  }
+
+  // Only leaders up to the longest block before the address can contain it
+  const auto first = address + 1 > longest ? address + 1 - longest : 0;
+  for (auto leader = first; leader <= address; ++leader) {
+    if (cache[leader].end > address) {
+      drop(leader);
+    }
+  }
+}
+
+} // namespace SynacorVM
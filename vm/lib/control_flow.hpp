@@ -0,0 +1,152 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <vector>
+
+#include "arch/arch.hpp"
+#include "memory.hpp"
+#include "observer.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+struct instruction {
+  std::uint16_t address;
+  Verb verb;
+  std::uint16_t length; // Words, including the opcode
+  std::array<std::uint16_t, 3> operands;
+};
+
+// Decodes the instruction at `address`, if the machine can run it: a known
+// opcode whose operands are in the heap, are numbers or registers, and are
+// registers where the instruction writes. Anything else decodes as a one-word
+// ERROR.
+instruction decode(Memory const &memory, std::uint32_t address) noexcept;
+
+// control_flow_graph indexes the basic blocks of the code in the heap. A
+// block starts at a leader and runs until the first jump, call, return or
+// halt, or until the first word that is not an instruction, which it
+// includes. Blocks of different leaders can overlap.
+//
+// Blocks are decoded the first time they are looked up, and kept until one
+// of their words is written. Writes to pages trusted to hold stable code are
+// not checked at all.
+//
+// Tools that follow a running machine share one graph: the owner of the CPU
+// attaches it as an observer, so that every write is only checked once.
+class control_flow_graph : public observer {
+public:
+  constexpr static std::uint32_t none = Memory::heap_size;
+
+  struct block {
+    std::uint16_t first = 0;
+    std::uint16_t last = 0; // Address of the last instruction
+    std::uint32_t end = 0;  // One past the last word
+    Verb exit = ERROR;      // Verb of the last instruction
+
+    // Edges out of the block: the instruction after it, where a branch not
+    // taken or a call returns, and the literal destination of the jump or
+    // call. `none` when there is no such edge, or when it is in a register.
+    std::uint32_t next = none;
+    std::uint32_t destination = none;
+
+    // Different every time a block is decoded
+    std::uint32_t id = 0;
+  };
+
+  explicit control_flow_graph(Memory const &memory);
+
+  // The block that starts at `leader`, decoded if needed. The reference is
+  // valid until the next write to the heap.
+  block const &at(std::uint32_t leader);
+
+  // Decodes every block reachable from the entries by the edges
+  void explore(std::vector<std::uint16_t> const &entries);
+
+  // Every known block, by address
+  std::vector<block> blocks() const;
+
+  // Literal destinations of the known calls, and the addresses they return to
+  bool is_call_target(std::uint32_t address) const noexcept {
+    return calls[address] > 0;
+  }
+  bool is_return_site(std::uint32_t address) const noexcept {
+    return returns[address] > 0;
+  }
+
+  // Drops the blocks that contain `address`, which was written
+  void invalidate(std::uint32_t address);
+
+  // Same, with the addresses of observer::on_write, which include registers
+  void on_write(Word address) {
+    if (address < Memory::heap_size) {
+      invalidate(address.to_uint());
+    }
+  }
+  void on_write(Word address, Word, Word) override { on_write(address); }
+
+  // Pages whose code does not change, such as the stable pages of a
+  // page_map. Blocks there are never dropped.
+  void trust(std::bitset<Memory::page_count> const &stable) noexcept {
+    trusted = stable;
+  }
+
+private:
+  void drop(std::uint32_t leader);
+
+  Memory const &memory;
+
+  // Block of every leader; unknown ones end at 0
+  std::vector<block> cache;
+
+  // Number of known blocks that contain every word, call or return there
+  std::vector<std::uint16_t> code;
+  std::vector<std::uint16_t> calls;
+  std::vector<std::uint16_t> returns;
+
+  std::bitset<Memory::page_count> trusted = {};
+
+  std::uint32_t longest = 0;
+  std::uint32_t next_id = 1;
+};
+
+// block_cursor follows a running machine through the blocks of a graph. The
+// instructions of a block run in increasing order until its exit, so only the
+// first instruction of every block that runs has to be looked up.
+class block_cursor {
+public:
+  explicit block_cursor(control_flow_graph &graph) : graph(graph) {}
+
+  // Moves to the instruction at `ip`. Returns the block that starts there, or
+  // nullptr if `ip` is further down the current block. The block is valid
+  // until the next write to the heap.
+  control_flow_graph::block const *advance(std::uint32_t ip) {
+    if (ip > last && ip < end && last != exit_at) {
+      last = ip;
+      return nullptr;
+    }
+    const auto &b = graph.at(ip);
+    last = ip;
+    end = b.end;
+    exit_at = b.last;
+    exit = b.exit;
+    return &b;
+  }
+
+  // Verb of the exit of the current block if the last instruction was it,
+  // or else NOOP
+  Verb exited() const noexcept { return last == exit_at ? exit : NOOP; }
+
+private:
+  control_flow_graph &graph;
+
+  // Current block, and the last instruction that ran in it
+  std::uint32_t last = 0;
+  std::uint32_t end = 0;
+  std::uint32_t exit_at = control_flow_graph::none;
+  Verb exit = NOOP;
+};
+
+} // namespace SynacorVM
@@ -0,0 +1,147 @@
+#include "coverage.hpp"
+
+#include <cstdint>
+#include <format>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "control_flow.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "snapshot.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+namespace {
+
+constexpr std::string_view header = "synacor-coverage 1";
+
+std::string to_hex(std::bitset<Memory::heap_size> const &bits) {
+  std::string out(bits.size() / 4, '0');
+  for (auto i = 0u; i < out.size(); ++i) {
+    const auto nibble = bits[4 * i] | bits[4 * i + 1] << 1 |
+                        bits[4 * i + 2] << 2 | bits[4 * i + 3] << 3;
+    out[i] = "0123456789abcdef"[nibble];
+  }
+  return out;
+}
+
+std::bitset<Memory::heap_size> from_hex(std::string const &s) {
+  std::bitset<Memory::heap_size> bits;
+  if (s.size() != bits.size() / 4) {
+    throw std::runtime_error("Coverage bitset has the wrong size");
+  }
+  for (auto i = 0u; i < s.size(); ++i) {
+    const auto ch = s[i];
+    unsigned nibble = 0;
+    if (ch >= '0' && ch <= '9') {
+      nibble = unsigned(ch - '0');
+    } else if (ch >= 'a' && ch <= 'f') {
+      nibble = unsigned(ch - 'a' + 10);
+    } else {
+      throw std::runtime_error(std::format("Bad hex digit {}", ch));
+    }
+    for (auto b = 0u; b < 4; ++b) {
+      bits[4 * i + b] = (nibble >> b) & 1;
+    }
+  }
+  return bits;
+}
+
+} // namespace
+
+coverage_report &coverage_report::operator|=(coverage_report const &other) {
+  if (image != other.image) {
+    throw std::runtime_error("Cannot merge coverage of different programs");
+  }
+  covered |= other.covered;
+  blocks |= other.blocks;
+  return *this;
+}
+
+std::string coverage_report::summary() const {
+  std::stringstream ss;
+  ss << "\n-------------\n"
+     << std::format("Covered {} addresses ({:.2f} %) in {} basic blocks",
+                    covered.count(),
+                    100.0 * double(covered.count()) / double(covered.size()),
+                    blocks.count());
+  ss << "\n-------------\n";
+  return ss.str();
+}
+
+void coverage_report::save(std::string const &file_name) const {
+  std::ofstream f(file_name);
+  f << header << '\n'
+    << std::format("image {:016x}\n", image)
+    << std::format("addresses {}\n", covered.count())
+    << std::format("blocks {}\n", blocks.count())
+    << "covered " << to_hex(covered) << '\n'
+    << "leaders " << to_hex(blocks) << '\n';
+  if (!f) {
+    throw std::runtime_error(
+        std::format("could not write coverage report {}", file_name));
+  }
+}
+
+coverage_report coverage_report::load(std::string const &file_name) {
+  std::ifstream f(file_name);
+  if (!f) {
+    throw std::runtime_error(
+        std::format("could not open coverage report {}", file_name));
+  }
+
+  std::string line;
+  if (!std::getline(f, line) || line != header) {
+    throw std::runtime_error(
+        std::format("{} is not a coverage report", file_name));
+  }
+
+  coverage_report r;
+  bool has_covered = false;
+  bool has_blocks = false;
+  while (std::getline(f, line)) {
+    std::stringstream ss(line);
+    std::string key, value;
+    ss >> key >> value;
+    if (key == "image") {
+      r.image = std::stoull(value, nullptr, 16);
+    } else if (key == "covered") {
+      r.covered = from_hex(value);
+      has_covered = true;
+    } else if (key == "leaders") {
+      r.blocks = from_hex(value);
+      has_blocks = true;
+    }
+    // The totals follow from the bitsets
+  }
+
+  if (!has_covered || !has_blocks) {
+    throw std::runtime_error(
+        std::format("{} is not a coverage report", file_name));
+  }
+  return r;
+}
+
+coverage::coverage(CPU &cpu, control_flow_graph &graph)
+    : m_report{.image = checksum(cpu)}, cursor(graph),
+      marked(Memory::heap_size, 0) {}
+
+void coverage::on_instruction(Number ip) {
+  const auto leader = ip.to_uint();
+  const auto *b = cursor.advance(leader);
+  if (b == nullptr || marked[leader] == b->id) {
+    return;
+  }
+
+  marked[leader] = b->id;
+  m_report.blocks.set(leader);
+  for (auto a = leader; a < b->end; ++a) {
+    m_report.covered.set(a);
+  }
+}
+
+} // namespace SynacorVM
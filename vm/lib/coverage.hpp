@@ -0,0 +1,57 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "control_flow.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "observer.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+// coverage_report lists the addresses of the heap that ran as code, and the
+// basic blocks they belong to by their first address. Reports of the same
+// program merge with a bitwise OR.
+struct coverage_report {
+  std::uint64_t image = 0; // Checksum of the machine when coverage started
+  std::bitset<Memory::heap_size> covered = {};
+  std::bitset<Memory::heap_size> blocks = {};
+
+  // Throws if the reports are not of the same program.
+  coverage_report &operator|=(coverage_report const &other);
+
+  // Human-readable totals
+  std::string summary() const;
+
+  // Machine-readable text file: the totals and both bitsets in hexadecimal.
+  void save(std::string const &file_name) const;
+  static coverage_report load(std::string const &file_name);
+};
+
+// coverage marks whole basic blocks of the control flow graph as covered the
+// first time they run. Blocks end after a jump, call, return or halt, so after
+// the first instruction of a block it only has to check that the machine is
+// still in it. Code that is overwritten is decoded again when it next runs.
+//
+// The graph is shared with other tools, and must be attached to the CPU too.
+class coverage : public observer {
+public:
+  coverage(CPU &cpu, control_flow_graph &graph);
+
+  void on_instruction(Number ip) override;
+
+  coverage_report const &report() const noexcept { return m_report; }
+
+private:
+  coverage_report m_report;
+  block_cursor cursor;
+
+  // Block last marked at every leader
+  std::vector<std::uint32_t> marked;
+};
+
+} // namespace SynacorVM
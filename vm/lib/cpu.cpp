@@ -10,11 +10,13 @@
 
 #include "arch/arch.hpp"
 #include "vm/lib/memory.hpp"
+#include "vm/lib/observer.hpp"
 #include "vm/lib/word.hpp"
 
 namespace SynacorVM {
 
-Word &get_register(Memory &m, Number ptr) {
+// Address of the register encoded at ptr
+Word register_address(Memory &m, Number ptr) {
   const Word v = m[ptr];
 
   int p = static_cast<int>(v.to_uint()) - static_cast<int>(Memory::heap_size);
@@ -24,18 +26,7 @@ Word &get_register(Memory &m, Number ptr) {
         v.to_uint()));
   }
 
-  return m[v];
-}
-
-Word value_or_register(Memory &m, Number ptr) {
-  const Word v = m[ptr];
-  if (v < Memory::heap_size) {
-    // Number literal
-    return v;
-  }
-
-  // Register
-  return m[v];
+  return v;
 }
 
 [[nodiscard]] Number jump(Word destination) {
@@ -48,51 +39,105 @@ Word value_or_register(Memory &m, Number ptr) {
 }
 
 bool CPU::Step() {
+  return observers.empty() ? step<false>() : step<true>();
+}
+
+// The observed and unobserved interpreters are the same code: notifications
+// are compiled out of step<false>.
+template <bool Observed> bool CPU::step() {
+  const auto notify = [this](auto f) {
+    if constexpr (Observed) {
+      for (observer *o : observers) {
+        f(*o);
+      }
+    }
+  };
+
+  const auto value_or_register = [this, &notify](Number ptr) -> Word {
+    const Word v = memory[ptr];
+    if (v < Memory::heap_size) {
+      // Number literal
+      return v;
+    }
+
+    // Register
+    const Word r = memory[v];
+    notify([&](observer &o) { o.on_read(v, r); });
+    return r;
+  };
+
+  const auto load = [this, &notify](Word address) -> Word {
+    const Word w = memory[address];
+    notify([&](observer &o) { o.on_read(address, w); });
+    return w;
+  };
+
+  const auto store = [this, &notify](Word address, Word value) {
+    Word &dest = memory[address];
+    notify([&](observer &o) { o.on_write(address, dest, value); });
+    dest = value;
+  };
+
+  const auto push = [this, &notify](Word w) {
+    notify([&](observer &o) { o.on_push(w); });
+    memory.push(w);
+  };
+
+  const auto pop = [this, &notify]() -> Word {
+    const Word w = memory.pop();
+    notify([&](observer &o) { o.on_pop(w); });
+    return w;
+  };
+
+  notify([this](observer &o) { o.on_instruction(instruction_pointer); });
+
+  ++instruction_count;
   auto opcode = Number(memory[instruction_pointer++].to_uint());
   switch (opcode.to_int()) {
   case HALT:
     return false;
   case SET: {
-    Word &regA = get_register(memory, instruction_pointer++);
-    Word const b = value_or_register(memory, instruction_pointer++);
-    regA = b;
+    const Word a = register_address(memory, instruction_pointer++);
+    Word const b = value_or_register(instruction_pointer++);
+    store(a, b);
     return true;
   }
   case PUSH: {
-    const Word w = value_or_register(memory, instruction_pointer++);
-    memory.push(w);
+    const Word w = value_or_register(instruction_pointer++);
+    push(w);
     return true;
   }
   case POP: {
-    Word &regA = get_register(memory, instruction_pointer++);
+    const Word a = register_address(memory, instruction_pointer++);
     if (memory.stack_ptr() == 0) {
       throw std::runtime_error("Called POP with an empty stack");
     }
-    regA = memory.pop();
+    const Word w = pop();
+    store(a, w);
     return true;
   }
   case EQ: {
-    Word &regA = get_register(memory, instruction_pointer++);
-    Word const b = value_or_register(memory, instruction_pointer++);
-    Word const c = value_or_register(memory, instruction_pointer++);
-    regA = (b == c) ? Word(1) : Word(0);
+    const Word a = register_address(memory, instruction_pointer++);
+    Word const b = value_or_register(instruction_pointer++);
+    Word const c = value_or_register(instruction_pointer++);
+    store(a, (b == c) ? Word(1) : Word(0));
     return true;
   }
   case GT: {
-    Word &regA = get_register(memory, instruction_pointer++);
-    Word const b = value_or_register(memory, instruction_pointer++);
-    Word const c = value_or_register(memory, instruction_pointer++);
-    regA = (b > c) ? Word(1) : Word(0);
+    const Word a = register_address(memory, instruction_pointer++);
+    Word const b = value_or_register(instruction_pointer++);
+    Word const c = value_or_register(instruction_pointer++);
+    store(a, (b > c) ? Word(1) : Word(0));
     return true;
   }
   case JMP: {
-    Word const pos = value_or_register(memory, instruction_pointer++);
+    Word const pos = value_or_register(instruction_pointer++);
     instruction_pointer = jump(pos);
     return true;
   }
   case JT: {
-    Word cond = value_or_register(memory, instruction_pointer++);
-    Word const pos = value_or_register(memory, instruction_pointer++);
+    Word cond = value_or_register(instruction_pointer++);
+    Word const pos = value_or_register(instruction_pointer++);
     if (!cond.nonzero()) {
       return true;
     }
@@ -100,8 +145,8 @@ bool CPU::Step() {
     return true;
   }
   case JF: {
-    Word cond = value_or_register(memory, instruction_pointer++);
-    Word const pos = value_or_register(memory, instruction_pointer++);
+    Word cond = value_or_register(instruction_pointer++);
+    Word const pos = value_or_register(instruction_pointer++);
     if (cond.nonzero()) {
       return true;
     }
@@ -109,61 +154,61 @@ bool CPU::Step() {
     return true;
   }
   case ADD: {
-    Word &regA = get_register(memory, instruction_pointer++);
-    Word const b = value_or_register(memory, instruction_pointer++);
-    Word const c = value_or_register(memory, instruction_pointer++);
-    regA = Word((b.to_uint() + c.to_uint()) % 0x8000u);
+    const Word a = register_address(memory, instruction_pointer++);
+    Word const b = value_or_register(instruction_pointer++);
+    Word const c = value_or_register(instruction_pointer++);
+    store(a, Word((b.to_uint() + c.to_uint()) % 0x8000u));
     return true;
   }
   case MULT: {
-    Word &regA = get_register(memory, instruction_pointer++);
-    Word const b = value_or_register(memory, instruction_pointer++);
-    Word const c = value_or_register(memory, instruction_pointer++);
-    regA = Word((b.to_uint() * c.to_uint()) % 0x8000u);
+    const Word a = register_address(memory, instruction_pointer++);
+    Word const b = value_or_register(instruction_pointer++);
+    Word const c = value_or_register(instruction_pointer++);
+    store(a, Word((b.to_uint() * c.to_uint()) % 0x8000u));
     return true;
   }
   case MOD: {
-    Word &regA = get_register(memory, instruction_pointer++);
-    Word const b = value_or_register(memory, instruction_pointer++);
-    Word const c = value_or_register(memory, instruction_pointer++);
-    regA = Word(b.to_uint() % c.to_uint());
+    const Word a = register_address(memory, instruction_pointer++);
+    Word const b = value_or_register(instruction_pointer++);
+    Word const c = value_or_register(instruction_pointer++);
+    store(a, Word(b.to_uint() % c.to_uint()));
     return true;
   }
   case AND: {
-    Word &regA = get_register(memory, instruction_pointer++);
-    Word const b = value_or_register(memory, instruction_pointer++);
-    Word const c = value_or_register(memory, instruction_pointer++);
-    regA = b & c;
+    const Word a = register_address(memory, instruction_pointer++);
+    Word const b = value_or_register(instruction_pointer++);
+    Word const c = value_or_register(instruction_pointer++);
+    store(a, b & c);
     return true;
   }
   case OR: {
-    Word &regA = get_register(memory, instruction_pointer++);
-    Word const b = value_or_register(memory, instruction_pointer++);
-    Word const c = value_or_register(memory, instruction_pointer++);
-    regA = b | c;
+    const Word a = register_address(memory, instruction_pointer++);
+    Word const b = value_or_register(instruction_pointer++);
+    Word const c = value_or_register(instruction_pointer++);
+    store(a, b | c);
     return true;
   }
   case NOT: {
-    Word &regA = get_register(memory, instruction_pointer++);
-    Word const b = value_or_register(memory, instruction_pointer++);
-    regA = ~b;
+    const Word a = register_address(memory, instruction_pointer++);
+    Word const b = value_or_register(instruction_pointer++);
+    store(a, ~b);
     return true;
   }
   case RMEM: {
-    Word &regA = get_register(memory, instruction_pointer++);
-    Word const ptr = value_or_register(memory, instruction_pointer++);
-    regA = memory[ptr];
+    const Word a = register_address(memory, instruction_pointer++);
+    Word const ptr = value_or_register(instruction_pointer++);
+    store(a, load(ptr));
     return true;
   }
   case WMEM: {
-    Word const ptr = value_or_register(memory, instruction_pointer++);
-    Word const src = value_or_register(memory, instruction_pointer++);
-    memory[ptr] = src;
+    Word const ptr = value_or_register(instruction_pointer++);
+    Word const src = value_or_register(instruction_pointer++);
+    store(ptr, src);
     return true;
   }
   case CALL: {
-    Word const pos = value_or_register(memory, instruction_pointer++);
-    memory.push(Word(instruction_pointer));
+    Word const pos = value_or_register(instruction_pointer++);
+    push(Word(instruction_pointer));
     instruction_pointer = jump(pos);
     return true;
   }
@@ -171,12 +216,12 @@ bool CPU::Step() {
     if (memory.stack_ptr() == 0) {
       return false;
     }
-    Word const pos = memory.pop();
+    Word const pos = pop();
     instruction_pointer = jump(pos);
     return true;
   }
   case OUT: {
-    Word const a = value_or_register(memory, instruction_pointer++);
+    Word const a = value_or_register(instruction_pointer++);
     assert(a < 256);
     const auto ch = static_cast<char>(a.to_uint());
     if(ch == '\n') {
@@ -187,12 +232,15 @@ bool CPU::Step() {
     return true;
   }
   case IN: {
-    Word &regA = get_register(memory, instruction_pointer++);
+    const Word a = register_address(memory, instruction_pointer++);
     auto w = stdIn->get();
     if(w == std::char_traits<char>::eof()) {
       throw std::runtime_error("could not read from stdin");
     }
-    regA = Word(w);
+    notify([w](observer &o) {
+      o.on_input(std::char_traits<char>::to_char_type(w));
+    });
+    store(a, Word(w));
     return true;
   }
   case NOOP:
@@ -204,11 +252,15 @@ bool CPU::Step() {
 
 void CPU::Run() noexcept {
   instruction_pointer = Number(0);
+  instruction_count = 0;
 
   try {
     bool keep_running = true;
     while (keep_running) {
-      if(pre_exec_hook != nullptr) {
+      if (pre_exec_hook != nullptr &&
+          (traps == nullptr ||
+           traps->hit(instruction_pointer, memory[instruction_pointer],
+                      instruction_count))) {
         pre_exec_hook(execution_state(*this));
       }
       
@@ -1,11 +1,15 @@
 #pragma once
 
+#include <cstdint>
 #include <functional>
 #include <iostream>
 #include <ostream>
 #include <stack>
+#include <vector>
 
+#include "debug.hpp"
 #include "memory.hpp"
+#include "observer.hpp"
 #include "word.hpp"
 
 namespace SynacorVM {
@@ -33,9 +37,22 @@ struct CPU {
 
   Number instruction_pointer = Number(0);
 
+  // Number of instructions started since the last call to Run.
+  std::uint64_t instruction_count = 0;
+
   friend struct execution_state;
   std::function<void(execution_state)> pre_exec_hook = nullptr;
   std::function<void(execution_state, bool)> post_exec_hook = nullptr;
+
+  // When set, pre_exec_hook is only called before the instructions matching
+  // the traps. Otherwise it is called before every instruction.
+  trap_set const *traps = nullptr;
+
+  // Notified of every instruction, read and write while not empty.
+  std::vector<observer *> observers = {};
+
+private:
+  template <bool Observed> bool step();
 };
 
 constexpr execution_state::execution_state(CPU const &cpu)
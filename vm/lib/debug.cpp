@@ -0,0 +1,57 @@
+#include "debug.hpp"
+
+#include <format>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "word.hpp"
+
+namespace SynacorVM {
+
+void watchpoints::set(Word address, access a) {
+  const auto i = address.to_uint();
+  if (i >= address_count) {
+    throw std::runtime_error(
+        std::format("cannot watch inexistent address {:04x}", i));
+  }
+
+  const bool was_armed = reads[i] || writes[i];
+  reads[i] = (a & READ) != 0;
+  writes[i] = (a & WRITE) != 0;
+  const bool is_armed = reads[i] || writes[i];
+
+  if (was_armed != is_armed) {
+    armed = is_armed ? armed + 1 : armed - 1;
+  }
+}
+
+watchpoints::access watchpoints::get(Word address) const {
+  const auto i = address.to_uint();
+  if (i >= address_count) {
+    return NONE;
+  }
+  return access((reads[i] ? READ : NONE) | (writes[i] ? WRITE : NONE));
+}
+
+std::vector<watchpoints::hit> watchpoints::take_hits() {
+  return std::exchange(hits, {});
+}
+
+void watchpoints::on_read(Word address, Word value) {
+  if (!reads[address.to_uint()]) {
+    return;
+  }
+  hits.push_back({current, address, READ, value, value});
+  traps.pending = true;
+}
+
+void watchpoints::on_write(Word address, Word old_value, Word value) {
+  if (!writes[address.to_uint()]) {
+    return;
+  }
+  hits.push_back({current, address, WRITE, old_value, value});
+  traps.pending = true;
+}
+
+} // namespace SynacorVM
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <bitset>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "memory.hpp"
+#include "observer.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+// trap_set selects the instructions before which the CPU calls its
+// pre_exec_hook, so that debuggers only pay for a hook call where they may
+// want to stop instead of on every instruction.
+struct trap_set {
+  constexpr static std::uint64_t never =
+      std::numeric_limits<std::uint64_t>::max();
+
+  std::bitset<Memory::heap_size> addresses = {};
+
+  // Bit i set means: trap before every instruction with opcode i
+  std::uint32_t opcodes = 0;
+
+  // Trap when CPU::instruction_count reaches this value
+  std::uint64_t at_instruction = never;
+
+  // Trap before every instruction (e.g. while tracing)
+  bool every_instruction = false;
+
+  // Trap before the next instruction, whichever it is. Set by observers such
+  // as watchpoints; whoever handles the trap must clear it.
+  bool pending = false;
+
+  // Trap before the next instruction once this flag is set, e.g. from a
+  // signal handler, which cannot touch the rest of the set safely.
+  volatile std::sig_atomic_t const *signalled = nullptr;
+
+  bool hit(Number ip, Word opcode, std::uint64_t count) const noexcept {
+    const auto op = opcode.to_uint();
+    return every_instruction || pending ||
+           (signalled != nullptr && *signalled != 0) ||
+           addresses[ip.to_uint()] ||
+           count == at_instruction || (op < 32 && ((opcodes >> op) & 1) != 0);
+  }
+};
+
+// watchpoints stop the machine after an instruction reads or writes one of
+// the watched heap addresses or registers. They are notified by the CPU as an
+// observer, so they only cost anything while attached.
+class watchpoints : public observer {
+public:
+  enum access : unsigned {
+    NONE = 0,
+    READ = 1,
+    WRITE = 2,
+    READ_WRITE = READ | WRITE,
+  };
+
+  struct hit {
+    Number ip; // Instruction that made the access
+    Word address;
+    access kind;
+    Word old_value; // Same as value for reads
+    Word value;
+  };
+
+  // Hits are reported by setting traps.pending
+  explicit watchpoints(trap_set &traps) : traps(traps) {}
+
+  void set(Word address, access a);
+  access get(Word address) const;
+  bool empty() const noexcept { return armed == 0; }
+
+  // Returns and forgets the hits since the last call.
+  std::vector<hit> take_hits();
+
+  void on_instruction(Number ip) override { current = ip; }
+  void on_read(Word address, Word value) override;
+  void on_write(Word address, Word old_value, Word value) override;
+
+private:
+  constexpr static unsigned address_count =
+      Memory::heap_size + Memory::register_count;
+
+  trap_set &traps;
+  std::bitset<address_count> reads = {};
+  std::bitset<address_count> writes = {};
+  std::size_t armed = 0;
+
+  Number current = Number(0);
+  std::vector<hit> hits = {};
+};
+
+} // namespace SynacorVM
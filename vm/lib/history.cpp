@@ -0,0 +1,146 @@
+#include "history.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "snapshot.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+history::history(CPU &cpu, std::size_t max_bytes,
+                 std::uint64_t snapshot_interval)
+    : cpu(cpu), ring(max_bytes / sizeof(record)),
+      m_oldest(cpu.instruction_count), snapshot_interval(snapshot_interval) {
+  if (ring.size() < 16) {
+    throw std::runtime_error("History buffer is too small");
+  }
+  if (snapshot_interval == 0) {
+    throw std::runtime_error("Snapshot interval must be positive");
+  }
+}
+
+void history::add(record r) {
+  if (head - tail == ring.size()) {
+    // Forget the oldest instruction altogether
+    do {
+      ++tail;
+    } while (tail != head && ring[tail % ring.size()].k != kind::INSTRUCTION);
+    ++m_oldest;
+
+    while (!checkpoints.empty() && checkpoints.begin()->second.position < tail) {
+      checkpoints.erase(checkpoints.begin());
+    }
+  }
+
+  ring[head++ % ring.size()] = r;
+}
+
+void history::on_instruction(Number ip) {
+  if (cpu.instruction_count % snapshot_interval == 0) {
+    checkpoints.insert_or_assign(cpu.instruction_count,
+                                 checkpoint{
+                                     .state = snapshot::take(cpu),
+                                     .position = head,
+                                 });
+  }
+
+  add({.a = std::uint16_t(ip.to_uint()), .b = 0, .k = kind::INSTRUCTION});
+}
+
+void history::on_write(Word address, Word old_value, Word) {
+  add({.a = std::uint16_t(address.to_uint()),
+       .b = std::uint16_t(old_value.to_uint()),
+       .k = kind::WRITE});
+}
+
+void history::on_push(Word) { add({.a = 0, .b = 0, .k = kind::PUSH}); }
+
+void history::on_pop(Word value) {
+  add({.a = 0, .b = std::uint16_t(value.to_uint()), .k = kind::POP});
+}
+
+void history::on_input(char ch) {
+  add({.a = 0, .b = static_cast<unsigned char>(ch), .k = kind::INPUT});
+}
+
+void history::put_back(std::uint16_t ch) {
+  cpu.stdIn->clear();
+  cpu.stdIn->putback(static_cast<char>(ch));
+  if (!*cpu.stdIn) {
+    throw std::runtime_error("Could not put input back into the stream");
+  }
+  ++returned_input;
+}
+
+void history::undo_instruction() {
+  if (head == tail) {
+    throw std::runtime_error("History is empty");
+  }
+
+  while (head != tail) {
+    const auto r = ring[--head % ring.size()];
+    switch (r.k) {
+    case kind::INSTRUCTION:
+      cpu.instruction_pointer = Number(r.a);
+      --cpu.instruction_count;
+      return;
+    case kind::WRITE:
+      cpu.memory[Word(r.a)] = Word(r.b);
+      break;
+    case kind::PUSH:
+      cpu.memory.pop();
+      break;
+    case kind::POP:
+      cpu.memory.push(Word(r.b));
+      break;
+    case kind::INPUT:
+      put_back(r.b);
+      break;
+    }
+  }
+}
+
+std::size_t history::rewind(std::uint64_t instruction) {
+  if (instruction < m_oldest) {
+    throw std::runtime_error(
+        std::format("History only goes back to instruction {}", m_oldest));
+  }
+
+  returned_input = 0;
+  if (instruction >= cpu.instruction_count) {
+    return 0;
+  }
+
+  // Jump to the closest snapshot after the target, if it saves any work
+  if (auto it = checkpoints.lower_bound(instruction);
+      it != checkpoints.end() && it->first < cpu.instruction_count) {
+    // Input read since the snapshot must be put back all the same
+    for (auto p = head; p != it->second.position; --p) {
+      const auto r = ring[(p - 1) % ring.size()];
+      if (r.k == kind::INPUT) {
+        put_back(r.b);
+      }
+    }
+    it->second.state.restore(cpu);
+    head = it->second.position;
+  }
+
+  while (cpu.instruction_count > instruction) {
+    undo_instruction();
+  }
+
+  // Snapshots of the undone future are no longer valid
+  checkpoints.erase(checkpoints.upper_bound(instruction), checkpoints.end());
+
+  return std::exchange(returned_input, 0);
+}
+
+} // namespace SynacorVM
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "cpu.hpp"
+#include "observer.hpp"
+#include "snapshot.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+// history lets a machine run backwards. While attached to a CPU as an
+// observer, it keeps a bounded ring buffer of undo records: the instruction
+// pointer of every instruction, the words it overwrote, its stack operations
+// and the input it consumed. Full snapshots are taken periodically so that
+// going far back does not require undoing every single instruction.
+//
+// Output cannot be taken back, and neither can changes made to the memory
+// from outside the CPU.
+class history : public observer {
+public:
+  constexpr static std::size_t default_max_bytes = std::size_t(64) << 20;
+  constexpr static std::uint64_t default_snapshot_interval = 1 << 16;
+
+  explicit history(CPU &cpu, std::size_t max_bytes = default_max_bytes,
+                   std::uint64_t snapshot_interval = default_snapshot_interval);
+
+  // Moves the machine back to its state after `instruction` instructions.
+  // Input consumed since then is put back into the CPU's input stream, and
+  // the number of characters put back is returned.
+  // Throws if the history does not reach that far back.
+  std::size_t rewind(std::uint64_t instruction);
+
+  // Earliest instruction count that can be rewound to.
+  std::uint64_t oldest() const noexcept { return m_oldest; }
+
+  void on_instruction(Number ip) override;
+  void on_write(Word address, Word old_value, Word value) override;
+  void on_push(Word value) override;
+  void on_pop(Word value) override;
+  void on_input(char ch) override;
+
+private:
+  enum class kind : std::uint8_t {
+    INSTRUCTION, // a: instruction pointer
+    WRITE,       // a: address, b: overwritten value
+    PUSH,
+    POP,   // b: popped value
+    INPUT, // b: character
+  };
+
+  struct record {
+    std::uint16_t a;
+    std::uint16_t b;
+    kind k;
+  };
+
+  struct checkpoint {
+    snapshot state;
+    std::uint64_t position; // Ring position right after the snapshot
+  };
+
+  void add(record r);
+  void undo_instruction();
+  void put_back(std::uint16_t ch);
+
+  CPU &cpu;
+
+  // Records live at ring[position % ring.size()]. Positions grow forever:
+  // the ones between tail and head are valid.
+  std::vector<record> ring;
+  std::uint64_t head = 0;
+  std::uint64_t tail = 0;
+  std::uint64_t m_oldest;
+
+  std::uint64_t snapshot_interval;
+  std::map<std::uint64_t, checkpoint> checkpoints = {};
+
+  std::size_t returned_input = 0;
+};
+
+} // namespace SynacorVM
@@ -0,0 +1,375 @@
+#include "lockstep.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <exception>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "arch/arch.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "snapshot.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+namespace {
+
+constexpr unsigned register_base = Memory::heap_size;
+
+} // namespace
+
+lockstep::lockstep(snapshot const &start, std::string input)
+    : heap(start.memory), instruction_pointer(start.instruction_pointer),
+      instruction_count(start.instruction_count),
+      start_count(start.instruction_count), input(std::move(input)) {
+  for (auto r = 0u; r < Memory::register_count; ++r) {
+    const auto v = heap[Word(register_base + r)].to_uint();
+    registers[r].fill(static_cast<std::uint16_t>(v));
+  }
+
+  // The stack is moved out of the shared heap into the per-lane stack
+  std::vector<Word> s;
+  while (heap.stack_ptr() != 0) {
+    s.push_back(heap.pop());
+  }
+  std::for_each(s.crbegin(), s.crend(), [this](Word w) {
+    lane_words v;
+    v.fill(static_cast<std::uint16_t>(w.to_uint()));
+    stack.push_back(v);
+  });
+}
+
+void lockstep::set_register(unsigned lane, unsigned reg, Word value) {
+  registers.at(reg).at(lane) = static_cast<std::uint16_t>(value.to_uint());
+}
+
+std::vector<lockstep::lane_result> lockstep::run(std::uint64_t instruction) {
+  while (active != 0 && instruction_count < instruction) {
+    if (const auto diverged = step(); diverged != 0) {
+      split(diverged);
+    }
+  }
+  split(active);
+
+  std::vector<lane_result> results(lanes);
+  for (auto &s : splits) {
+    run_scalar(s, instruction);
+    results[s.lane] = std::move(s.result);
+  }
+  splits.clear();
+
+  return results;
+}
+
+lockstep::lane_mask lockstep::disagree(lane_words const &v) const noexcept {
+  const auto lead = v[unsigned(std::countr_zero(active))];
+  lane_mask m = 0;
+  for (auto l = 0u; l < lanes; ++l) {
+    m |= lane_mask(v[l] != lead) << l;
+  }
+  return m & active;
+}
+
+bool lockstep::is_register(Word w) const noexcept {
+  return w.to_uint() >= register_base &&
+         w.to_uint() < register_base + Memory::register_count;
+}
+
+lockstep::lane_words lockstep::operand(Word w) const {
+  if (w.to_uint() < register_base) {
+    lane_words v;
+    v.fill(static_cast<std::uint16_t>(w.to_uint()));
+    return v;
+  }
+  return registers[w.to_uint() - register_base];
+}
+
+void lockstep::split(lane_mask which) {
+  for (auto l = 0u; l < lanes; ++l) {
+    if ((which & active & (lane_mask(1) << l)) == 0) {
+      continue;
+    }
+
+    split_lane s{
+        .lane = l,
+        .result =
+            {
+                .state =
+                    {
+                        .memory = heap,
+                        .instruction_pointer = instruction_pointer,
+                        .instruction_count = instruction_count,
+                    },
+                .output = output,
+                .lockstep_instructions = instruction_count - start_count,
+            },
+        .input_pos = input_pos,
+    };
+
+    Memory &m = s.result.state.memory;
+    for (auto r = 0u; r < Memory::register_count; ++r) {
+      m[Word(register_base + r)] = Word(registers[r][l]);
+    }
+    for (auto const &v : stack) {
+      m.push(Word(v[l]));
+    }
+
+    splits.push_back(std::move(s));
+  }
+
+  active &= ~which;
+}
+
+// Anything unusual (errors, halting, input running out) is handed to the
+// scalar interpreter by returning `active`, so that it is reproduced exactly.
+lockstep::lane_mask lockstep::step() {
+  const auto ip = instruction_pointer.to_uint();
+  if (ip + 4 > Memory::heap_size) {
+    return active;
+  }
+
+  const auto arg = [&](unsigned i) -> Word { return heap[Number(ip + 1 + i)]; };
+  const auto is_value = [](Word w) -> bool {
+    return w.to_uint() < register_base + Memory::register_count;
+  };
+  const auto reg = [&](unsigned i) -> lane_words & {
+    return registers[arg(i).to_uint() - register_base];
+  };
+  const auto next = [&](unsigned argc) -> lane_mask {
+    instruction_pointer = Number(ip + 1 + argc);
+    ++instruction_count;
+    return 0;
+  };
+  const auto jump = [&](lane_words const &target) -> lane_mask {
+    if (const auto d = disagree(target); d != 0) {
+      return d;
+    }
+    const auto dest = target[unsigned(std::countr_zero(active))];
+    if (dest >= register_base) {
+      return active;
+    }
+    instruction_pointer = Number(dest);
+    ++instruction_count;
+    return 0;
+  };
+
+  // dest = f(b, c) for every lane
+  const auto binary = [&](auto f) -> lane_mask {
+    if (!is_register(arg(0)) || !is_value(arg(1)) || !is_value(arg(2))) {
+      return active;
+    }
+    const auto b = operand(arg(1));
+    const auto c = operand(arg(2));
+    auto &a = reg(0);
+    for (auto l = 0u; l < lanes; ++l) {
+      a[l] = static_cast<std::uint16_t>(f(unsigned(b[l]), unsigned(c[l])));
+    }
+    return next(3);
+  };
+
+  switch (heap[Number(ip)].to_uint()) {
+  case SET: {
+    if (!is_register(arg(0)) || !is_value(arg(1))) {
+      return active;
+    }
+    reg(0) = operand(arg(1));
+    return next(2);
+  }
+  case PUSH: {
+    if (!is_value(arg(0))) {
+      return active;
+    }
+    stack.push_back(operand(arg(0)));
+    return next(1);
+  }
+  case POP: {
+    if (!is_register(arg(0)) || stack.empty()) {
+      return active;
+    }
+    reg(0) = stack.back();
+    stack.pop_back();
+    return next(1);
+  }
+  case EQ:
+    return binary([](unsigned b, unsigned c) { return b == c ? 1u : 0u; });
+  case GT:
+    return binary([](unsigned b, unsigned c) { return b > c ? 1u : 0u; });
+  case JMP: {
+    if (!is_value(arg(0))) {
+      return active;
+    }
+    return jump(operand(arg(0)));
+  }
+  case JT:
+  case JF: {
+    if (!is_value(arg(0)) || !is_value(arg(1))) {
+      return active;
+    }
+    const bool jump_if = heap[Number(ip)].to_uint() == JT;
+    const auto cond = operand(arg(0));
+    const auto target = operand(arg(1));
+    lane_words dest;
+    for (auto l = 0u; l < lanes; ++l) {
+      dest[l] = ((cond[l] != 0) == jump_if)
+                    ? target[l]
+                    : static_cast<std::uint16_t>(ip + 3);
+    }
+    return jump(dest);
+  }
+  case ADD:
+    return binary([](unsigned b, unsigned c) { return (b + c) % 0x8000u; });
+  case MULT:
+    return binary([](unsigned b, unsigned c) { return (b * c) % 0x8000u; });
+  case MOD: {
+    if (!is_value(arg(2))) {
+      return active;
+    }
+    // Division by zero is left for the interpreter
+    const auto c = operand(arg(2));
+    lane_mask zero = 0;
+    for (auto l = 0u; l < lanes; ++l) {
+      zero |= lane_mask(c[l] == 0) << l;
+    }
+    if ((zero & active) != 0) {
+      return zero & active;
+    }
+    return binary([](unsigned b, unsigned c) { return c == 0 ? 0 : b % c; });
+  }
+  case AND:
+    return binary([](unsigned b, unsigned c) { return b & c; });
+  case OR:
+    return binary([](unsigned b, unsigned c) { return b | c; });
+  case NOT: {
+    if (!is_register(arg(0)) || !is_value(arg(1))) {
+      return active;
+    }
+    const auto b = operand(arg(1));
+    auto &a = reg(0);
+    for (auto l = 0u; l < lanes; ++l) {
+      a[l] = static_cast<std::uint16_t>(~b[l] & 0x7fff);
+    }
+    return next(2);
+  }
+  case RMEM: {
+    if (!is_register(arg(0)) || !is_value(arg(1))) {
+      return active;
+    }
+    const auto ptr = operand(arg(1));
+    lane_mask outside = 0;
+    for (auto l = 0u; l < lanes; ++l) {
+      outside |= lane_mask(ptr[l] >= register_base) << l;
+    }
+    if ((outside & active) != 0) {
+      return outside & active;
+    }
+    auto &a = reg(0);
+    for (auto l = 0u; l < lanes; ++l) {
+      a[l] = static_cast<std::uint16_t>(
+          heap[Number(ptr[l] & (register_base - 1))].to_uint());
+    }
+    return next(2);
+  }
+  case WMEM: {
+    if (!is_value(arg(0)) || !is_value(arg(1))) {
+      return active;
+    }
+    // The heap stays shared only if every lane writes the same value
+    const auto ptr = operand(arg(0));
+    const auto value = operand(arg(1));
+    if (const auto d = disagree(ptr) | disagree(value); d != 0) {
+      return d;
+    }
+    const auto lead = unsigned(std::countr_zero(active));
+    if (ptr[lead] >= register_base) {
+      return active;
+    }
+    heap[Number(ptr[lead])] = Word(value[lead]);
+    return next(2);
+  }
+  case CALL: {
+    if (!is_value(arg(0))) {
+      return active;
+    }
+    const auto target = operand(arg(0));
+    if (const auto d = disagree(target); d != 0) {
+      return d;
+    }
+    lane_words ret;
+    ret.fill(static_cast<std::uint16_t>(ip + 2));
+    stack.push_back(ret);
+    if (const auto r = jump(target); r != 0) {
+      stack.pop_back();
+      return r;
+    }
+    return 0;
+  }
+  case RET: {
+    if (stack.empty()) {
+      return active;
+    }
+    const auto target = stack.back();
+    if (const auto r = jump(target); r != 0) {
+      return r;
+    }
+    stack.pop_back();
+    return 0;
+  }
+  case OUT: {
+    if (!is_value(arg(0))) {
+      return active;
+    }
+    const auto ch = operand(arg(0));
+    if (const auto d = disagree(ch); d != 0) {
+      return d;
+    }
+    const auto lead = unsigned(std::countr_zero(active));
+    if (ch[lead] >= 256) {
+      return active;
+    }
+    output.push_back(static_cast<char>(ch[lead]));
+    return next(1);
+  }
+  case IN: {
+    if (!is_register(arg(0)) || input_pos >= input.size()) {
+      return active;
+    }
+    reg(0).fill(static_cast<unsigned char>(input[input_pos++]));
+    return next(1);
+  }
+  case NOOP:
+    return next(0);
+  }
+
+  // HALT and unknown opcodes
+  return active;
+}
+
+void lockstep::run_scalar(split_lane &lane, std::uint64_t instruction) const {
+  std::istringstream in(input.substr(lane.input_pos));
+  std::ostringstream out;
+
+  Memory memory;
+  CPU cpu{.memory = memory, .stdOut = &out, .stdIn = &in};
+  lane.result.state.restore(cpu);
+
+  bool running = true;
+  try {
+    while (running && cpu.instruction_count < instruction) {
+      running = cpu.Step();
+    }
+  } catch (std::exception &e) {
+    out << "\nFATAL ERROR\n" << e.what() << std::endl;
+    running = false;
+  }
+
+  lane.result.halted = !running;
+  lane.result.output += out.str();
+  lane.result.state = snapshot::take(cpu);
+}
+
+} // namespace SynacorVM
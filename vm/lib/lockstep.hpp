@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "memory.hpp"
+#include "snapshot.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+// lockstep runs many copies of a machine that only differ in their registers,
+// such as a sweep over the possible values of r7.
+//
+// Registers and stack are stored as structure-of-arrays, one element per lane,
+// so that every instruction is executed for all lanes at once with loops the
+// compiler turns into SIMD code. The heap is shared for as long as all lanes
+// write the same values to it.
+//
+// A lane that stops agreeing with the others (it branches elsewhere, writes a
+// different value to the heap, prints a different character...) is split off:
+// its state is copied into a regular machine and it continues running on the
+// scalar interpreter.
+class lockstep {
+public:
+  constexpr static unsigned lanes = 16;
+
+  struct lane_result {
+    snapshot state;
+    std::string output = {};
+    bool halted = false; // false if the lane ran out of budget
+
+    // Instructions executed in lockstep before the lane was split off
+    std::uint64_t lockstep_instructions = 0;
+  };
+
+  // Every lane starts as a copy of `start` and reads `input` as its stdin.
+  lockstep(snapshot const &start, std::string input);
+
+  void set_register(unsigned lane, unsigned reg, Word value);
+
+  // Runs every lane until it halts or until its instruction count reaches
+  // `instruction`.
+  std::vector<lane_result> run(std::uint64_t instruction);
+
+private:
+  using lane_words = std::array<std::uint16_t, lanes>;
+  using lane_mask = std::uint32_t;
+
+  constexpr static lane_mask all_lanes = (lane_mask(1) << lanes) - 1;
+
+  struct split_lane {
+    unsigned lane;
+    lane_result result;
+    std::size_t input_pos;
+  };
+
+  // Executes one instruction. Returns the lanes that could not execute it in
+  // lockstep, which must be split off before the instruction runs.
+  lane_mask step();
+
+  void split(lane_mask which);
+  lane_mask disagree(lane_words const &v) const noexcept;
+
+  lane_words operand(Word w) const;
+  bool is_register(Word w) const noexcept;
+
+  void run_scalar(split_lane &lane, std::uint64_t instruction) const;
+
+  Memory heap; // Shared heap. Its registers and stack are not used.
+  std::array<lane_words, Memory::register_count> registers = {};
+  std::vector<lane_words> stack = {};
+
+  Number instruction_pointer = Number(0);
+  std::uint64_t instruction_count = 0;
+  std::uint64_t start_count = 0;
+
+  std::string input;
+  std::size_t input_pos = 0;
+  std::string output = {};
+
+  lane_mask active = all_lanes;
+  std::vector<split_lane> splits = {};
+};
+
+} // namespace SynacorVM
@@ -0,0 +1,47 @@
+#include "mapped_file.hpp"
+
+#include <cstddef>
+#include <format>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace SynacorVM {
+
+mapped_file::mapped_file(std::string const &file_name) {
+  const int fd = ::open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error(std::format("could not open {}", file_name));
+  }
+
+  struct stat st = {};
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw std::runtime_error(std::format("could not stat {}", file_name));
+  }
+  m_size = std::size_t(st.st_size);
+
+  // Empty files cannot be mapped
+  if (m_size != 0) {
+    void *p = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      ::close(fd);
+      throw std::runtime_error(std::format("could not map {}", file_name));
+    }
+    m_data = static_cast<std::byte const *>(p);
+  }
+
+  ::close(fd);
+}
+
+mapped_file::~mapped_file() {
+  if (m_data != nullptr) {
+    ::munmap(const_cast<std::byte *>(m_data), m_size);
+  }
+}
+
+} // namespace SynacorVM
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace SynacorVM {
+
+// mapped_file maps a whole file read-only into memory, so that large traces
+// and indexes can be read without loading them.
+class mapped_file {
+public:
+  explicit mapped_file(std::string const &file_name);
+  ~mapped_file();
+
+  mapped_file(mapped_file const &) = delete;
+  mapped_file &operator=(mapped_file const &) = delete;
+
+  std::basic_string_view<std::byte> bytes() const noexcept {
+    return {m_data, m_size};
+  }
+
+private:
+  std::byte const *m_data = nullptr;
+  std::size_t m_size = 0;
+};
+
+} // namespace SynacorVM
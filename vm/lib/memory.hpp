@@ -27,6 +27,10 @@ public:
   constexpr static unsigned register_count = 8;
   constexpr static unsigned heap_size = 1 << 15;
 
+  // Pages group the heap in regions for tools that classify it
+  constexpr static unsigned page_size = 256;
+  constexpr static unsigned page_count = heap_size / page_size;
+
 private:
   std::array<Word, register_count> m_registers;
   std::array<Word, heap_size> m_heap;
@@ -68,6 +72,13 @@ public:
 
   std::size_t stack_ptr() const { return m_stack.size(); }
 
+  // Read-only views, for tools that compare whole machines
+  std::array<Word, heap_size> const &heap() const noexcept { return m_heap; }
+  std::array<Word, register_count> const &registers() const noexcept {
+    return m_registers;
+  }
+  std::stack<Word> const &stack() const noexcept { return m_stack; }
+
   void load(std::basic_string<std::byte> in) {
     std::size_t len = in.size();
     if (len > heap_size * 2) {
@@ -0,0 +1,74 @@
+#include "native.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <span>
+#include <string>
+
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+native::native(std::span<std::uint16_t const> image,
+               std::span<block const> translated)
+    : last_of(Memory::heap_size, 0) {
+  std::basic_string<std::byte> bytes(2 * image.size(), std::byte(0));
+  for (std::size_t a = 0; a < image.size(); ++a) {
+    bytes[2 * a] = std::byte(image[a] & 0xff);
+    bytes[2 * a + 1] = std::byte(image[a] >> 8);
+  }
+  ram.load(bytes);
+
+  for (auto const &b : translated) {
+    for (auto a = b.first; a < b.end; ++a) {
+      code.set(a);
+    }
+    leaders.set(b.first);
+    last_of[b.first] = std::uint16_t(b.end - 1);
+  }
+  cpu.observers = {&writes};
+}
+
+void native::write_observer::on_write(Word address, Word, Word) {
+  if (address < Memory::heap_size && machine.code[address.to_uint()]) {
+    machine.dirty.set(address.to_uint() / Memory::page_size);
+  }
+}
+
+bool native::resumes(std::uint32_t ip) const noexcept {
+  return ip < Memory::heap_size && leaders[ip] && !stale(ip, last_of[ip]);
+}
+
+int native::run(translation translated) noexcept {
+  try {
+    std::uint32_t ip = 0;
+    while (true) {
+      ip = translated(*this, ip);
+      if (ip == halted) {
+        break;
+      }
+
+      // The interpreter runs until the translated code can take over again
+      cpu.instruction_pointer = Number(ip);
+      bool running = true;
+      do {
+        running = cpu.Step();
+        ip = cpu.instruction_pointer.to_uint();
+      } while (running && !resumes(ip));
+      if (!running) {
+        break;
+      }
+    }
+  } catch (std::exception &e) {
+    std::cout << "\nFATAL ERROR\n" << e.what() << std::endl;
+  } catch (...) {
+    std::cout << "\nFATAL ERROR\nUnknown reasons" << std::endl;
+  }
+  return 0;
+}
+
+} // namespace SynacorVM
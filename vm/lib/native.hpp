@@ -0,0 +1,110 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <iostream>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "observer.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+// native is the machine that the C++ written by `recompile` runs on. The
+// translated blocks keep the registers in locals, and share the heap and the
+// stack with the interpreter. The interpreter runs the code that was not
+// translated, and the blocks whose pages were written after the translation:
+// translated code is only trusted while the program does not change it.
+class native {
+public:
+  // Words of a translated basic block
+  struct block {
+    std::uint16_t first;
+    std::uint16_t end;
+  };
+
+  // The translated code runs from `ip` until the machine halts, or until it
+  // reaches code that was not translated, and returns where it stopped.
+  using translation = std::uint32_t (*)(native &, std::uint32_t ip);
+  constexpr static std::uint32_t halted = Memory::heap_size;
+
+  native(std::span<std::uint16_t const> image,
+         std::span<block const> translated);
+
+  // Runs the program from address 0, as CPU::Run does
+  int run(translation code) noexcept;
+
+  // Interface of the translated code
+  std::uint16_t get_register(unsigned r) const noexcept {
+    return std::uint16_t(ram.registers()[r].to_uint());
+  }
+  void set_register(unsigned r, std::uint16_t value) noexcept {
+    ram[Word(Memory::heap_size + r)] = Word(value);
+  }
+
+  std::uint16_t read(std::uint32_t address) const noexcept {
+    return std::uint16_t(ram[Number(address)].to_uint());
+  }
+  void write(std::uint32_t address, std::uint16_t value) noexcept {
+    ram[Number(address)] = Word(value);
+    if (code[address]) {
+      dirty.set(address / Memory::page_size);
+    }
+  }
+
+  // Whether the program wrote any page of the block from `first` to `last`
+  bool stale(std::uint32_t first, std::uint32_t last) const noexcept {
+    for (auto p = first / Memory::page_size; p <= last / Memory::page_size;
+         ++p) {
+      if (dirty[p]) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool stack_empty() const noexcept { return ram.stack_ptr() == 0; }
+  void push(std::uint16_t value) { ram.push(Word(value)); }
+  std::uint16_t pop() { return std::uint16_t(ram.pop().to_uint()); }
+
+  void out(std::uint16_t c) {
+    if (c == '\n') {
+      std::cout << std::endl;
+    } else {
+      std::cout << static_cast<char>(c);
+    }
+  }
+  std::uint16_t in() {
+    const auto c = std::cin.get();
+    if (c == std::char_traits<char>::eof()) {
+      throw std::runtime_error("could not read from stdin");
+    }
+    return std::uint16_t(c);
+  }
+
+private:
+  // Marks the writes of the interpreter
+  struct write_observer : observer {
+    native &machine;
+    explicit write_observer(native &m) : machine(m) {}
+    void on_write(Word address, Word, Word value) override;
+  };
+
+  // Whether the translated code can resume at `ip`
+  bool resumes(std::uint32_t ip) const noexcept;
+
+  Memory ram;
+  CPU cpu{.memory = ram};
+  write_observer writes{*this};
+
+  std::bitset<Memory::heap_size> code = {};
+  std::bitset<Memory::heap_size> leaders = {};
+  std::vector<std::uint16_t> last_of; // Last word of the block at a leader
+  std::bitset<Memory::page_count> dirty = {};
+};
+
+} // namespace SynacorVM
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "word.hpp"
+
+namespace SynacorVM {
+
+// observer is notified by the CPU of what every instruction does, for tools
+// that need more than the pre- and post-execution hooks (watchpoints,
+// tracing...). Observers cost nothing while none is attached to the CPU.
+//
+// Addresses follow Memory::operator[]: 0x0000 to 0x7fff for the heap and
+// 0x8000 to 0x8007 for the registers.
+struct observer {
+  virtual ~observer() = default;
+
+  // Called before executing the instruction at `ip`.
+  virtual void on_instruction(Number) {}
+
+  // Data reads: registers used as operands and RMEM. Instruction fetches are
+  // not reported.
+  virtual void on_read(Word /* address */, Word /* value */) {}
+
+  // Called before `value` is written to `address`.
+  virtual void on_write(Word /* address */, Word /* old_value */,
+                        Word /* value */) {}
+
+  // Stack operations, including the return addresses of CALL and RET.
+  virtual void on_push(Word /* value */) {}
+  virtual void on_pop(Word /* value */) {}
+
+  // A character consumed by IN. The register write is reported separately.
+  virtual void on_input(char) {}
+};
+
+} // namespace SynacorVM
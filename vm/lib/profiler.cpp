@@ -0,0 +1,182 @@
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "arch/arch.hpp"
+#include "memory.hpp"
+#include "symbols.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+profiler::profiler(control_flow_graph &graph)
+    : cursor(graph), per_address(Memory::heap_size, 0),
+      nodes{{.entry = start, .parent = root}}, stack{{.node = root,
+                                                      .repeats = 0}} {}
+
+std::uint32_t profiler::child(std::uint32_t parent, std::uint16_t entry) {
+  const auto key = (std::uint64_t(parent) << 16) | entry;
+  const auto [it, inserted] =
+      children.try_emplace(key, std::uint32_t(nodes.size()));
+  if (inserted) {
+    nodes.push_back({.entry = entry, .parent = parent});
+  }
+  return it->second;
+}
+
+void profiler::on_instruction(Number ip) {
+  // The exit of a block is the only instruction that can be a call or a
+  // return
+  const auto a = ip.to_uint();
+  const auto previous = cursor.exited();
+  cursor.advance(a);
+
+  // The instruction after a CALL is the start of the function it called
+  if (previous == CALL) {
+    auto &top = stack.back();
+    if (nodes[top.node].entry == ip.to_uint()) {
+      ++top.repeats;
+      ++nodes[top.node].calls;
+    } else {
+      const auto n = child(top.node, std::uint16_t(ip.to_uint()));
+      ++nodes[n].calls;
+      stack.push_back({.node = n, .repeats = 0});
+    }
+  } else if (previous == RET) {
+    auto &top = stack.back();
+    if (top.repeats > 0) {
+      --top.repeats;
+    } else if (stack.size() > 1) {
+      stack.pop_back();
+    }
+  }
+
+  ++nodes[stack.back().node].self;
+  ++per_address[a];
+}
+
+std::vector<profiler::function> profiler::functions() const {
+  // Inclusive counts, from the leaves up. Children always come after their
+  // parents.
+  std::vector<std::uint64_t> inclusive(nodes.size());
+  for (auto i = nodes.size(); i-- > 0;) {
+    inclusive[i] += nodes[i].self;
+    if (i != root) {
+      inclusive[nodes[i].parent] += inclusive[i];
+    }
+  }
+
+  std::vector<function> by_entry(Memory::heap_size + 1,
+                                 function{.entry = Word(0),
+                                          .self = 0,
+                                          .total = 0,
+                                          .calls = 0});
+  const auto slot = [](std::uint16_t entry) {
+    return entry == start ? Memory::heap_size : entry;
+  };
+
+  for (auto i = 0u; i < nodes.size(); ++i) {
+    auto &f = by_entry[slot(nodes[i].entry)];
+    f.self += nodes[i].self;
+    f.calls += nodes[i].calls;
+
+    // Recursion through other functions must not count twice
+    bool outermost = true;
+    for (auto p = i; p != root;) {
+      p = nodes[p].parent;
+      if (nodes[p].entry == nodes[i].entry) {
+        outermost = false;
+        break;
+      }
+    }
+    if (outermost) {
+      f.total += inclusive[i];
+    }
+  }
+
+  std::vector<function> out;
+  for (auto i = 0u; i < by_entry.size(); ++i) {
+    if (by_entry[i].self == 0 && by_entry[i].calls == 0) {
+      continue;
+    }
+    by_entry[i].entry = Word(i == Memory::heap_size ? start : i);
+    out.push_back(by_entry[i]);
+  }
+  std::ranges::sort(out, [](function const &a, function const &b) {
+    return a.self > b.self;
+  });
+  return out;
+}
+
+std::string profiler::path(std::uint32_t n,
+                           symbol_table const &symbols) const {
+  if (n == root) {
+    return "start";
+  }
+  const Word entry(nodes[n].entry);
+  return std::format("{};{}", path(nodes[n].parent, symbols),
+                     symbols.empty()
+                         ? std::format("0x{:04x}", entry.to_uint())
+                         : symbols.describe(entry));
+}
+
+void profiler::write_folded(std::ostream &out,
+                            symbol_table const &symbols) const {
+  for (auto i = 0u; i < nodes.size(); ++i) {
+    if (nodes[i].self != 0) {
+      out << std::format("{} {}\n", path(i, symbols), nodes[i].self);
+    }
+  }
+}
+
+std::string profiler::report(std::size_t top,
+                             symbol_table const &symbols) const {
+  const auto name = [&](Word entry) {
+    if (entry.to_uint() == start) {
+      return std::string("start");
+    }
+    return symbols.empty() ? std::format("0x{:04x}", entry.to_uint())
+                           : symbols.describe(entry);
+  };
+
+  std::stringstream ss;
+  ss << "Function       Self      Total      Calls\n";
+  const auto fs = functions();
+  for (auto i = 0u; i < fs.size() && i < top; ++i) {
+    ss << std::format("{:<8} {:>10} {:>10} {:>10}\n", name(fs[i].entry),
+                      fs[i].self, fs[i].total, fs[i].calls);
+  }
+
+  std::vector<std::uint32_t> addresses(Memory::heap_size);
+  for (auto i = 0u; i < addresses.size(); ++i) {
+    addresses[i] = i;
+  }
+  const auto n = std::min(top, addresses.size());
+  std::partial_sort(addresses.begin(), addresses.begin() + std::ptrdiff_t(n),
+                    addresses.end(), [this](auto a, auto b) {
+                      return per_address[a] > per_address[b];
+                    });
+
+  ss << "\nAddress     Count\n";
+  for (auto i = 0u; i < n && per_address[addresses[i]] != 0; ++i) {
+    ss << std::format("0x{:04x} {:>10}", addresses[i],
+                      per_address[addresses[i]]);
+    if (!symbols.empty()) {
+      const Word a(addresses[i]);
+      const auto where = symbols.where(a);
+      ss << "  " << symbols.describe(a)
+         << (where.empty() ? where : " at " + where);
+    }
+    ss << '\n';
+  }
+  return ss.str();
+}
+
+} // namespace SynacorVM
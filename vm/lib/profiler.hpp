@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "arch/arch.hpp"
+#include "control_flow.hpp"
+#include "memory.hpp"
+#include "observer.hpp"
+#include "symbols.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+// profiler counts the instructions executed at every address and in every
+// function, following CALL and RET to keep a shadow call stack. Functions are
+// known by their entry address; the code running before any call belongs to
+// a pseudo-function called "start".
+//
+// Calls and returns are the exits of the basic blocks of the control flow
+// graph, so the code is only looked at once per block. The graph is shared
+// with other tools, and must be attached to the CPU too.
+//
+// Direct recursion is folded into a single frame, so that deeply recursive
+// functions do not produce one call path per level.
+class profiler : public observer {
+public:
+  struct function {
+    Word entry;
+    std::uint64_t self;  // Instructions executed in the function itself
+    std::uint64_t total; // Including the functions it called
+    std::uint64_t calls;
+  };
+
+  explicit profiler(control_flow_graph &graph);
+
+  void on_instruction(Number ip) override;
+
+  std::uint64_t count(Number address) const noexcept {
+    return per_address[address.to_uint()];
+  }
+
+  // Every function that ran, by descending self count
+  std::vector<function> functions() const;
+
+  // Writes one line per call path with the instructions executed in it, in
+  // the folded format read by flamegraph tools: "start;0x0aa1;0x05b2 1234".
+  // Functions are named after their labels when there are symbols.
+  void write_folded(std::ostream &out,
+                    symbol_table const &symbols = {}) const;
+
+  // Hottest functions and addresses, in human-readable form. With symbols,
+  // addresses also get their label and source line.
+  std::string report(std::size_t top = 20,
+                     symbol_table const &symbols = {}) const;
+
+private:
+  constexpr static std::uint32_t root = 0;
+  constexpr static std::uint16_t start = 0xffff;
+
+  // Node of the call tree: one per call path
+  struct node {
+    std::uint16_t entry;
+    std::uint32_t parent;
+    std::uint64_t self = 0;
+    std::uint64_t calls = 0;
+  };
+
+  struct frame {
+    std::uint32_t node;
+    std::uint32_t repeats; // Direct recursion
+  };
+
+  std::uint32_t child(std::uint32_t parent, std::uint16_t entry);
+  std::string path(std::uint32_t n, symbol_table const &symbols) const;
+
+  block_cursor cursor;
+  std::vector<std::uint64_t> per_address;
+  std::vector<node> nodes;
+  std::unordered_map<std::uint64_t, std::uint32_t> children;
+  std::vector<frame> stack;
+};
+
+} // namespace SynacorVM
@@ -0,0 +1,199 @@
+#include "self_modification.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "arch/arch.hpp"
+#include "control_flow.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "snapshot.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+namespace {
+
+constexpr std::string_view header = "synacor-pages 1";
+constexpr std::string_view kinds = ".dC";
+
+void classify(page_map &m, std::uint32_t address, page_kind kind) {
+  auto &page = m.pages[address / Memory::page_size];
+  page = std::max(page, kind);
+}
+
+} // namespace
+
+std::bitset<Memory::page_count> page_map::stable_pages() const noexcept {
+  std::bitset<Memory::page_count> stable;
+  for (auto p = 0u; p < pages.size(); ++p) {
+    stable[p] = pages[p] != page_kind::MODIFIED_CODE;
+  }
+  return stable;
+}
+
+page_map &page_map::operator|=(page_map const &other) {
+  if (image != other.image) {
+    throw std::runtime_error("Cannot merge page maps of different programs");
+  }
+  for (auto p = 0u; p < pages.size(); ++p) {
+    pages[p] = std::max(pages[p], other.pages[p]);
+  }
+  return *this;
+}
+
+std::string page_map::summary() const {
+  std::array<std::size_t, 3> counts = {};
+  std::string modified;
+  for (auto p = 0u; p < pages.size(); ++p) {
+    ++counts[std::size_t(pages[p])];
+    if (pages[p] == page_kind::MODIFIED_CODE) {
+      modified += std::format(" 0x{:04x}", p * Memory::page_size);
+    }
+  }
+
+  std::stringstream ss;
+  ss << "\n-------------\n"
+     << std::format("Pages of {} words: {} unwritten, {} data, {} modified "
+                    "code",
+                    Memory::page_size, counts[0], counts[1], counts[2]);
+  if (!modified.empty()) {
+    ss << "\nModified code at" << modified;
+  }
+  ss << "\n-------------\n";
+  return ss.str();
+}
+
+void page_map::save(std::string const &file_name) const {
+  std::string line;
+  for (auto kind : pages) {
+    line += kinds[std::size_t(kind)];
+  }
+
+  std::ofstream f(file_name);
+  f << header << '\n'
+    << std::format("image {:016x}\n", image) << "pages " << line << '\n';
+  if (!f) {
+    throw std::runtime_error(
+        std::format("could not write page map {}", file_name));
+  }
+}
+
+page_map page_map::load(std::string const &file_name) {
+  std::ifstream f(file_name);
+  if (!f) {
+    throw std::runtime_error(
+        std::format("could not open page map {}", file_name));
+  }
+
+  std::string line;
+  if (!std::getline(f, line) || line != header) {
+    throw std::runtime_error(std::format("{} is not a page map", file_name));
+  }
+
+  page_map m;
+  bool has_pages = false;
+  while (std::getline(f, line)) {
+    std::stringstream ss(line);
+    std::string key, value;
+    ss >> key >> value;
+    if (key == "image") {
+      m.image = std::stoull(value, nullptr, 16);
+    } else if (key == "pages") {
+      if (value.size() != m.pages.size()) {
+        throw std::runtime_error(
+            std::format("{} has the wrong number of pages", file_name));
+      }
+      for (auto p = 0u; p < value.size(); ++p) {
+        const auto kind = kinds.find(value[p]);
+        if (kind == std::string_view::npos) {
+          throw std::runtime_error(
+              std::format("Bad page kind {} in {}", value[p], file_name));
+        }
+        m.pages[p] = page_kind(kind);
+      }
+      has_pages = true;
+    }
+  }
+
+  if (!has_pages) {
+    throw std::runtime_error(std::format("{} is not a page map", file_name));
+  }
+  return m;
+}
+
+std::optional<page_map> page_map::analyze(CPU const &cpu) {
+  control_flow_graph graph(cpu.memory);
+  graph.explore({std::uint16_t(cpu.instruction_pointer.to_uint())});
+
+  std::bitset<Memory::heap_size> code;
+  std::vector<std::uint32_t> writes;
+  for (auto const &b : graph.blocks()) {
+    for (auto a = std::uint32_t(b.first); a < b.end;) {
+      const auto i = decode(cpu.memory, a);
+      for (auto w = a; w < a + i.length; ++w) {
+        code.set(w);
+      }
+      if (i.verb == WMEM) {
+        if (i.operands[0] >= Memory::heap_size) {
+          return std::nullopt;
+        }
+        writes.push_back(i.operands[0]);
+      }
+      a += i.length;
+    }
+  }
+
+  page_map m{.image = checksum(cpu)};
+  for (auto w : writes) {
+    classify(m, w, code[w] ? page_kind::MODIFIED_CODE : page_kind::DATA);
+  }
+  return m;
+}
+
+self_modification::self_modification(CPU &cpu, control_flow_graph &graph)
+    : m_map{.image = checksum(cpu)}, cursor(graph),
+      checked(Memory::heap_size, 0) {}
+
+void self_modification::modified(std::uint32_t address) {
+  classify(m_map, address, page_kind::MODIFIED_CODE);
+}
+
+void self_modification::on_instruction(Number ip) {
+  const auto leader = ip.to_uint();
+  const auto *b = cursor.advance(leader);
+  if (b == nullptr || checked[leader] == b->id) {
+    return;
+  }
+
+  checked[leader] = b->id;
+  for (auto a = leader; a < b->end; ++a) {
+    ran.set(a);
+    if (written[a]) {
+      modified(a);
+    }
+  }
+}
+
+void self_modification::on_write(Word address, Word, Word) {
+  if (address >= Memory::heap_size) {
+    return;
+  }
+
+  const auto a = address.to_uint();
+  written.set(a);
+  if (ran[a]) {
+    modified(a);
+  } else {
+    classify(m_map, a, page_kind::DATA);
+  }
+}
+
+} // namespace SynacorVM
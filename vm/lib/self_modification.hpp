@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "control_flow.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "observer.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+// Kinds of pages, from the safest to the least safe
+enum class page_kind : std::uint8_t {
+  UNWRITTEN,
+  DATA,          // Written, but never where code runs
+  MODIFIED_CODE, // Code ran from words that were written, before or after
+};
+
+// page_map classifies the pages of the heap by how the program writes them.
+// Code in the pages that are not MODIFIED_CODE is stable: caches of decoded
+// or translated code need not watch the writes there. Maps of runs of the
+// same program merge by keeping the least safe kind of every page.
+struct page_map {
+  std::uint64_t image = 0; // Checksum of the machine when the analysis began
+  std::array<page_kind, Memory::page_count> pages = {};
+
+  bool stable(std::uint32_t address) const noexcept {
+    return pages[address / Memory::page_size] != page_kind::MODIFIED_CODE;
+  }
+  // Whether every page from `first` to `last` is stable
+  bool stable(std::uint32_t first, std::uint32_t last) const noexcept {
+    for (auto p = first / Memory::page_size; p <= last / Memory::page_size;
+         ++p) {
+      if (pages[p] == page_kind::MODIFIED_CODE) {
+        return false;
+      }
+    }
+    return true;
+  }
+  std::bitset<Memory::page_count> stable_pages() const noexcept;
+
+  // Throws if the maps are not of the same program.
+  page_map &operator|=(page_map const &other);
+
+  // Human-readable totals, and the modified pages
+  std::string summary() const;
+
+  // Machine-readable text file: one character per page, '.' for unwritten,
+  // 'd' for data and 'C' for modified code.
+  void save(std::string const &file_name) const;
+  static page_map load(std::string const &file_name);
+
+  // Static pass over the code reachable from the instruction pointer through
+  // the literal edges of the control flow graph. Returns nothing when the
+  // code writes through registers, as only running it then tells where.
+  static std::optional<page_map> analyze(CPU const &cpu);
+};
+
+// self_modification is the dynamic pass: it classifies the pages as the
+// program runs. Code is tracked by basic block, so the words of a block are
+// only checked when it starts, and when it is decoded again after a write.
+// The graph is shared with other tools, and must be attached to the CPU too.
+class self_modification : public observer {
+public:
+  self_modification(CPU &cpu, control_flow_graph &graph);
+
+  void on_instruction(Number ip) override;
+  void on_write(Word address, Word, Word) override;
+
+  page_map const &map() const noexcept { return m_map; }
+
+private:
+  void modified(std::uint32_t address);
+
+  page_map m_map;
+  block_cursor cursor;
+  std::bitset<Memory::heap_size> ran = {};
+  std::bitset<Memory::heap_size> written = {};
+
+  // Block last checked at every leader
+  std::vector<std::uint32_t> checked;
+};
+
+} // namespace SynacorVM
@@ -0,0 +1,384 @@
+#include "session.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <format>
+#include <ios>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "cpu.hpp"
+#include "snapshot.hpp"
+#include "varint.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+namespace {
+
+constexpr std::string_view magic = "SYNREC1\n";
+
+using bytes = std::basic_string<std::byte>;
+using bytes_view = std::basic_string_view<std::byte>;
+
+// Reads the size of a list. Every entry takes at least one byte, so a size
+// larger than what is left of the file can only come from a corrupt log.
+std::size_t read_count(bytes_view &in) {
+  const auto n = varint::read(in);
+  if (n > in.size()) {
+    throw std::runtime_error("Truncated session log");
+  }
+  return std::size_t(n);
+}
+
+} // namespace
+
+void session_log::save(std::string const &file_name) const {
+  bytes out;
+  for (char ch : magic) {
+    out.push_back(std::byte(ch));
+  }
+
+  varint::write(out, initial_checksum);
+  varint::write(out, checkpoint_interval);
+
+  // Instruction counts are stored as deltas from the previous entry
+  varint::write(out, inputs.size());
+  std::uint64_t last = 0;
+  for (auto const &in : inputs) {
+    varint::write(out, in.instruction - last);
+    out.push_back(std::byte(in.value));
+    last = in.instruction;
+  }
+
+  varint::write(out, events.size());
+  last = 0;
+  for (auto const &ev : events) {
+    out.push_back(std::byte(ev.kind));
+    varint::write(out, ev.instruction - last);
+    switch (ev.kind) {
+    case event_kind::PATCH:
+      varint::write(out, ev.address.to_uint());
+      varint::write(out, ev.value.to_uint());
+      break;
+    case event_kind::CHECKPOINT:
+    case event_kind::END:
+      varint::write(out, ev.checksum);
+      break;
+    }
+    last = ev.instruction;
+  }
+
+  std::unique_ptr<FILE, int (*)(FILE *)> f(::fopen(file_name.c_str(), "wb"),
+                                           &::fclose);
+  if (f == nullptr) {
+    throw std::runtime_error(
+        std::format("could not open session log {}", file_name));
+  }
+
+  if (::fwrite(out.data(), out.size(), 1, f.get()) != 1) {
+    throw std::runtime_error(
+        std::format("could not write session log {}", file_name));
+  }
+}
+
+session_log session_log::load(std::string const &file_name) {
+  std::unique_ptr<FILE, int (*)(FILE *)> f(::fopen(file_name.c_str(), "rb"),
+                                           &::fclose);
+  if (f == nullptr) {
+    throw std::runtime_error(
+        std::format("could not open session log {}", file_name));
+  }
+
+  ::fseek(f.get(), 0, SEEK_END);
+  const auto fsize = std::size_t(::ftell(f.get()));
+  ::fseek(f.get(), 0, SEEK_SET);
+
+  bytes buffer(fsize, std::byte(0));
+  if (fsize != 0 && ::fread(buffer.data(), fsize, 1, f.get()) != 1) {
+    throw std::runtime_error(
+        std::format("could not read session log {}", file_name));
+  }
+
+  bytes_view in = buffer;
+  if (in.size() < magic.size() ||
+      !std::equal(magic.begin(), magic.end(), in.begin(),
+                  [](char a, std::byte b) { return std::byte(a) == b; })) {
+    throw std::runtime_error(
+        std::format("{} is not a session log", file_name));
+  }
+  in.remove_prefix(magic.size());
+
+  session_log log;
+  log.initial_checksum = varint::read(in);
+  log.checkpoint_interval = varint::read(in);
+
+  log.inputs.resize(read_count(in));
+  std::uint64_t last = 0;
+  for (auto &input : log.inputs) {
+    input.instruction = last + varint::read(in);
+    if (in.empty()) {
+      throw std::runtime_error("Truncated session log");
+    }
+    input.value = static_cast<char>(in.front());
+    in.remove_prefix(1);
+    last = input.instruction;
+  }
+
+  const auto n_events = read_count(in);
+  log.events.reserve(n_events);
+  last = 0;
+  for (auto i = 0u; i < n_events; ++i) {
+    if (in.empty()) {
+      throw std::runtime_error("Truncated session log");
+    }
+    event ev{.instruction = 0, .kind = event_kind(in.front())};
+    in.remove_prefix(1);
+
+    ev.instruction = last + varint::read(in);
+    switch (ev.kind) {
+    case event_kind::PATCH:
+      ev.address = Word(varint::read(in) & 0xffff);
+      ev.value = Word(varint::read(in) & 0xffff);
+      break;
+    case event_kind::CHECKPOINT:
+    case event_kind::END:
+      ev.checksum = varint::read(in);
+      break;
+    default:
+      throw std::runtime_error(std::format("Unknown session event {}",
+                                           static_cast<int>(ev.kind)));
+    }
+    last = ev.instruction;
+    log.events.push_back(ev);
+  }
+
+  return log;
+}
+
+session_recorder::session_recorder(CPU &cpu, std::uint64_t checkpoint_interval)
+    : cpu(cpu), m_log{.checkpoint_interval = checkpoint_interval}, tap(*this),
+      tapped_input(&tap) {
+  if (checkpoint_interval == 0) {
+    throw std::runtime_error("Checkpoint interval must be positive");
+  }
+}
+
+void session_recorder::install() {
+  m_log.initial_checksum = checksum(cpu);
+
+  tap.source = cpu.stdIn->rdbuf();
+  cpu.stdIn = &tapped_input;
+
+  auto previous = std::move(cpu.post_exec_hook);
+  cpu.post_exec_hook = [this, previous = std::move(previous)](
+                           execution_state es, bool keep_running) {
+    if (cpu.instruction_count % m_log.checkpoint_interval == 0) {
+      m_log.events.push_back({
+          .instruction = cpu.instruction_count,
+          .kind = session_log::event_kind::CHECKPOINT,
+          .checksum = checksum(cpu),
+      });
+    }
+
+    if (previous != nullptr) {
+      previous(es, keep_running);
+    }
+  };
+}
+
+void session_recorder::patch(Word address, Word value) {
+  m_log.events.push_back({
+      .instruction = cpu.instruction_count,
+      .kind = session_log::event_kind::PATCH,
+      .address = address,
+      .value = value,
+  });
+}
+
+void session_recorder::finish() {
+  m_log.events.push_back({
+      .instruction = cpu.instruction_count,
+      .kind = session_log::event_kind::END,
+      .checksum = checksum(cpu),
+  });
+}
+
+session_recorder::input_tap::int_type session_recorder::input_tap::underflow() {
+  return source->sgetc();
+}
+
+session_recorder::input_tap::int_type session_recorder::input_tap::uflow() {
+  const auto ch = source->sbumpc();
+  if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+    recorder.m_log.inputs.push_back({
+        .instruction = recorder.cpu.instruction_count,
+        .value = traits_type::to_char_type(ch),
+    });
+  }
+  return ch;
+}
+
+session_replayer::session_replayer(CPU &cpu, session_log log,
+                                   std::size_t max_checkpoints)
+    : cpu(cpu), m_log(std::move(log)), feed(*this), fed_input(&feed),
+      max_checkpoints(std::max<std::size_t>(max_checkpoints, 1)) {
+  cpu.instruction_pointer = Number(0);
+  cpu.instruction_count = 0;
+
+  if (checksum(cpu) != m_log.initial_checksum) {
+    throw replay_divergence(
+        "The loaded image does not match the one of the recording");
+  }
+
+  // Let divergences escape the stream instead of becoming an EOF
+  fed_input.exceptions(std::ios::badbit);
+  cpu.stdIn = &fed_input;
+  checkpoints.emplace(0, checkpoint{
+                             .state = snapshot::take(cpu),
+                             .next_input = 0,
+                             .next_event = 0,
+                         });
+}
+
+bool session_replayer::run_until(std::uint64_t instruction) {
+  while (true) {
+    process_due_events();
+    if (m_halted || cpu.instruction_count >= instruction) {
+      return !m_halted;
+    }
+
+    auto stop = instruction;
+    if (next_event < m_log.events.size()) {
+      stop = std::min(stop, m_log.events[next_event].instruction);
+    }
+
+    m_halted = !step_until(stop);
+  }
+}
+
+void session_replayer::seek(std::uint64_t instruction) {
+  if (instruction < cpu.instruction_count) {
+    // Closest checkpoint at or before the target
+    auto it = std::prev(checkpoints.upper_bound(instruction));
+    it->second.state.restore(cpu);
+    feed.next = it->second.next_input;
+    next_event = it->second.next_event;
+    m_halted = false;
+  }
+
+  run_until(instruction);
+}
+
+void session_replayer::process_due_events() {
+  while (next_event < m_log.events.size()) {
+    auto const &ev = m_log.events[next_event];
+    if (ev.instruction > cpu.instruction_count) {
+      return;
+    }
+
+    if (ev.instruction < cpu.instruction_count) {
+      throw replay_divergence(std::format(
+          "Missed event at instruction {}: replay is at instruction {}",
+          ev.instruction, cpu.instruction_count));
+    }
+
+    ++next_event;
+    switch (ev.kind) {
+    case session_log::event_kind::PATCH:
+      cpu.memory[ev.address] = ev.value;
+      break;
+    case session_log::event_kind::CHECKPOINT:
+    case session_log::event_kind::END:
+      if (checksum(cpu) != ev.checksum) {
+        throw replay_divergence(std::format(
+            "State checksum mismatch at instruction {}", ev.instruction));
+      }
+      ++m_verified;
+      if (ev.kind == session_log::event_kind::END) {
+        m_halted = true;
+        return;
+      }
+      keep_checkpoint(ev.instruction);
+      break;
+    }
+  }
+}
+
+void session_replayer::keep_checkpoint(std::uint64_t instruction) {
+  // Seeking back replays checkpoints that were already considered
+  const auto before = std::prev(checkpoints.upper_bound(instruction));
+  if (instruction - before->first < checkpoint_spacing) {
+    return;
+  }
+
+  checkpoints.emplace(instruction, checkpoint{
+                                       .state = snapshot::take(cpu),
+                                       .next_input = feed.next,
+                                       .next_event = next_event,
+                                   });
+
+  while (checkpoints.size() > max_checkpoints) {
+    checkpoint_spacing *= 2;
+    auto kept = checkpoints.begin();
+    for (auto it = std::next(kept); it != checkpoints.end();) {
+      if (it->first - kept->first < checkpoint_spacing) {
+        it = checkpoints.erase(it);
+      } else {
+        kept = it++;
+      }
+    }
+  }
+}
+
+bool session_replayer::step_until(std::uint64_t instruction) {
+  try {
+    while (cpu.instruction_count < instruction) {
+      if (!cpu.Step()) {
+        return false;
+      }
+    }
+    return true;
+  } catch (replay_divergence &) {
+    throw;
+  } catch (std::exception &e) {
+    *cpu.stdOut << "\nFATAL ERROR\n" << e.what() << std::endl;
+  } catch (...) {
+    *cpu.stdOut << "\nFATAL ERROR\nUnknown reasons" << std::endl;
+  }
+  return false;
+}
+
+session_replayer::input_feed::int_type session_replayer::input_feed::underflow() {
+  auto const &inputs = replayer.m_log.inputs;
+  if (next >= inputs.size()) {
+    return traits_type::eof();
+  }
+  return traits_type::to_int_type(inputs[next].value);
+}
+
+session_replayer::input_feed::int_type session_replayer::input_feed::uflow() {
+  auto const &inputs = replayer.m_log.inputs;
+  const auto now = replayer.cpu.instruction_count;
+  if (next >= inputs.size()) {
+    // The recording ran out of input as well: the END event will tell.
+    return traits_type::eof();
+  }
+
+  if (inputs[next].instruction != now) {
+    throw replay_divergence(
+        std::format("Instruction {} reads input recorded at instruction {}",
+                    now, inputs[next].instruction));
+  }
+
+  return traits_type::to_int_type(inputs[next++].value);
+}
+
+} // namespace SynacorVM
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "cpu.hpp"
+#include "snapshot.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+// session_log is the minimal information needed to reproduce a run of the VM
+// bit-for-bit: every input byte the program consumed, every change made to the
+// machine from the outside (e.g. by the debugger), and periodic checksums to
+// detect a replay diverging from the recording.
+//
+// All instruction counts are CPU::instruction_count at the time of the event.
+struct session_log {
+  struct input {
+    std::uint64_t instruction;
+    char value;
+  };
+
+  enum class event_kind : std::uint8_t {
+    CHECKPOINT, // State checksum after `instruction` instructions
+    PATCH,      // External write to a heap address or register
+    END,        // Final checksum after the machine stopped
+  };
+
+  struct event {
+    std::uint64_t instruction;
+    event_kind kind;
+    Word address = Word(0);
+    Word value = Word(0);
+    std::uint64_t checksum = 0;
+  };
+
+  std::uint64_t initial_checksum = 0;
+  std::uint64_t checkpoint_interval = 0;
+  std::vector<input> inputs = {};
+  std::vector<event> events = {};
+
+  void save(std::string const &file_name) const;
+  static session_log load(std::string const &file_name);
+};
+
+// Thrown when a replay does not match its recording.
+struct replay_divergence : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+class session_recorder {
+public:
+  constexpr static std::uint64_t default_checkpoint_interval = 1 << 16;
+
+  explicit session_recorder(
+      CPU &cpu, std::uint64_t checkpoint_interval = default_checkpoint_interval);
+
+  session_recorder(session_recorder const &) = delete;
+  session_recorder &operator=(session_recorder const &) = delete;
+
+  // Starts recording. Must be called once the image is loaded and the CPU's
+  // input stream is set, and before the CPU starts running.
+  void install();
+
+  // Records a write to the heap or a register (addresses 0x8000 to 0x8007)
+  // done from outside the program. The caller performs the write itself.
+  void patch(Word address, Word value);
+
+  // Records the final state. Call once the CPU has stopped.
+  void finish();
+
+  session_log const &log() const noexcept { return m_log; }
+
+private:
+  struct input_tap : std::streambuf {
+    session_recorder &recorder;
+    std::streambuf *source = nullptr;
+
+    explicit input_tap(session_recorder &r) : recorder(r) {}
+
+  protected:
+    int_type underflow() override;
+    int_type uflow() override;
+  };
+
+  CPU &cpu;
+  session_log m_log;
+  input_tap tap;
+  std::istream tapped_input;
+};
+
+class session_replayer {
+public:
+  constexpr static std::uint64_t forever =
+      std::numeric_limits<std::uint64_t>::max();
+
+  // Each checkpoint kept to seek back holds a copy of the heap
+  constexpr static std::size_t default_max_checkpoints = 256;
+
+  // The CPU must have the recorded image loaded and not have run yet. At most
+  // `max_checkpoints` of the recorded checkpoints are kept to seek back: past
+  // that, every other one is dropped, so that they stay evenly spread.
+  session_replayer(CPU &cpu, session_log log,
+                   std::size_t max_checkpoints = default_max_checkpoints);
+
+  session_replayer(session_replayer const &) = delete;
+  session_replayer &operator=(session_replayer const &) = delete;
+
+  // Runs until instruction_count reaches `instruction`. Returns false if the
+  // machine stopped before (or at) that point.
+  bool run_until(std::uint64_t instruction);
+
+  // Moves the machine to the state after `instruction` instructions, going
+  // back to the closest checkpoint if needed.
+  void seek(std::uint64_t instruction);
+
+  bool halted() const noexcept { return m_halted; }
+  std::size_t verified_checkpoints() const noexcept { return m_verified; }
+
+private:
+  struct input_feed : std::streambuf {
+    session_replayer &replayer;
+    std::size_t next = 0;
+
+    explicit input_feed(session_replayer &r) : replayer(r) {}
+
+  protected:
+    int_type underflow() override;
+    int_type uflow() override;
+  };
+
+  struct checkpoint {
+    snapshot state;
+    std::size_t next_input;
+    std::size_t next_event;
+  };
+
+  void process_due_events();
+  void keep_checkpoint(std::uint64_t instruction);
+  bool step_until(std::uint64_t instruction);
+
+  CPU &cpu;
+  session_log m_log;
+  input_feed feed;
+  std::istream fed_input;
+
+  std::map<std::uint64_t, checkpoint> checkpoints;
+  std::size_t max_checkpoints;
+  std::uint64_t checkpoint_spacing = 1; // Least distance between checkpoints
+  std::size_t next_event = 0;
+  std::size_t m_verified = 0;
+  bool m_halted = false;
+};
+
+} // namespace SynacorVM
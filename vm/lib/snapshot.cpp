@@ -0,0 +1,292 @@
+#include "snapshot.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <stack>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cpu.hpp"
+#include "mapped_file.hpp"
+#include "memory.hpp"
+#include "varint.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+snapshot snapshot::take(CPU const &cpu) {
+  return snapshot{
+      .memory = cpu.memory,
+      .instruction_pointer = cpu.instruction_pointer,
+      .instruction_count = cpu.instruction_count,
+  };
+}
+
+void snapshot::restore(CPU &cpu) const {
+  cpu.memory = memory;
+  cpu.instruction_pointer = instruction_pointer;
+  cpu.instruction_count = instruction_count;
+}
+
+namespace {
+
+constexpr std::string_view magic = "SYNSNP1\n";
+
+using bytes = std::basic_string<std::byte>;
+using bytes_view = std::basic_string_view<std::byte>;
+
+// Bottom of the stack first
+std::vector<Word> stack_words(Memory const &m) {
+  std::stack<Word> s = m.stack();
+  std::vector<Word> out(s.size(), Word(0));
+  for (auto i = out.size(); i > 0; --i) {
+    out[i - 1] = s.top();
+    s.pop();
+  }
+  return out;
+}
+
+Word read_word(bytes_view &in) {
+  const auto v = varint::read(in);
+  if (v > 0xffff) {
+    throw std::runtime_error("Invalid word in snapshot");
+  }
+  return Word(static_cast<unsigned>(v));
+}
+
+} // namespace
+
+// The registers and the stack are stored as varints, followed by the heap
+// as in a binary image.
+void snapshot::save(std::string const &file_name) const {
+  bytes out;
+  for (char ch : magic) {
+    out.push_back(std::byte(ch));
+  }
+
+  varint::write(out, instruction_pointer.to_uint());
+  varint::write(out, instruction_count);
+  for (Word r : memory.registers()) {
+    varint::write(out, r.to_uint());
+  }
+  const auto stack = stack_words(memory);
+  varint::write(out, stack.size());
+  for (Word w : stack) {
+    varint::write(out, w.to_uint());
+  }
+  for (Word w : memory.heap()) {
+    out.push_back(w.lo());
+    out.push_back(w.hi());
+  }
+
+  std::unique_ptr<FILE, int (*)(FILE *)> f(::fopen(file_name.c_str(), "wb"),
+                                           &::fclose);
+  if (f == nullptr) {
+    throw std::runtime_error(
+        std::format("could not open snapshot {}", file_name));
+  }
+  if (::fwrite(out.data(), out.size(), 1, f.get()) != 1) {
+    throw std::runtime_error(
+        std::format("could not write snapshot {}", file_name));
+  }
+}
+
+snapshot snapshot::load(std::string const &file_name) {
+  const mapped_file file(file_name);
+  bytes_view in = file.bytes();
+  if (in.size() < magic.size() ||
+      !std::equal(magic.begin(), magic.end(), in.begin(),
+                  [](char a, std::byte b) { return std::byte(a) == b; })) {
+    throw std::runtime_error(std::format("{} is not a snapshot", file_name));
+  }
+  in.remove_prefix(magic.size());
+
+  snapshot s;
+  const auto ip = varint::read(in);
+  if (ip >= Memory::heap_size) {
+    throw std::runtime_error("Invalid instruction pointer in snapshot");
+  }
+  s.instruction_pointer = Number(static_cast<unsigned>(ip));
+  s.instruction_count = varint::read(in);
+  for (unsigned r = 0; r < Memory::register_count; ++r) {
+    s.memory[Word(Memory::heap_size + r)] = read_word(in);
+  }
+
+  const auto depth = varint::read(in);
+  if (depth > in.size()) {
+    throw std::runtime_error("Truncated snapshot");
+  }
+  for (std::uint64_t i = 0; i < depth; ++i) {
+    s.memory.push(read_word(in));
+  }
+
+  if (in.size() != 2 * Memory::heap_size) {
+    throw std::runtime_error("Truncated snapshot");
+  }
+  s.memory.load(bytes(in));
+  return s;
+}
+
+namespace {
+
+void extend(std::vector<snapshot_diff::run> &runs, unsigned address) {
+  // The heap and the registers are never part of the same run
+  if (!runs.empty() && address != Memory::heap_size &&
+      runs.back().first + runs.back().count == address) {
+    ++runs.back().count;
+  } else {
+    runs.push_back({address, 1});
+  }
+}
+
+} // namespace
+
+snapshot_diff snapshot_diff::compare(snapshot const &a, snapshot const &b) {
+  static_assert(sizeof(Word) == 2);
+  constexpr unsigned block = 32; // Words, one cache line
+
+  snapshot_diff d;
+  const auto &ha = a.memory.heap();
+  const auto &hb = b.memory.heap();
+  for (unsigned i = 0; i < Memory::heap_size; i += block) {
+    if (std::memcmp(&ha[i], &hb[i], block * sizeof(Word)) == 0) {
+      continue;
+    }
+    for (unsigned j = i; j < i + block; ++j) {
+      if (ha[j] != hb[j]) {
+        extend(d.memory, j);
+      }
+    }
+  }
+
+  const auto &ra = a.memory.registers();
+  const auto &rb = b.memory.registers();
+  for (unsigned r = 0; r < Memory::register_count; ++r) {
+    if (ra[r] != rb[r]) {
+      extend(d.memory, Memory::heap_size + r);
+    }
+  }
+
+  const auto sa = stack_words(a.memory);
+  const auto sb = stack_words(b.memory);
+  d.stack_sizes[0] = sa.size();
+  d.stack_sizes[1] = sb.size();
+  for (unsigned i = 0; i < std::min(sa.size(), sb.size()); ++i) {
+    if (sa[i] != sb[i]) {
+      extend(d.stack, i);
+    }
+  }
+
+  d.instruction_pointer_changed = a.instruction_pointer != b.instruction_pointer;
+  return d;
+}
+
+std::string snapshot_diff::report(snapshot const &a,
+                                  snapshot const &b) const {
+  constexpr unsigned shown = 8; // Longer runs are only counted
+
+  const auto values = [](auto word_at, run r) {
+    std::string out;
+    for (unsigned i = r.first; i < r.first + r.count; ++i) {
+      out += std::format(" {:04x}", word_at(i).to_uint());
+    }
+    return out;
+  };
+  const auto line = [&](std::string const &label, run r, auto old_at,
+                        auto new_at) {
+    auto out = std::format("{} ({} word{})", label, r.count,
+                           r.count == 1 ? "" : "s");
+    if (r.count <= shown) {
+      out += std::format(":{} ->{}", values(old_at, r), values(new_at, r));
+    }
+    return out + '\n';
+  };
+  const auto name = [](unsigned address) {
+    return address < Memory::heap_size
+               ? std::format("0x{:04x}", address)
+               : std::format("r{}", address - Memory::heap_size);
+  };
+
+  std::string out;
+  if (instruction_pointer_changed) {
+    out += std::format("ip: 0x{:04x} -> 0x{:04x}\n",
+                       a.instruction_pointer.to_uint(),
+                       b.instruction_pointer.to_uint());
+  }
+
+  for (run r : memory) {
+    const auto label = r.count == 1
+                           ? name(r.first)
+                           : std::format("{}..{}", name(r.first),
+                                         name(r.first + r.count - 1));
+    out += line(label, r, [&](unsigned i) { return a.memory[Word(i)]; },
+                [&](unsigned i) { return b.memory[Word(i)]; });
+  }
+
+  const auto sa = stack_words(a.memory);
+  const auto sb = stack_words(b.memory);
+  for (run r : stack) {
+    const auto label =
+        r.count == 1 ? std::format("stack[{}]", r.first)
+                     : std::format("stack[{}..{}]", r.first,
+                                   r.first + r.count - 1);
+    out += line(label, r, [&](unsigned i) { return sa[i]; },
+                [&](unsigned i) { return sb[i]; });
+  }
+  if (stack_sizes[0] != stack_sizes[1]) {
+    out += std::format("stack size: {} -> {}\n", stack_sizes[0],
+                       stack_sizes[1]);
+  }
+
+  return out.empty() ? "No differences\n" : out;
+}
+
+namespace {
+
+// FNV-1a
+struct hasher {
+  std::uint64_t value = 0xcbf29ce484222325ull;
+
+  void add(Word w) noexcept {
+    add(w.lo());
+    add(w.hi());
+  }
+
+  void add(std::byte b) noexcept {
+    value ^= static_cast<std::uint64_t>(b);
+    value *= 0x100000001b3ull;
+  }
+};
+
+} // namespace
+
+std::uint64_t checksum(CPU const &cpu) {
+  const execution_state es(cpu);
+
+  hasher h;
+  for (Word w : es.heap) {
+    h.add(w);
+  }
+  for (Word w : es.registers) {
+    h.add(w);
+  }
+
+  std::stack<Word> stack = es.stack;
+  h.add(Word(stack.size() & 0xffff));
+  while (!stack.empty()) {
+    h.add(stack.top());
+    stack.pop();
+  }
+
+  h.add(Word(es.instruction_ptr));
+  return h.value;
+}
+
+} // namespace SynacorVM
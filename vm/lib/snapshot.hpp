@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+// snapshot is a full copy of the state of a machine at some instruction.
+struct snapshot {
+  Memory memory;
+  Number instruction_pointer = Number(0);
+  std::uint64_t instruction_count = 0;
+
+  static snapshot take(CPU const &cpu);
+  void restore(CPU &cpu) const;
+
+  void save(std::string const &file_name) const;
+  static snapshot load(std::string const &file_name);
+};
+
+// snapshot_diff lists the words that differ between two snapshots, grouped
+// into runs of consecutive addresses.
+struct snapshot_diff {
+  struct run {
+    unsigned first; // Address, or position from the bottom of the stack
+    unsigned count;
+  };
+
+  // Heap and registers, addressed as in Memory::operator[]
+  std::vector<run> memory;
+
+  // Positions present in both stacks
+  std::vector<run> stack;
+  std::size_t stack_sizes[2] = {0, 0};
+
+  bool instruction_pointer_changed = false;
+
+  bool empty() const noexcept {
+    return memory.empty() && stack.empty() &&
+           stack_sizes[0] == stack_sizes[1] && !instruction_pointer_changed;
+  }
+
+  // Compares the heaps in blocks that memcmp checks with vector instructions,
+  // and only looks at the words of the blocks that differ.
+  static snapshot_diff compare(snapshot const &a, snapshot const &b);
+
+  // One line per run, with the old and new values of short runs
+  std::string report(snapshot const &a, snapshot const &b) const;
+};
+
+// checksum hashes the heap, registers, stack and instruction pointer of the
+// machine. Two machines with the same checksum are assumed to be identical.
+std::uint64_t checksum(CPU const &cpu);
+
+} // namespace SynacorVM
@@ -0,0 +1,154 @@
+#include "symbols.hpp"
+
+#include <algorithm>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace SynacorVM {
+
+namespace {
+constexpr std::string_view magic = "synacor-symbols 1";
+constexpr std::string_view source = "source ";
+} // namespace
+
+symbol_table::symbol_table(std::vector<symbol> s,
+                           std::vector<std::string> files,
+                           std::vector<location> l)
+    : symbols(std::move(s)), sources(std::move(files)),
+      locations(std::move(l)) {
+  std::ranges::stable_sort(symbols, {}, [](symbol const &x) {
+    return x.address.to_uint();
+  });
+  std::ranges::stable_sort(locations, {}, [](location const &x) {
+    return x.address.to_uint();
+  });
+
+  by_name.resize(symbols.size());
+  for (std::uint32_t i = 0; i < by_name.size(); ++i) {
+    by_name[i] = i;
+  }
+  std::ranges::stable_sort(by_name, {}, [this](std::uint32_t i) -> auto & {
+    return symbols[i].name;
+  });
+}
+
+symbol_table symbol_table::parse(std::istream &in) {
+  std::string line;
+  if (!std::getline(in, line) || line != magic) {
+    throw std::runtime_error("not a symbol file");
+  }
+
+  std::vector<symbol> symbols;
+  std::vector<std::string> files;
+  std::vector<location> locations;
+  for (unsigned n = 2; std::getline(in, line); ++n) {
+    if (line.empty()) {
+      continue;
+    }
+    if (line.starts_with(source)) {
+      files.push_back(line.substr(source.size()));
+      continue;
+    }
+
+    std::istringstream ss(line);
+    std::string address;
+    std::string name;
+    if (!(ss >> address >> name)) {
+      throw std::runtime_error(std::format("invalid symbol at line {}", n));
+    }
+    const auto a = std::stoul(address, nullptr, 16);
+    if (a > 0xffff) {
+      throw std::runtime_error(std::format("invalid address at line {}", n));
+    }
+    if (files.empty()) {
+      symbols.push_back({Word(a), std::move(name)});
+      continue;
+    }
+
+    unsigned row = 0;
+    unsigned col = 0;
+    char colon = 0;
+    std::istringstream position(name);
+    if (!(position >> row >> colon >> col) || colon != ':') {
+      throw std::runtime_error(std::format("invalid location at line {}", n));
+    }
+    locations.push_back(
+        {Word(a), std::uint32_t(files.size() - 1), row, col});
+  }
+  return symbol_table(std::move(symbols), std::move(files),
+                      std::move(locations));
+}
+
+symbol_table symbol_table::load(std::string const &file_name) {
+  std::ifstream f(file_name);
+  if (!f) {
+    throw std::runtime_error(
+        std::format("could not open symbol file {}", file_name));
+  }
+  return parse(f);
+}
+
+void symbol_table::save(std::ostream &out) const {
+  out << magic << '\n';
+  for (auto const &s : symbols) {
+    out << std::format("{:04x} {}\n", s.address.to_uint(), s.name);
+  }
+  for (std::uint32_t file = 0; file < sources.size(); ++file) {
+    out << source << sources[file] << '\n';
+    for (auto const &l : locations) {
+      if (l.file == file) {
+        out << std::format("{:04x} {}:{}\n", l.address.to_uint(), l.row,
+                           l.col);
+      }
+    }
+  }
+}
+
+std::optional<Word> symbol_table::address_of(std::string_view name) const {
+  const auto it = std::ranges::lower_bound(
+      by_name, name, {},
+      [this](std::uint32_t i) -> std::string_view { return symbols[i].name; });
+  if (it == by_name.end() || symbols[*it].name != name) {
+    return std::nullopt;
+  }
+  return symbols[*it].address;
+}
+
+symbol_table::symbol const *symbol_table::containing(Word address) const {
+  const auto it = std::ranges::upper_bound(
+      symbols, address.to_uint(), {},
+      [](symbol const &s) { return s.address.to_uint(); });
+  return it == symbols.begin() ? nullptr : &*std::prev(it);
+}
+
+std::string symbol_table::describe(Word address) const {
+  const auto *s = containing(address);
+  if (s == nullptr) {
+    return std::format("0x{:04x}", address.to_uint());
+  }
+  const auto offset = address.to_uint() - s->address.to_uint();
+  return offset == 0 ? s->name : std::format("{}+{}", s->name, offset);
+}
+
+symbol_table::location const *symbol_table::source_of(Word address) const {
+  const auto it = std::ranges::upper_bound(
+      locations, address.to_uint(), {},
+      [](location const &l) { return l.address.to_uint(); });
+  return it == locations.begin() ? nullptr : &*std::prev(it);
+}
+
+std::string symbol_table::where(Word address) const {
+  const auto *l = source_of(address);
+  if (l == nullptr) {
+    return {};
+  }
+  return std::format("{}:{}:{}", sources[l->file], l->row, l->col);
+}
+
+} // namespace SynacorVM
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "word.hpp"
+
+namespace SynacorVM {
+
+// symbol_table names the addresses of a program after the labels of its
+// source, and maps them back to the lines that produced them. It is read
+// once, and kept sorted by address and by name for lookups.
+//
+// The text format starts with the line "synacor-symbols 1", followed by one
+// "<hex address> <label>" line per label. A "source <file>" line starts the
+// source map of that file: one "<hex address> <row>:<col>" line per
+// statement, at the first word it assembles to.
+class symbol_table {
+public:
+  struct symbol {
+    Word address;
+    std::string name;
+  };
+
+  struct location {
+    Word address;
+    std::uint32_t file; // Index in files()
+    unsigned row;
+    unsigned col;
+  };
+
+  symbol_table() = default;
+  explicit symbol_table(std::vector<symbol> symbols,
+                        std::vector<std::string> files = {},
+                        std::vector<location> locations = {});
+
+  static symbol_table parse(std::istream &in);
+  static symbol_table load(std::string const &file_name);
+  void save(std::ostream &out) const;
+
+  bool empty() const noexcept { return symbols.empty(); }
+
+  std::optional<Word> address_of(std::string_view name) const;
+
+  // Closest label at or before the address, if any
+  symbol const *containing(Word address) const;
+
+  // "label" or "label+offset", or the address in hex if no label precedes it
+  std::string describe(Word address) const;
+
+  // Statement that the word at the address belongs to, if any
+  location const *source_of(Word address) const;
+
+  // "file:row:col" of the statement at the address, or an empty string
+  std::string where(Word address) const;
+
+  std::vector<std::string> const &files() const noexcept { return sources; }
+
+private:
+  std::vector<symbol> symbols;
+  std::vector<std::uint32_t> by_name; // Indices in symbols
+  std::vector<std::string> sources;
+  std::vector<location> locations;
+};
+
+} // namespace SynacorVM
@@ -0,0 +1,308 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "arch/arch.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "varint.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+namespace {
+
+constexpr std::string_view magic = "SYNTRC1\n";
+
+// The file ends with the position of the footer and this string
+constexpr std::string_view footer_magic = "SYNTRCX\n";
+constexpr std::size_t trailer_size = 8 + footer_magic.size();
+
+constexpr std::uint8_t opcode_mask = 0x1f;
+constexpr std::uint8_t jumped = 0x20;
+constexpr std::uint8_t wrote = 0x40;
+constexpr std::uint8_t end_of_records = 0xff;
+
+bool starts_with(std::basic_string_view<std::byte> data, std::string_view s) {
+  return data.size() >= s.size() &&
+         std::equal(s.begin(), s.end(), data.begin(),
+                    [](char a, std::byte b) { return std::byte(a) == b; });
+}
+
+// Registers go first, then the heap, then the words that are neither. This
+// is a bijection on 16 bits.
+constexpr std::uint32_t pack(Word w) {
+  const auto v = w.to_uint();
+  if (v >= 0x8000 && v < 0x8008) {
+    return v - 0x8000;
+  }
+  if (v < 0x8000) {
+    return v + 8;
+  }
+  return v;
+}
+
+constexpr Word unpack(std::uint64_t p) {
+  if (p < 8) {
+    return Word(p + 0x8000);
+  }
+  if (p < 0x8008) {
+    return Word(p - 8);
+  }
+  if (p > 0xffff) {
+    throw std::runtime_error("Corrupt trace: word out of range");
+  }
+  return Word(p);
+}
+
+// Operand count, treating unknown opcodes as taking none
+std::uint32_t operand_count(Verb v) {
+  return std::uint32_t(std::max(arch::argument_count(v), 0));
+}
+
+} // namespace
+
+trace_writer::trace_writer(CPU &cpu, std::string const &file_name,
+                           std::uint64_t sync_interval)
+    : cpu(cpu), file_name(file_name),
+      file(::fopen(file_name.c_str(), "wb"), &::fclose),
+      sync_interval(sync_interval) {
+  if (file == nullptr) {
+    throw std::runtime_error(std::format("could not open trace {}", file_name));
+  }
+  if (sync_interval == 0) {
+    throw std::runtime_error("Sync interval must be positive");
+  }
+
+  buffer.reserve(buffer_size + 64);
+  for (char ch : magic) {
+    buffer.push_back(std::byte(ch));
+  }
+  varint::write(buffer, cpu.instruction_count);
+  for (auto i = 0u; i < Memory::register_count; ++i) {
+    varint::write(buffer, cpu.memory[Word(0x8000 + i)].to_uint());
+  }
+}
+
+trace_writer::~trace_writer() {
+  try {
+    flush();
+    write_footer();
+  } catch (std::exception &e) {
+    std::fputs(e.what(), stderr);
+  }
+}
+
+void trace_writer::flush() {
+  if (!buffer.empty() &&
+      ::fwrite(buffer.data(), buffer.size(), 1, file.get()) != 1) {
+    throw std::runtime_error(
+        std::format("could not write trace {}", file_name));
+  }
+  flushed += buffer.size();
+  buffer.clear();
+}
+
+void trace_writer::write_footer() {
+  const auto footer = flushed + buffer.size();
+
+  buffer.push_back(std::byte(end_of_records));
+  varint::write(buffer, sync_points.size());
+  trace_sync_point last;
+  for (auto const &sp : sync_points) {
+    varint::write(buffer, sp.instruction - last.instruction);
+    varint::write(buffer, sp.offset - last.offset);
+    for (auto r : sp.registers) {
+      varint::write(buffer, r.to_uint());
+    }
+    last = sp;
+  }
+
+  for (auto i = 0u; i < 8; ++i) {
+    buffer.push_back(std::byte((footer >> (8 * i)) & 0xff));
+  }
+  for (char ch : footer_magic) {
+    buffer.push_back(std::byte(ch));
+  }
+  flush();
+}
+
+void trace_writer::on_instruction(Number ip) {
+  // Only flushed between records: the header byte of the current one is
+  // still patched while it runs.
+  if (buffer.size() >= buffer_size) {
+    flush();
+  }
+
+  const auto raw = cpu.memory[ip].to_uint();
+  opcode = raw < ERROR ? Verb(raw) : ERROR;
+
+  const bool sync = records++ % sync_interval == 0;
+  if (sync) {
+    trace_sync_point sp{.instruction = cpu.instruction_count,
+                        .offset = flushed + buffer.size()};
+    for (auto i = 0u; i < Memory::register_count; ++i) {
+      sp.registers[i] = cpu.memory[Word(0x8000 + i)];
+    }
+    sync_points.push_back(sp);
+  }
+
+  current = buffer.size();
+  if (ip.to_uint() == next_ip && !sync) {
+    buffer.push_back(std::byte(opcode));
+  } else {
+    buffer.push_back(std::byte(opcode | jumped));
+    varint::write(buffer, ip.to_uint());
+  }
+
+  const auto argc = operand_count(opcode);
+  for (auto i = 0u; i < argc; ++i) {
+    const auto operand = Number((ip.to_uint() + 1 + i) % Memory::heap_size);
+    varint::write(buffer, pack(cpu.memory[operand]));
+  }
+  next_ip = ip.to_uint() + 1 + argc;
+}
+
+void trace_writer::on_write(Word address, Word, Word value) {
+  buffer[current] |= std::byte(wrote);
+  varint::write(buffer, pack(address));
+  varint::write(buffer, value.to_uint());
+}
+
+void trace_writer::on_push(Word value) {
+  // CALL pushes its return address, which is implied
+  if (opcode == PUSH) {
+    varint::write(buffer, value.to_uint());
+  }
+}
+
+trace_reader::trace_reader(std::basic_string_view<std::byte> data)
+    : data(data), in(data) {
+  if (!starts_with(in, magic)) {
+    throw std::runtime_error("Not an execution trace");
+  }
+  in.remove_prefix(magic.size());
+
+  m_first = varint::read(in);
+  for (auto &r : m_registers) {
+    r = Word(varint::read(in) & 0x7fff);
+  }
+  instruction = m_first;
+
+  const auto records_begin = data.size() - in.size();
+  records_end = data.size();
+  if (data.size() < records_begin + trailer_size ||
+      !starts_with(data.substr(data.size() - footer_magic.size()),
+                   footer_magic)) {
+    // Not closed properly
+    return;
+  }
+
+  std::uint64_t footer = 0;
+  for (auto i = 0u; i < 8; ++i) {
+    footer |= std::uint64_t(data[data.size() - trailer_size + i]) << (8 * i);
+  }
+  if (footer < records_begin || footer >= data.size() - trailer_size ||
+      data[footer] != std::byte(end_of_records)) {
+    throw std::runtime_error("Corrupt trace: bad footer");
+  }
+  records_end = std::size_t(footer);
+  in = data.substr(records_begin, records_end - records_begin);
+
+  auto f = data.substr(records_end + 1, data.size() - trailer_size -
+                                            records_end - 1);
+  const auto n = varint::read(f);
+  if (n > f.size()) {
+    throw std::runtime_error("Corrupt trace: bad footer");
+  }
+  m_sync_points.resize(std::size_t(n));
+  trace_sync_point last;
+  for (auto &sp : m_sync_points) {
+    sp.instruction = last.instruction + varint::read(f);
+    sp.offset = last.offset + varint::read(f);
+    for (auto &r : sp.registers) {
+      r = Word(varint::read(f) & 0x7fff);
+    }
+    if (sp.offset < std::max<std::uint64_t>(last.offset, records_begin) ||
+        sp.offset >= records_end) {
+      throw std::runtime_error("Corrupt trace: bad sync point");
+    }
+    last = sp;
+  }
+}
+
+trace_reader trace_reader::slice(std::size_t begin, std::size_t end) const {
+  if (begin > end || end > m_sync_points.size()) {
+    throw std::runtime_error("Slice out of range");
+  }
+
+  trace_reader r;
+  r.data = data;
+  r.records_end = end < m_sync_points.size()
+                      ? std::size_t(m_sync_points[end].offset)
+                      : records_end;
+  if (begin == m_sync_points.size()) {
+    r.in = data.substr(r.records_end, 0);
+    return r;
+  }
+
+  auto const &sp = m_sync_points[begin];
+  r.in = data.substr(std::size_t(sp.offset), r.records_end - sp.offset);
+  r.m_first = sp.instruction;
+  r.m_registers = sp.registers;
+  r.instruction = sp.instruction;
+  return r;
+}
+
+bool trace_reader::next(trace_record &r) {
+  if (in.empty()) {
+    return false;
+  }
+
+  const auto header = static_cast<std::uint8_t>(in.front());
+  in.remove_prefix(1);
+
+  const auto op = std::uint8_t(header & opcode_mask);
+  if (op > ERROR) {
+    throw std::runtime_error(std::format("Corrupt trace: opcode {}", op));
+  }
+
+  r.instruction = instruction++;
+  r.opcode = Verb(op);
+
+  if ((header & jumped) != 0) {
+    r.ip = Number(varint::read(in) & 0x7fff);
+  } else if (next_ip < Memory::heap_size) {
+    r.ip = Number(next_ip);
+  } else {
+    throw std::runtime_error("Corrupt trace: missing instruction pointer");
+  }
+
+  const auto argc = operand_count(r.opcode);
+  for (auto i = 0u; i < argc; ++i) {
+    r.operands[i] = unpack(varint::read(in));
+  }
+  next_ip = r.ip.to_uint() + 1 + argc;
+
+  r.wrote = (header & wrote) != 0;
+  if (r.wrote) {
+    r.address = unpack(varint::read(in));
+    r.value = Word(varint::read(in) & 0xffff);
+  }
+
+  if (r.opcode == PUSH) {
+    r.pushed = Word(varint::read(in) & 0xffff);
+  }
+
+  return true;
+}
+
+} // namespace SynacorVM
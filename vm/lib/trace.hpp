@@ -0,0 +1,136 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arch/arch.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "observer.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+// Binary execution traces.
+//
+// A trace starts with a header: a magic string, the instruction count and the
+// registers when tracing started. Then there is one record per instruction:
+//
+//   byte    opcode | JUMPED | WROTE
+//   varint  instruction pointer, only if JUMPED: the instruction does not
+//           follow the previous one
+//   varint  each operand
+//   varint  written address and value, only if WROTE
+//   varint  pushed value, only for PUSH
+//
+// Words are packed so that registers and small numbers take a single byte.
+// Everything else (popped values, return addresses, consumed input) follows
+// from the records and the registers in the header.
+//
+// Every sync_interval records, the record is JUMPED so that it can be decoded
+// on its own. Once the trace is complete, a footer lists these sync points
+// with the registers at each, so that readers can split the trace in chunks.
+struct trace_record {
+  std::uint64_t instruction = 0; // Instructions executed before this one
+  Number ip = Number(0);
+  Verb opcode = HALT;
+  std::array<Word, 3> operands = {Word(0), Word(0), Word(0)};
+
+  bool wrote = false;
+  Word address = Word(0);
+  Word value = Word(0);
+
+  Word pushed = Word(0);
+};
+
+struct trace_sync_point {
+  std::uint64_t instruction = 0;
+  std::uint64_t offset = 0; // Position of the record in the file
+  std::array<Word, Memory::register_count> registers = {
+      Word(0), Word(0), Word(0), Word(0), Word(0), Word(0), Word(0), Word(0)};
+};
+
+// trace_writer records every instruction executed by the CPU it observes.
+// Records go through a large buffer; the file is complete once the writer is
+// destroyed.
+class trace_writer : public observer {
+public:
+  constexpr static std::size_t buffer_size = std::size_t(1) << 20;
+  constexpr static std::uint64_t default_sync_interval = 1 << 16;
+
+  trace_writer(CPU &cpu, std::string const &file_name,
+               std::uint64_t sync_interval = default_sync_interval);
+  ~trace_writer() override;
+
+  trace_writer(trace_writer const &) = delete;
+  trace_writer &operator=(trace_writer const &) = delete;
+
+  void on_instruction(Number ip) override;
+  void on_write(Word address, Word old_value, Word value) override;
+  void on_push(Word value) override;
+
+private:
+  void flush();
+  void write_footer();
+
+  CPU &cpu;
+  std::string file_name;
+  std::unique_ptr<FILE, int (*)(FILE *)> file;
+  std::basic_string<std::byte> buffer;
+  std::uint64_t flushed = 0; // Bytes already in the file
+  std::uint64_t sync_interval;
+  std::uint64_t records = 0;
+  std::vector<trace_sync_point> sync_points = {};
+
+  std::size_t current = 0; // Position of the current record's first byte
+  Verb opcode = HALT;
+  std::uint32_t next_ip = ~std::uint32_t(0);
+};
+
+// trace_reader decodes the records of a trace held in memory.
+class trace_reader {
+public:
+  // Throws if data does not start with a trace header. Traces that were not
+  // closed properly have no footer, and so no sync points, but are otherwise
+  // readable.
+  explicit trace_reader(std::basic_string_view<std::byte> data);
+
+  // Decodes the next record into r. Returns false at the end of the trace.
+  bool next(trace_record &r);
+
+  std::uint64_t first_instruction() const noexcept { return m_first; }
+  std::array<Word, Memory::register_count> const &
+  initial_registers() const noexcept {
+    return m_registers;
+  }
+
+  std::vector<trace_sync_point> const &sync_points() const noexcept {
+    return m_sync_points;
+  }
+
+  // Reader for the records between sync points `begin` and `end`, or until
+  // the end of the trace if `end` is sync_points().size().
+  trace_reader slice(std::size_t begin, std::size_t end) const;
+
+private:
+  trace_reader() = default;
+
+  std::basic_string_view<std::byte> data;
+  std::basic_string_view<std::byte> in;
+  std::size_t records_end = 0;
+  std::vector<trace_sync_point> m_sync_points = {};
+  std::uint64_t m_first = 0;
+  std::array<Word, Memory::register_count> m_registers = {
+      Word(0), Word(0), Word(0), Word(0), Word(0), Word(0), Word(0), Word(0)};
+
+  std::uint64_t instruction = 0;
+  std::uint32_t next_ip = ~std::uint32_t(0);
+};
+
+} // namespace SynacorVM
@@ -0,0 +1,367 @@
+#include "trace_index.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "arch/arch.hpp"
+#include "mapped_file.hpp"
+#include "memory.hpp"
+#include "trace.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+namespace {
+
+constexpr std::string_view magic = "SYNTIX1\n";
+
+// Everything in the file is aligned to 8 bytes so that it can be used in
+// place once mapped.
+struct file_header {
+  std::array<char, 8> magic;
+  std::uint64_t trace_size;
+  std::uint64_t write_count;
+  std::uint64_t call_count;
+};
+
+constexpr std::size_t padded(std::size_t bytes) { return (bytes + 7) & ~7ul; }
+
+// What a chunk of the trace contributes to the index
+struct chunk {
+  struct write {
+    std::uint64_t instruction;
+    std::uint16_t address;
+    std::uint16_t value;
+  };
+
+  // Calls and returns that happen while no call made in this chunk is in
+  // progress. Returns match calls made in earlier chunks.
+  struct top_level_event {
+    bool is_return;
+    std::uint64_t value; // Index into calls, or the instruction of the RET
+  };
+
+  std::vector<write> writes = {};
+  std::vector<trace_index::call> calls = {};
+  std::vector<top_level_event> top_level = {};
+  std::vector<std::uint64_t> open = {}; // Calls still in progress at the end
+};
+
+chunk index_chunk(trace_reader reader) {
+  chunk c;
+  auto registers = reader.initial_registers();
+
+  trace_record r;
+  while (reader.next(r)) {
+    if (r.opcode == CALL) {
+      const auto operand = r.operands[0].to_uint();
+      const auto target =
+          operand >= 0x8000 ? registers[(operand - 0x8000) & 7].to_uint()
+                            : operand;
+
+      trace_index::call call{
+          .begin = r.instruction,
+          .end = trace_index::none,
+          .parent = c.open.empty() ? trace_index::none : c.open.back(),
+          .target = std::uint16_t(target),
+          .caller = std::uint16_t(r.ip.to_uint()),
+          .depth = 0,
+          .registers = {},
+      };
+      for (auto i = 0u; i < registers.size(); ++i) {
+        call.registers[i] = std::uint16_t(registers[i].to_uint());
+      }
+
+      if (c.open.empty()) {
+        c.top_level.push_back({.is_return = false, .value = c.calls.size()});
+      }
+      c.open.push_back(c.calls.size());
+      c.calls.push_back(call);
+    } else if (r.opcode == RET) {
+      if (c.open.empty()) {
+        c.top_level.push_back({.is_return = true, .value = r.instruction});
+      } else {
+        c.calls[c.open.back()].end = r.instruction;
+        c.open.pop_back();
+      }
+    }
+
+    if (r.wrote) {
+      const auto address = r.address.to_uint();
+      c.writes.push_back({
+          .instruction = r.instruction,
+          .address = std::uint16_t(address),
+          .value = std::uint16_t(r.value.to_uint()),
+      });
+      if (address >= 0x8000) {
+        registers[address - 0x8000] = r.value;
+      }
+    }
+  }
+
+  return c;
+}
+
+template <typename T>
+void write_array(FILE *f, std::vector<T> const &v, std::string const &name) {
+  const auto bytes = v.size() * sizeof(T);
+  const std::array<std::byte, 8> zeros = {};
+  if ((bytes != 0 && ::fwrite(v.data(), bytes, 1, f) != 1) ||
+      (padded(bytes) != bytes &&
+       ::fwrite(zeros.data(), padded(bytes) - bytes, 1, f) != 1)) {
+    throw std::runtime_error(std::format("could not write index {}", name));
+  }
+}
+
+} // namespace
+
+void trace_index::build(std::string const &trace_file,
+                        std::string const &index_file, unsigned threads) {
+  mapped_file trace(trace_file);
+  const trace_reader reader(trace.bytes());
+
+  // Split the sync points evenly. Traces without them are a single chunk.
+  const auto sync_points = reader.sync_points().size();
+  const auto n_chunks =
+      std::max<std::size_t>(1, std::min<std::size_t>(threads, sync_points));
+
+  std::vector<chunk> chunks(n_chunks);
+  {
+    std::vector<std::jthread> workers;
+    for (auto i = 0u; i < n_chunks; ++i) {
+      workers.emplace_back([&, i] {
+        chunks[i] = sync_points == 0
+                        ? index_chunk(reader)
+                        : index_chunk(reader.slice(i * sync_points / n_chunks,
+                                                   (i + 1) * sync_points /
+                                                       n_chunks));
+      });
+    }
+  }
+
+  // Stitch the calls together, carrying over the ones still in progress
+  std::vector<call> calls;
+  std::vector<std::uint64_t> open;
+  for (auto &c : chunks) {
+    const auto base = calls.size();
+    for (auto &call : c.calls) {
+      if (call.parent != none) {
+        call.parent += base;
+      }
+    }
+    for (auto const &ev : c.top_level) {
+      if (ev.is_return) {
+        if (!open.empty()) {
+          calls[open.back()].end = ev.value;
+          open.pop_back();
+        }
+        continue;
+      }
+      c.calls[ev.value].parent = open.empty() ? none : open.back();
+    }
+    calls.insert(calls.end(), c.calls.begin(), c.calls.end());
+    for (auto i : c.open) {
+      open.push_back(base + i);
+    }
+  }
+  for (auto &call : calls) {
+    call.depth = call.parent == none ? 0 : calls[call.parent].depth + 1;
+  }
+
+  std::vector<std::uint64_t> call_offsets(Memory::heap_size + 1, 0);
+  for (auto const &call : calls) {
+    ++call_offsets[call.target + 1u];
+  }
+  for (auto i = 1u; i < call_offsets.size(); ++i) {
+    call_offsets[i] += call_offsets[i - 1];
+  }
+  std::vector<std::uint64_t> calls_by_target(calls.size());
+  {
+    auto cursor = call_offsets;
+    for (auto i = 0u; i < calls.size(); ++i) {
+      calls_by_target[cursor[calls[i].target]++] = i;
+    }
+  }
+
+  // Writes are sorted by address, and then by instruction. Every chunk
+  // scatters its own writes, which come after those of earlier chunks.
+  std::vector<std::vector<std::uint64_t>> cursors(
+      n_chunks, std::vector<std::uint64_t>(address_count + 1, 0));
+  for (auto i = 0u; i < n_chunks; ++i) {
+    for (auto const &w : chunks[i].writes) {
+      ++cursors[i][w.address];
+    }
+  }
+  std::vector<std::uint64_t> write_offsets(address_count + 1, 0);
+  std::uint64_t total = 0;
+  for (auto a = 0u; a < address_count; ++a) {
+    write_offsets[a] = total;
+    for (auto &cursor : cursors) {
+      const auto n = cursor[a];
+      cursor[a] = total;
+      total += n;
+    }
+  }
+  write_offsets[address_count] = total;
+
+  std::vector<std::uint64_t> write_instructions(total);
+  std::vector<std::uint16_t> write_values(total);
+  {
+    std::vector<std::jthread> workers;
+    for (auto i = 0u; i < n_chunks; ++i) {
+      workers.emplace_back([&, i] {
+        auto &cursor = cursors[i];
+        for (auto const &w : chunks[i].writes) {
+          const auto at = cursor[w.address]++;
+          write_instructions[at] = w.instruction;
+          write_values[at] = w.value;
+        }
+      });
+    }
+  }
+
+  std::unique_ptr<FILE, int (*)(FILE *)> f(::fopen(index_file.c_str(), "wb"),
+                                           &::fclose);
+  if (f == nullptr) {
+    throw std::runtime_error(
+        std::format("could not open index {}", index_file));
+  }
+
+  file_header header{
+      .magic = {},
+      .trace_size = trace.bytes().size(),
+      .write_count = total,
+      .call_count = calls.size(),
+  };
+  std::copy(magic.begin(), magic.end(), header.magic.begin());
+  if (::fwrite(&header, sizeof(header), 1, f.get()) != 1) {
+    throw std::runtime_error(
+        std::format("could not write index {}", index_file));
+  }
+  write_array(f.get(), write_offsets, index_file);
+  write_array(f.get(), write_instructions, index_file);
+  write_array(f.get(), write_values, index_file);
+  write_array(f.get(), calls, index_file);
+  write_array(f.get(), call_offsets, index_file);
+  write_array(f.get(), calls_by_target, index_file);
+}
+
+trace_index::trace_index(std::string const &index_file,
+                         std::uint64_t trace_size)
+    : file(index_file) {
+  auto data = file.bytes();
+
+  file_header header;
+  if (data.size() < sizeof(header)) {
+    throw std::runtime_error(std::format("{} is not a trace index", index_file));
+  }
+  std::copy_n(data.data(), sizeof(header),
+              reinterpret_cast<std::byte *>(&header));
+  if (!std::equal(magic.begin(), magic.end(), header.magic.begin())) {
+    throw std::runtime_error(std::format("{} is not a trace index", index_file));
+  }
+  if (header.trace_size != trace_size) {
+    throw std::runtime_error(
+        std::format("{} does not belong to this trace", index_file));
+  }
+  data.remove_prefix(sizeof(header));
+
+  const auto take = [&]<typename T>(std::span<T const> &out,
+                                    std::uint64_t count) {
+    const auto bytes = padded(std::size_t(count) * sizeof(T));
+    if (count > data.size() / sizeof(T) || bytes > data.size()) {
+      throw std::runtime_error(std::format("{} is truncated", index_file));
+    }
+    out = {reinterpret_cast<T const *>(data.data()), std::size_t(count)};
+    data.remove_prefix(bytes);
+  };
+
+  take(write_offsets, address_count + 1);
+  take(write_instructions, header.write_count);
+  take(write_values, header.write_count);
+  take(m_calls, header.call_count);
+  take(call_offsets, Memory::heap_size + 1);
+  take(calls_by_target, header.call_count);
+
+  if (write_offsets.back() != header.write_count ||
+      call_offsets.back() != header.call_count) {
+    throw std::runtime_error(std::format("{} is corrupt", index_file));
+  }
+}
+
+std::vector<trace_index::write> trace_index::writes(Word address) const {
+  const auto a = address.to_uint();
+  if (a >= address_count) {
+    throw std::runtime_error(std::format("Address {:04x} is out of range", a));
+  }
+
+  std::vector<write> out;
+  for (auto i = write_offsets[a]; i < write_offsets[a + 1]; ++i) {
+    out.push_back({.instruction = write_instructions[i],
+                   .value = Word(write_values[i])});
+  }
+  return out;
+}
+
+std::optional<trace_index::write>
+trace_index::last_write(Word address, std::uint64_t instruction) const {
+  const auto a = address.to_uint();
+  if (a >= address_count) {
+    throw std::runtime_error(std::format("Address {:04x} is out of range", a));
+  }
+
+  const auto begin = write_instructions.begin() + write_offsets[a];
+  const auto end = write_instructions.begin() + write_offsets[a + 1];
+  const auto it = std::lower_bound(begin, end, instruction);
+  if (it == begin) {
+    return std::nullopt;
+  }
+
+  const auto i = std::size_t(it - write_instructions.begin()) - 1;
+  return write{.instruction = write_instructions[i],
+               .value = Word(write_values[i])};
+}
+
+std::span<std::uint64_t const> trace_index::calls_to(Word target) const {
+  const auto t = target.to_uint();
+  if (t >= Memory::heap_size) {
+    return {};
+  }
+  return calls_by_target.subspan(call_offsets[t],
+                                 call_offsets[t + 1] - call_offsets[t]);
+}
+
+std::vector<std::uint64_t>
+trace_index::stack_at(std::uint64_t instruction) const {
+  // Calls nest, so every call in progress encloses the last one to start
+  const auto it = std::lower_bound(
+      m_calls.begin(), m_calls.end(), instruction,
+      [](call const &c, std::uint64_t i) { return c.begin < i; });
+
+  std::vector<std::uint64_t> stack;
+  if (it == m_calls.begin()) {
+    return stack;
+  }
+
+  for (auto i = std::uint64_t(it - m_calls.begin()) - 1; i != none;
+       i = m_calls[i].parent) {
+    if (m_calls[i].end == none || m_calls[i].end >= instruction) {
+      stack.push_back(i);
+    }
+  }
+  return stack;
+}
+
+} // namespace SynacorVM
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "memory.hpp"
+#include "word.hpp"
+
+namespace SynacorVM {
+
+// trace_index answers questions about an execution trace without decoding
+// it again: when every address was written, and every call with the
+// registers it was made with and when it returned.
+//
+// It is built from the trace in parallel chunks, one per range of sync
+// points, and saved to a file that is memory-mapped when reused.
+class trace_index {
+public:
+  constexpr static std::uint64_t none =
+      std::numeric_limits<std::uint64_t>::max();
+
+  // Heap and registers
+  constexpr static std::size_t address_count =
+      Memory::heap_size + Memory::register_count;
+
+  struct write {
+    std::uint64_t instruction;
+    Word value;
+  };
+
+  struct call {
+    std::uint64_t begin;  // Instruction count of the CALL
+    std::uint64_t end;    // Instruction count of its RET, or none
+    std::uint64_t parent; // Index of the call it was made from, or none
+    std::uint16_t target;
+    std::uint16_t caller; // Address of the CALL
+    std::uint32_t depth;
+    std::array<std::uint16_t, Memory::register_count> registers;
+  };
+
+  // Indexes trace_file into index_file using up to `threads` threads.
+  static void build(std::string const &trace_file,
+                    std::string const &index_file, unsigned threads);
+
+  // Maps an index built by build(). Throws if it is not an index of a trace
+  // of trace_size bytes.
+  trace_index(std::string const &index_file, std::uint64_t trace_size);
+
+  trace_index(trace_index const &) = delete;
+  trace_index &operator=(trace_index const &) = delete;
+
+  std::vector<write> writes(Word address) const;
+
+  // Last write to address by an instruction before `instruction`.
+  std::optional<write> last_write(Word address,
+                                  std::uint64_t instruction) const;
+
+  std::span<call const> calls() const noexcept { return m_calls; }
+
+  // Indices into calls() of the calls to target, in order.
+  std::span<std::uint64_t const> calls_to(Word target) const;
+
+  // Indices into calls() of the calls in progress right before
+  // `instruction` runs, innermost first.
+  std::vector<std::uint64_t> stack_at(std::uint64_t instruction) const;
+
+private:
+  mapped_file file;
+
+  std::span<std::uint64_t const> write_offsets;
+  std::span<std::uint64_t const> write_instructions;
+  std::span<std::uint16_t const> write_values;
+
+  std::span<call const> m_calls;
+  std::span<std::uint64_t const> call_offsets;
+  std::span<std::uint64_t const> calls_by_target;
+};
+
+} // namespace SynacorVM
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace SynacorVM::varint {
+
+// LEB128 encoding of unsigned integers: 7 bits per byte, least significant
+// group first, with the high bit set on every byte but the last.
+inline void write(std::basic_string<std::byte> &out, std::uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back(std::byte((v & 0x7f) | 0x80));
+    v >>= 7;
+  }
+  out.push_back(std::byte(v));
+}
+
+// Reads a varint from the front of in and advances it.
+inline std::uint64_t read(std::basic_string_view<std::byte> &in) {
+  std::uint64_t v = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (in.empty()) {
+      throw std::runtime_error("Truncated varint");
+    }
+    const auto b = static_cast<std::uint64_t>(in.front());
+    in.remove_prefix(1);
+
+    v |= (b & 0x7f) << shift;
+    if ((b & 0x80) == 0) {
+      return v;
+    }
+  }
+  throw std::runtime_error("Varint is too long");
+}
+
+} // namespace SynacorVM::varint
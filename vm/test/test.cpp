@@ -1,3 +1,17 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 
-#include "test_cpu.hpp"
\ No newline at end of file
+#include "test_call_stack.hpp"
+#include "test_condition.hpp"
+#include "test_control_flow.hpp"
+#include "test_coverage.hpp"
+#include "test_cpu.hpp"
+#include "test_debug.hpp"
+#include "test_gdbstub.hpp"
+#include "test_history.hpp"
+#include "test_lockstep.hpp"
+#include "test_profiler.hpp"
+#include "test_self_modification.hpp"
+#include "test_session.hpp"
+#include "test_snapshot.hpp"
+#include "test_trace.hpp"
+#include "test_trace_index.hpp"
\ No newline at end of file
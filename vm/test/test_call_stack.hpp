@@ -0,0 +1,93 @@
+#pragma once
+
+#include <doctest/doctest.h>
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "lib/call_stack.hpp"
+#include "lib/cpu.hpp"
+#include "lib/memory.hpp"
+#include "lib/symbols.hpp"
+#include "testutils/utils.hpp"
+
+TEST_CASE("call stack") {
+  auto lock = SET_TEST_DIR();
+
+  std::stringstream out;
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out};
+  ram.load(testutils::read_binary(testutils::fixture_path("trace/calls")));
+
+  SynacorVM::call_stack calls(vm);
+  vm.observers.push_back(&calls);
+
+  // Depth every time countdown starts, and at its deepest point
+  std::vector<std::size_t> depths;
+  std::vector<SynacorVM::call_stack::frame> deepest;
+  while (true) {
+    const auto ip = vm.instruction_pointer.to_uint();
+    if (ip == 0x11) {
+      depths.push_back(calls.frames().size());
+    }
+    if (calls.frames().size() > deepest.size()) {
+      deepest = calls.frames();
+    }
+    if (!vm.Step()) {
+      break;
+    }
+  }
+
+  // countdown(5) from address 3 recurses 5 times, countdown(3) through r1
+  // from address 0x0e 3 times
+  const std::vector<std::size_t> want{1, 2, 3, 4, 5, 6, 1, 2, 3, 4};
+  CHECK(depths == want);
+  CHECK(calls.frames().empty());
+
+  REQUIRE_EQ(deepest.size(), 6u);
+  CHECK_EQ(deepest[0].call_site.to_uint(), 3u);
+  CHECK_EQ(deepest[0].return_address().to_uint(), 5u);
+  CHECK_EQ(deepest[0].depth, 1u);
+  CHECK_EQ(deepest[5].call_site.to_uint(), 0x1du);
+  CHECK_EQ(deepest[5].target.to_uint(), 0x11u);
+  CHECK_EQ(deepest[5].depth, 11u);
+}
+
+TEST_CASE("symbol table") {
+  auto lock = SET_TEST_DIR();
+  using SynacorVM::Word;
+
+  std::stringstream in{"synacor-symbols 1\n0021 done\n0011 countdown\n"};
+  const auto symbols = SynacorVM::symbol_table::parse(in);
+
+  CHECK_EQ(symbols.describe(Word(0x11u)), "countdown");
+  CHECK_EQ(symbols.describe(Word(0x1du)), "countdown+12");
+  CHECK_EQ(symbols.describe(Word(0x22u)), "done+1");
+  CHECK_EQ(symbols.describe(Word(0x3u)), "0x0003");
+  CHECK_EQ(symbols.address_of("done").value().to_uint(), 0x21u);
+  CHECK_FALSE(symbols.address_of("missing").has_value());
+
+  std::stringstream bad{"0011 countdown\n"};
+  CHECK_THROWS_AS(SynacorVM::symbol_table::parse(bad), std::runtime_error);
+
+  // The assembler also writes where every statement comes from
+  const auto assembled =
+      SynacorVM::symbol_table::load("testdata/fixtures/trace/calls.sym");
+  CHECK_EQ(assembled.files().size(), 1u);
+  CHECK_EQ(assembled.where(Word(0x11u)), "calls.as:10:5");
+  CHECK_EQ(assembled.where(Word(0x12u)), "calls.as:10:5");
+  CHECK_EQ(assembled.where(Word(0x21u)), "calls.as:17:5");
+  CHECK_EQ(symbols.where(Word(0x11u)), "");
+  REQUIRE_NE(assembled.source_of(Word(0x1du)), nullptr);
+  CHECK_EQ(assembled.source_of(Word(0x1du))->row, 14u);
+
+  std::ifstream f("testdata/fixtures/trace/calls.sym");
+  std::stringstream file;
+  file << f.rdbuf();
+  std::stringstream saved;
+  assembled.save(saved);
+  CHECK_EQ(saved.str(), file.str());
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <doctest/doctest.h>
+
+#include <stdexcept>
+#include <string>
+
+#include "lib/condition.hpp"
+#include "lib/cpu.hpp"
+#include "lib/memory.hpp"
+
+inline bool eval_condition(std::string const &text) {
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram};
+  vm.instruction_pointer = SynacorVM::Number(0x1587);
+  ram[SynacorVM::Word(0x8000)] = SynacorVM::Word(6);
+  ram[SynacorVM::Word(0x8007)] = SynacorVM::Word(0x7fff);
+  ram[SynacorVM::Word(0x0aac)] = SynacorVM::Word(4);
+  for (auto i = 0u; i < 11; ++i) {
+    ram.push(SynacorVM::Word(i));
+  }
+
+  const auto c = SynacorVM::condition::parse(text);
+  REQUIRE_EQ(c.text(), text);
+  return c.evaluate(SynacorVM::execution_state(vm));
+}
+
+TEST_CASE("condition") {
+  SUBCASE("operands") {
+    CHECK(eval_condition("r0 == 6"));
+    CHECK(eval_condition("r7 == 0x7fff"));
+    CHECK(eval_condition("r1 == 0"));
+    CHECK(eval_condition("mem[0x0aac] == 4"));
+    CHECK(eval_condition("mem[0x8000] == 6"));
+    CHECK(eval_condition("mem[0x8008] == 0"));
+    CHECK(eval_condition("mem[0x0aa0 + 12] == 4"));
+    CHECK(eval_condition("depth == 11"));
+    CHECK(eval_condition("ip == 0x1587"));
+    CHECK(eval_condition("5"));
+    CHECK_FALSE(eval_condition("0"));
+  }
+
+  SUBCASE("operators") {
+    CHECK(eval_condition("r0 == 6 && mem[0x0aac] > 3 && depth > 10"));
+    CHECK_FALSE(eval_condition("r0 == 6 && mem[0x0aac] > 4"));
+    CHECK(eval_condition("r0 == 5 || r0 == 6"));
+    CHECK(eval_condition("1 + 2 * 3 == 7"));
+    CHECK(eval_condition("(1 + 2) * 3 == 9"));
+    CHECK(eval_condition("10 - 4 - 3 == 3"));
+    CHECK(eval_condition("7 / 2 == 3 && 7 % 2 == 1"));
+    CHECK(eval_condition("7 / 0 == 0 && 7 % 0 == 0"));
+    CHECK(eval_condition("r0 & 4 && !(r0 & 1)"));
+    CHECK(eval_condition("(r0 | 1) == 7"));
+    CHECK(eval_condition("-1 < 0 && ~0 == -1"));
+    CHECK(eval_condition("1 <= 1 && 1 >= 1 && 1 != 2"));
+    CHECK(eval_condition("1 == 1 == 1"));
+  }
+
+  SUBCASE("deep expression") {
+    std::string text = "1";
+    for (int i = 0; i < 40; ++i) {
+      text = "(1 + " + text + ")";
+    }
+    CHECK(eval_condition(text + " == 41"));
+  }
+
+  SUBCASE("syntax errors") {
+    CHECK_THROWS_AS(SynacorVM::condition::parse(""), std::runtime_error);
+    CHECK_THROWS_AS(SynacorVM::condition::parse("r8 == 1"),
+                    std::runtime_error);
+    CHECK_THROWS_AS(SynacorVM::condition::parse("r0 =="), std::runtime_error);
+    CHECK_THROWS_AS(SynacorVM::condition::parse("(r0"), std::runtime_error);
+    CHECK_THROWS_AS(SynacorVM::condition::parse("mem[1"), std::runtime_error);
+    CHECK_THROWS_AS(SynacorVM::condition::parse("0xzz"), std::runtime_error);
+    CHECK_THROWS_AS(SynacorVM::condition::parse("r0 r1"), std::runtime_error);
+  }
+}
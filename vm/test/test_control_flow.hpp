@@ -0,0 +1,136 @@
+#pragma once
+
+#include <doctest/doctest.h>
+
+#include <cstdint>
+#include <sstream>
+
+#include "arch/arch.hpp"
+#include "lib/control_flow.hpp"
+#include "lib/coverage.hpp"
+#include "lib/cpu.hpp"
+#include "lib/memory.hpp"
+#include "testutils/utils.hpp"
+
+inline void load_words(SynacorVM::Memory &ram,
+                       std::initializer_list<std::uint16_t> words) {
+  std::uint32_t a = 0;
+  for (const auto w : words) {
+    ram[SynacorVM::Number(a++)] = SynacorVM::Word(w);
+  }
+}
+
+TEST_CASE("control flow graph") {
+  using graph = SynacorVM::control_flow_graph;
+
+  // 0: set r0 1, call 9, jt r0 0, halt
+  // 9: add r0 r0 1, ret
+  // Every subcase starts over, as they change the memory
+  SynacorVM::Memory ram;
+  const auto reset = [&ram] {
+    load_words(ram, {1, 0x8000, 1, 17, 9, 7, 0x8000, 0, 0, 9, 0x8000, 0x8000,
+                     1, 18});
+  };
+
+  SUBCASE("decode") {
+    reset();
+    const auto add = SynacorVM::decode(ram, 9);
+    CHECK_EQ(add.verb, ADD);
+    CHECK_EQ(add.length, 4u);
+    CHECK_EQ(add.operands[2], 1u);
+
+    // set must write to a register, operands must be numbers or registers,
+    // and must be in the heap
+    ram[SynacorVM::Number(1)] = SynacorVM::Word(5);
+    CHECK_EQ(SynacorVM::decode(ram, 0).verb, ERROR);
+    ram[SynacorVM::Number(1)] = SynacorVM::Word(0x8008);
+    CHECK_EQ(SynacorVM::decode(ram, 0).verb, ERROR);
+    ram[SynacorVM::Number(0x7fff)] = SynacorVM::Word(19);
+    CHECK_EQ(SynacorVM::decode(ram, 0x7fff).verb, ERROR);
+    CHECK_EQ(SynacorVM::decode(ram, 0x7fff).length, 1u);
+    ram[SynacorVM::Number(0x7fff)] = SynacorVM::Word(0);
+  }
+
+  SUBCASE("blocks") {
+    reset();
+    graph g(ram);
+    const auto main = g.at(0);
+    CHECK_EQ(main.last, 3u);
+    CHECK_EQ(main.end, 5u);
+    CHECK_EQ(main.exit, CALL);
+    CHECK_EQ(main.destination, 9u);
+    CHECK_EQ(main.next, 5u);
+    CHECK(g.is_call_target(9));
+    CHECK(g.is_return_site(5));
+
+    const auto loop = g.at(5);
+    CHECK_EQ(loop.exit, JT);
+    CHECK_EQ(loop.destination, 0u);
+    CHECK_EQ(loop.next, 8u);
+
+    CHECK_EQ(g.at(8).next, graph::none);
+    CHECK_EQ(g.at(9).exit, RET);
+
+    // Blocks of other leaders overlap
+    CHECK_EQ(g.at(3).end, 5u);
+    CHECK_EQ(g.blocks().size(), 5u);
+  }
+
+  SUBCASE("explore") {
+    reset();
+    graph g(ram);
+    g.explore({0});
+    const auto blocks = g.blocks();
+    REQUIRE_EQ(blocks.size(), 4u);
+    CHECK_EQ(blocks[0].first, 0u);
+    CHECK_EQ(blocks[1].first, 5u);
+    CHECK_EQ(blocks[2].first, 8u);
+    CHECK_EQ(blocks[3].first, 9u);
+  }
+
+  SUBCASE("writes") {
+    reset();
+    graph g(ram);
+    g.explore({0});
+    const auto id = g.at(9).id;
+
+    // Writes to data and registers change nothing
+    g.on_write(SynacorVM::Word(0x100));
+    g.on_write(SynacorVM::Word(0x8000));
+    CHECK_EQ(g.blocks().size(), 4u);
+
+    // The operand of the add
+    ram[SynacorVM::Number(12)] = SynacorVM::Word(2);
+    g.on_write(SynacorVM::Word(12));
+    CHECK_EQ(g.blocks().size(), 3u);
+    CHECK_NE(g.at(9).id, id);
+
+    // Calling the halt instead
+    ram[SynacorVM::Number(4)] = SynacorVM::Word(8);
+    g.on_write(SynacorVM::Word(4));
+    CHECK_FALSE(g.is_call_target(9));
+    CHECK_FALSE(g.is_return_site(5));
+    CHECK_EQ(g.at(0).destination, 8u);
+    CHECK(g.is_call_target(8));
+  }
+}
+
+// The program changes code that already ran
+TEST_CASE("coverage of modified code") {
+  // 0: call 7, wmem 7 19, jmp 7
+  // 7: ret, which becomes out 'a', halt
+  SynacorVM::Memory ram;
+  load_words(ram, {17, 7, 16, 7, 19, 6, 7, 18, 'a', 0});
+
+  std::stringstream out;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out};
+  SynacorVM::control_flow_graph graph(ram);
+  SynacorVM::coverage cov(vm, graph);
+  vm.observers = {&graph, &cov};
+  while (vm.Step()) {
+  }
+
+  CHECK_EQ(out.str(), "a");
+  CHECK_EQ(cov.report().covered.count(), 10u);
+  CHECK_EQ(cov.report().blocks.count(), 3u);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <doctest/doctest.h>
+
+#include <bitset>
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "arch/arch.hpp"
+#include "lib/control_flow.hpp"
+#include "lib/coverage.hpp"
+#include "lib/cpu.hpp"
+#include "lib/memory.hpp"
+#include "lib/observer.hpp"
+#include "testutils/utils.hpp"
+
+// Coverage the slow way: every instruction that runs
+struct instruction_coverage : SynacorVM::observer {
+  SynacorVM::CPU &cpu;
+  std::bitset<SynacorVM::Memory::heap_size> covered = {};
+  std::bitset<SynacorVM::Memory::heap_size> leaders = {};
+  bool leader = true;
+
+  explicit instruction_coverage(SynacorVM::CPU &cpu) : cpu(cpu) {}
+
+  void on_instruction(SynacorVM::Number ip) override {
+    const auto v = static_cast<Verb>(cpu.memory[ip].to_uint());
+    for (auto i = 0; i <= arch::argument_count(v); ++i) {
+      covered.set(ip.to_uint() + unsigned(i));
+    }
+    leaders[ip.to_uint()] = leaders[ip.to_uint()] || leader;
+    leader = v == JMP || v == JT || v == JF || v == CALL || v == RET;
+  }
+};
+
+inline SynacorVM::coverage_report run_coverage(std::string_view test_name,
+                                               std::size_t max_steps) {
+  std::stringstream in{"Hello, world!"};
+  std::stringstream out;
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out, .stdIn = &in};
+  ram.load(testutils::read_binary(testutils::fixture_path(test_name)));
+
+  SynacorVM::control_flow_graph graph(ram);
+  SynacorVM::coverage cov(vm, graph);
+  instruction_coverage want(vm);
+  vm.observers = {&graph, &cov, &want};
+  for (auto i = 0u; i < max_steps && vm.Step(); ++i) {
+  }
+
+  // Blocks are only covered once they start, and then entirely
+  if (max_steps == std::size_t(-1)) {
+    REQUIRE(cov.report().covered == want.covered);
+  }
+  REQUIRE(cov.report().blocks == want.leaders);
+  return cov.report();
+}
+
+TEST_CASE("coverage") {
+  auto lock = SET_TEST_DIR();
+
+  for (auto name : {"trace/calls", "history/echo", "cpu/call-ret"}) {
+    INFO(name);
+    const auto full = run_coverage(name, std::size_t(-1));
+    CHECK_GT(full.blocks.count(), 1u);
+
+    // Save and load
+    const std::string file = "coverage.txt";
+    full.save(file);
+    const auto loaded = SynacorVM::coverage_report::load(file);
+    std::remove(file.c_str());
+    CHECK_EQ(loaded.image, full.image);
+    CHECK(loaded.covered == full.covered);
+    CHECK(loaded.blocks == full.blocks);
+
+    // Partial runs merge into the full one
+    auto merged = run_coverage(name, 3);
+    CHECK_LT(merged.covered.count(), full.covered.count());
+    merged |= full;
+    CHECK(merged.covered == full.covered);
+    CHECK(merged.blocks == full.blocks);
+  }
+
+  auto a = run_coverage("trace/calls", 3);
+  const auto b = run_coverage("history/echo", 3);
+  CHECK_THROWS_AS(a |= b, std::runtime_error);
+}
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <doctest/doctest.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "arch/arch.hpp"
+#include "cmd/vmctl.hpp"
+#include "lib/cpu.hpp"
+#include "lib/debug.hpp"
+#include "lib/memory.hpp"
+#include "lib/symbols.hpp"
+#include "testutils/utils.hpp"
+
+// Runs a fixture and returns the instruction counts at which the traps hit
+inline std::vector<std::uint64_t> trap_hits(SynacorVM::trap_set const &traps) {
+  std::stringstream out;
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out};
+  ram.load(
+      testutils::read_binary(testutils::fixture_path("lockstep/sweep")));
+
+  std::vector<std::uint64_t> hits;
+  vm.traps = &traps;
+  vm.pre_exec_hook = [&](SynacorVM::execution_state) {
+    hits.push_back(vm.instruction_count);
+  };
+  vm.Run();
+  REQUIRE_EQ(out.str(), "a\nS");
+
+  return hits;
+}
+
+TEST_CASE("trap set") {
+  auto lock = SET_TEST_DIR();
+
+  using SynacorVM::Number;
+  using SynacorVM::Word;
+
+  SUBCASE("hit") {
+    SynacorVM::trap_set traps;
+    const auto add = Word(static_cast<unsigned>(Verb::ADD));
+    CHECK_FALSE(traps.hit(Number(3), add, 0));
+
+    traps.addresses.set(3);
+    CHECK(traps.hit(Number(3), add, 0));
+    CHECK_FALSE(traps.hit(Number(4), add, 0));
+
+    traps.opcodes = 1u << unsigned(Verb::ADD);
+    CHECK(traps.hit(Number(4), add, 0));
+    CHECK_FALSE(traps.hit(Number(4), Word(unsigned(Verb::MULT)), 0));
+
+    traps.at_instruction = 7;
+    CHECK(traps.hit(Number(4), Word(unsigned(Verb::MULT)), 7));
+    CHECK_FALSE(traps.hit(Number(4), Word(unsigned(Verb::MULT)), 8));
+  }
+
+  // The loop is at address 3 and runs 10 times, 7 instructions each
+  SUBCASE("none") {
+    SynacorVM::trap_set traps;
+    CHECK(trap_hits(traps).empty());
+  }
+
+  SUBCASE("address") {
+    SynacorVM::trap_set traps;
+    traps.addresses.set(3);
+    const std::vector<std::uint64_t> want{1, 8, 15, 22, 29, 36, 43, 50, 57, 64};
+    CHECK(trap_hits(traps) == want);
+  }
+
+  SUBCASE("opcode") {
+    SynacorVM::trap_set traps;
+    traps.opcodes = 1u << unsigned(Verb::WMEM);
+    const std::vector<std::uint64_t> want{4, 11, 18, 25, 32, 39, 46, 53, 60, 67};
+    CHECK(trap_hits(traps) == want);
+  }
+
+  SUBCASE("instruction count") {
+    SynacorVM::trap_set traps;
+    traps.at_instruction = 5;
+    const std::vector<std::uint64_t> want{5};
+    CHECK(trap_hits(traps) == want);
+  }
+
+  SUBCASE("every instruction") {
+    SynacorVM::trap_set traps;
+    traps.every_instruction = true;
+    CHECK_EQ(trap_hits(traps).size(), 81u);
+  }
+}
+
+// Runs the fixture under vmctl's command preprocessor with the given commands
+// and returns the number of instructions executed.
+inline std::uint64_t run_vmctl(std::string const &commands) {
+  std::stringstream in{commands};
+  std::stringstream out;
+  std::unique_ptr<SynacorVM::coverage> cov;
+
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out};
+  ram.load(
+      testutils::read_binary(testutils::fixture_path("lockstep/sweep")));
+
+  command_preprocessor p(in, cov);
+  p.install(vm);
+  vm.Run();
+
+  return vm.instruction_count;
+}
+
+TEST_CASE("vmctl skip") {
+  auto lock = SET_TEST_DIR();
+
+  // !exit replaces the next instruction by a HALT, which also counts
+  CHECK_EQ(run_vmctl("!exit\n"), 1u);
+  CHECK_EQ(run_vmctl("!step\n!exit\n"), 2u);
+  CHECK_EQ(run_vmctl("!skip 5\n!exit\n"), 6u);
+  CHECK_EQ(run_vmctl("!skip 5\n!skip 20\n!exit\n"), 26u);
+  CHECK_EQ(run_vmctl("!skip 5\n!cont\n"), 81u);
+}
+
+TEST_CASE("vmctl interrupt") {
+  auto lock = SET_TEST_DIR();
+
+  std::stringstream in{"!cont\n"};
+  std::stringstream out;
+  std::unique_ptr<SynacorVM::coverage> cov;
+
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out};
+  ram.load(
+      testutils::read_binary(testutils::fixture_path("lockstep/sweep")));
+
+  command_preprocessor p(in, cov);
+  p.install(vm);
+
+  // As the SIGINT handler does, far from any breakpoint or input
+  vm.post_exec_hook = [&](auto, bool) {
+    if (vm.instruction_count == 10) {
+      command_preprocessor::interrupted = 1;
+    }
+  };
+  vm.Run();
+  command_preprocessor::interrupted = 0;
+
+  // The next instruction is replaced by a HALT
+  CHECK_EQ(vm.instruction_count, 11u);
+}
+
+TEST_CASE("vmctl script") {
+  auto lock = SET_TEST_DIR();
+
+  const std::string commands =
+      "!abreak 3 if r0 == 4\n!cont\n!setr 9 1\n!skip 5\n!cont\n";
+
+  std::stringstream in{commands};
+  std::stringstream out;
+  std::unique_ptr<SynacorVM::coverage> cov;
+
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out};
+  ram.load(
+      testutils::read_binary(testutils::fixture_path("lockstep/sweep")));
+
+  std::stringstream dummy;
+  command_preprocessor p(dummy, cov);
+  p.install(vm);
+  p.load_script(script::parse(in));
+  vm.Run();
+
+  // Same as reading the commands interactively
+  CHECK_EQ(vm.instruction_count, run_vmctl(commands));
+
+  std::stringstream report;
+  p.write_report(report, out.str(), 0);
+  const auto r = report.str();
+  CHECK_NE(r.find("\"instructions\": 81,"), std::string::npos);
+  CHECK_NE(r.find(R"({"line": 2, "command": "!cont", "instruction": 0, )"
+                  R"("ok": true})"),
+           std::string::npos);
+  CHECK_NE(r.find(R"({"line": 3, "command": "!setr 9 1", "instruction": 29, )"
+                  R"("ok": false, "error": )"),
+           std::string::npos);
+  CHECK_NE(r.find(R"("output": "a\nS")"), std::string::npos);
+
+  // Unknown commands are found before running
+  std::stringstream bad{"!cont\n!bogus 1\n"};
+  command_preprocessor q(dummy, cov);
+  CHECK_THROWS_AS(q.load_script(script::parse(bad)), std::runtime_error);
+}
+
+TEST_CASE("vmctl conditional breakpoint") {
+  auto lock = SET_TEST_DIR();
+
+  // The loop starts at address 3: r0 is 4 on its fifth iteration
+  CHECK_EQ(run_vmctl("!abreak 3 if r0 == 4\n!cont\n!exit\n"), 30u);
+  CHECK_EQ(run_vmctl("!abreak 3 if r0 == 4 && depth == 4\n!cont\n!exit\n"),
+           30u);
+  CHECK_EQ(run_vmctl("!abreak 3 if r0 == 99\n!cont\n"), 81u);
+
+  // Toggling it off removes the condition too
+  CHECK_EQ(run_vmctl("!abreak 3 if r0 == 4\n!abreak 3\n!abreak 3\n!cont\n"
+                     "!exit\n"),
+           2u);
+}
+
+TEST_CASE("vmctl reverse execution") {
+  auto lock = SET_TEST_DIR();
+
+  CHECK_EQ(run_vmctl("!history\n!skip 10\n!rstep 3\n!exit\n"), 8u);
+  CHECK_EQ(run_vmctl("!history\n!skip 10\n!rstep\n!step\n!exit\n"), 11u);
+  CHECK_EQ(run_vmctl("!history\n!skip 10\n!rstep 50\n!exit\n"), 1u);
+
+  // Going back cancels the pending !step, so !cont runs to the end
+  CHECK_EQ(run_vmctl("!history\n!skip 10\n!step\n!rstep 3\n!cont\n!exit\n"),
+           81u);
+
+  // Runs back to the last time the loop started
+  CHECK_EQ(run_vmctl("!history\n!skip 20\n!abreak 3\n!rcont\n!exit\n"),
+           16u);
+}
+
+TEST_CASE("vmctl snapshots") {
+  auto lock = SET_TEST_DIR();
+
+  // Snapshots can be compared with each other or with the current state
+  CHECK_EQ(run_vmctl("!snap first\n!skip 10\n!snap second\n!diff first\n"
+                     "!diff first second\n!diff second.snap\n!exit\n"),
+           11u);
+  for (auto file : {"first.snap", "second.snap"}) {
+    CHECK_EQ(std::remove(file), 0);
+  }
+}
+
+TEST_CASE("vmctl backtrace") {
+  auto lock = SET_TEST_DIR();
+
+  // Breakpoints can be set at labels
+  std::stringstream in{
+      "!bt\n!abreak done\n!cont\n!bt\n!abreak countdown+16\n!cont\n"};
+  std::stringstream out;
+  std::unique_ptr<SynacorVM::coverage> cov;
+
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out};
+  ram.load(testutils::read_binary(testutils::fixture_path("trace/calls")));
+
+  command_preprocessor p(in, cov);
+  p.set_symbols(
+      SynacorVM::symbol_table::load("testdata/fixtures/trace/calls.sym"));
+  p.install(vm);
+
+  // Backtrace at the bottom of countdown(5), taken before vmctl stops there
+  std::string bt;
+  auto hook = vm.pre_exec_hook;
+  vm.pre_exec_hook = [&](SynacorVM::execution_state es) {
+    if (bt.empty() && es.instruction_ptr.to_uint() == 0x21) {
+      bt = p.backtrace();
+    }
+    hook(es);
+  };
+  vm.Run();
+
+  std::string want = "#0  0x0021 in done at calls.as:17:5\n";
+  for (int i = 1; i <= 5; ++i) {
+    want += std::format("#{:<2} 0x001d in countdown+12 at calls.as:14:5\n", i);
+  }
+  want += "#6  0x0003 in 0x0003 at calls.as:2:5\n";
+  CHECK_EQ(bt, want);
+
+  // Offsets are numbers in any base, as addresses are
+  CHECK_EQ(p.address_of("0x21"), 0x21ul);
+  CHECK_EQ(p.address_of("countdown+0x10"), p.address_of("countdown+16"));
+  CHECK_THROWS_AS(p.address_of("dnoe"), std::runtime_error);
+  CHECK_THROWS_AS(p.address_of("done+x"), std::runtime_error);
+}
+
+TEST_CASE("watchpoints") {
+  auto lock = SET_TEST_DIR();
+
+  using SynacorVM::watchpoints;
+  using SynacorVM::Word;
+
+  std::stringstream out;
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out};
+  ram.load(testutils::read_binary(testutils::fixture_path("cpu/rwmem")));
+
+  SynacorVM::trap_set traps;
+  watchpoints watches(traps);
+  watches.set(Word(0x0009), watchpoints::READ_WRITE); // data
+  watches.set(Word(0x8000), watchpoints::WRITE);      // r0
+  REQUIRE_EQ(watches.get(Word(0x0009)), watchpoints::READ_WRITE);
+  REQUIRE_EQ(watches.get(Word(0x8001)), watchpoints::NONE);
+
+  std::vector<std::uint64_t> stops;
+  std::vector<watchpoints::hit> hits;
+  vm.traps = &traps;
+  vm.observers.push_back(&watches);
+  vm.pre_exec_hook = [&](SynacorVM::execution_state) {
+    REQUIRE(traps.pending);
+    traps.pending = false;
+    stops.push_back(vm.instruction_count);
+    for (auto const &h : watches.take_hits()) {
+      hits.push_back(h);
+    }
+  };
+
+  vm.Run();
+  REQUIRE_EQ(out.str(), "A");
+
+  // Stops right after the instructions that hit
+  const std::vector<std::uint64_t> want_stops{1, 2};
+  REQUIRE(stops == want_stops);
+  REQUIRE_EQ(hits.size(), 3u);
+
+  CHECK_EQ(hits[0].ip.to_uint(), 0x0000);
+  CHECK_EQ(hits[0].address.to_uint(), 0x0009);
+  CHECK_EQ(hits[0].kind, watchpoints::WRITE);
+  CHECK_EQ(hits[0].old_value.to_uint(), 'X');
+  CHECK_EQ(hits[0].value.to_uint(), 'A');
+
+  CHECK_EQ(hits[1].ip.to_uint(), 0x0003);
+  CHECK_EQ(hits[1].address.to_uint(), 0x0009);
+  CHECK_EQ(hits[1].kind, watchpoints::READ);
+  CHECK_EQ(hits[1].value.to_uint(), 'A');
+
+  CHECK_EQ(hits[2].ip.to_uint(), 0x0003);
+  CHECK_EQ(hits[2].address.to_uint(), 0x8000);
+  CHECK_EQ(hits[2].kind, watchpoints::WRITE);
+  CHECK_EQ(hits[2].old_value.to_uint(), 0);
+  CHECK_EQ(hits[2].value.to_uint(), 'A');
+
+  // Disarming the last watchpoint leaves the set empty
+  watches.set(Word(0x0009), watchpoints::NONE);
+  REQUIRE_FALSE(watches.empty());
+  watches.set(Word(0x8000), watchpoints::NONE);
+  REQUIRE(watches.empty());
+}
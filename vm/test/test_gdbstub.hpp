@@ -0,0 +1,168 @@
+#pragma once
+
+#include <doctest/doctest.h>
+
+#include <chrono>
+#include <format>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "cmd/gdbstub.hpp"
+#include "lib/cpu.hpp"
+#include "lib/memory.hpp"
+#include "testutils/utils.hpp"
+
+// Minimal RSP client: sends a packet and returns the payload of the reply
+class rsp_client {
+public:
+  explicit rsp_client(int fd) : fd(fd) {}
+  ~rsp_client() { ::close(fd); }
+
+  void send(std::string_view payload) {
+    unsigned sum = 0;
+    for (char c : payload) {
+      sum += static_cast<unsigned char>(c);
+    }
+    const auto framed = std::format("${}#{:02x}", payload, sum & 0xff);
+    REQUIRE_EQ(::write(fd, framed.data(), framed.size()),
+               static_cast<ssize_t>(framed.size()));
+    REQUIRE_EQ(get(), '+');
+  }
+
+  std::string receive() {
+    while (get() != '$') {
+    }
+    std::string payload;
+    for (char c = get(); c != '#'; c = get()) {
+      payload += c;
+    }
+    get();
+    get();
+    REQUIRE_EQ(::write(fd, "+", 1), 1);
+    return payload;
+  }
+
+  std::string ask(std::string_view payload) {
+    send(payload);
+    return receive();
+  }
+
+  void interrupt() { REQUIRE_EQ(::write(fd, "\x03", 1), 1); }
+
+private:
+  char get() {
+    char c = 0;
+    REQUIRE_EQ(::read(fd, &c, 1), 1);
+    return c;
+  }
+
+  int fd;
+};
+
+// The VM runs in a thread and stops in the stub; the test is the client
+TEST_CASE("gdb stub") {
+  auto lock = SET_TEST_DIR();
+
+  int fds[2];
+  REQUIRE_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+  std::stringstream out;
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out};
+  ram.load(
+      testutils::read_binary(testutils::fixture_path("lockstep/sweep")));
+
+  gdb_stub stub(fds[0]);
+  stub.install(vm);
+  std::jthread machine([&] {
+    vm.Run();
+    stub.finish();
+  });
+
+  rsp_client client(fds[1]);
+
+  // Stopped before the first instruction
+  CHECK_EQ(client.ask("?"), "S05");
+  CHECK_EQ(client.ask("qSupported:multiprocess+"),
+           "PacketSize=4000;qXfer:features:read+");
+  CHECK_EQ(client.ask("g"), "000000000000000000000000000000000000");
+
+  // The loop starts at word 3: add r0 r0 1
+  CHECK_EQ(client.ask("m6,8"), "0900008000800100");
+  CHECK_EQ(client.ask("Z0,6,2"), "OK");
+  CHECK_EQ(client.ask("c"), "S05");
+  CHECK_EQ(client.ask("p8"), "0300");
+  CHECK_EQ(client.ask("p0"), "0000");
+  CHECK_EQ(client.ask("c"), "S05");
+  CHECK_EQ(client.ask("p0"), "0100");
+
+  // Registers and memory can be written
+  CHECK_EQ(client.ask("P0=0800"), "OK");
+  CHECK_EQ(client.ask("z0,6,2"), "OK");
+
+  // wmem 0x1000 r0 writes byte address 0x2000
+  CHECK_EQ(client.ask("Z2,2000,2"), "OK");
+  CHECK_EQ(client.ask("c"), "T05watch:2000;");
+  CHECK_EQ(client.ask("m2000,2"), "0900");
+  CHECK_EQ(client.ask("z2,2000,2"), "OK");
+
+  // Single steps
+  CHECK_EQ(client.ask("p8"), "1200");
+  CHECK_EQ(client.ask("s"), "S05");
+  CHECK_EQ(client.ask("p8"), "1400");
+
+  // A pc outside the heap is refused and leaves every register untouched
+  const auto registers = client.ask("g");
+  CHECK_EQ(client.ask("G" + std::string(32, '0') + "0080"), "E01");
+  CHECK_EQ(client.ask("P8=0080"), "E01");
+  CHECK_EQ(client.ask("g"), registers);
+  CHECK_EQ(client.ask("p8"), "1400");
+
+  CHECK_EQ(client.ask("M0,0:"), "OK");
+  CHECK_EQ(client.ask("m10000,2"), "E01");
+  CHECK_EQ(client.ask("vMustReplyEmpty"), "");
+
+  // The loop ends when r0 reaches 10, one round later
+  CHECK_EQ(client.ask("c"), "W00");
+  machine.join();
+  CHECK_EQ(out.str(), "a\nS");
+}
+
+// A program that never stops on its own can be interrupted, which is only
+// noticed at the next poll of the connection, and killed
+TEST_CASE("gdb stub interrupt") {
+  auto lock = SET_TEST_DIR();
+
+  int fds[2];
+  REQUIRE_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram};
+  ram.load(testutils::read_binary(testutils::fixture_path("gdb/spin")));
+
+  gdb_stub stub(fds[0]);
+  stub.install(vm);
+  std::jthread machine([&] {
+    vm.Run();
+    stub.finish();
+  });
+
+  rsp_client client(fds[1]);
+  CHECK_EQ(client.ask("?"), "S05");
+  CHECK_EQ(client.ask("qXfer:features:read:target.xml:0,5"), "m<?xml");
+
+  client.send("c");
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  client.interrupt();
+  CHECK_EQ(client.receive(), "S02");
+  CHECK_EQ(client.ask("g").size(), 36u);
+
+  client.send("k");
+  machine.join();
+  CHECK(vm.instruction_count > gdb_stub::poll_interval);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <doctest/doctest.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "lib/cpu.hpp"
+#include "lib/history.hpp"
+#include "lib/memory.hpp"
+#include "lib/snapshot.hpp"
+#include "testutils/utils.hpp"
+
+inline void test_history(std::size_t max_bytes,
+                         std::uint64_t snapshot_interval) {
+  auto lock = SET_TEST_DIR();
+
+  std::stringstream in{"Hello, world!"};
+  std::stringstream out;
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out, .stdIn = &in};
+  ram.load(
+      testutils::read_binary(testutils::fixture_path("history/echo")));
+
+  SynacorVM::history past(vm, max_bytes, snapshot_interval);
+  vm.observers.push_back(&past);
+
+  // State after every instruction
+  std::vector<std::uint64_t> sums{SynacorVM::checksum(vm)};
+  while (vm.Step()) {
+    sums.push_back(SynacorVM::checksum(vm));
+  }
+  sums.push_back(SynacorVM::checksum(vm));
+  REQUIRE_EQ(out.str(), "Hello, world!");
+
+  const auto end = vm.instruction_count;
+  REQUIRE_EQ(sums.size(), end + 1);
+
+  // Going back lands on the same states, and running forward again reads the
+  // same input
+  for (auto target : {end - 1, end - 2, end / 2, end / 2 - 7, past.oldest()}) {
+    INFO(std::format("rewind to {}", target));
+    past.rewind(target);
+    REQUIRE_EQ(vm.instruction_count, target);
+    REQUIRE_EQ(SynacorVM::checksum(vm), sums[target]);
+  }
+
+  const auto oldest = past.oldest();
+  while (vm.Step()) {
+    REQUIRE_EQ(SynacorVM::checksum(vm), sums[vm.instruction_count]);
+  }
+  REQUIRE_EQ(vm.instruction_count, end);
+  REQUIRE_EQ(SynacorVM::checksum(vm), sums[end]);
+  REQUIRE_EQ(in.get(), std::char_traits<char>::eof());
+
+  if (oldest > 0) {
+    REQUIRE_THROWS_AS(past.rewind(oldest - 1), std::runtime_error);
+  }
+}
+
+TEST_CASE("history") {
+  SUBCASE("default") {
+    test_history(SynacorVM::history::default_max_bytes,
+                 SynacorVM::history::default_snapshot_interval);
+  }
+  SUBCASE("snapshots") {
+    test_history(SynacorVM::history::default_max_bytes, 4);
+  }
+  SUBCASE("bounded") { test_history(1024, 3); }
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <doctest/doctest.h>
+
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <sstream>
+#include <string>
+
+#include "lib/cpu.hpp"
+#include "lib/lockstep.hpp"
+#include "lib/memory.hpp"
+#include "lib/snapshot.hpp"
+#include "testutils/utils.hpp"
+
+// Runs the same machine with the regular interpreter
+inline SynacorVM::lockstep::lane_result
+run_scalar_lane(SynacorVM::snapshot const &start, std::string const &input,
+                std::uint64_t budget) {
+  std::istringstream in(input);
+  std::ostringstream out;
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out, .stdIn = &in};
+  start.restore(vm);
+
+  bool running = true;
+  try {
+    while (running && vm.instruction_count < budget) {
+      running = vm.Step();
+    }
+  } catch (std::exception &e) {
+    out << "\nFATAL ERROR\n" << e.what() << std::endl;
+    running = false;
+  }
+
+  return {
+      .state = SynacorVM::snapshot::take(vm),
+      .output = out.str(),
+      .halted = !running,
+  };
+}
+
+// shared(r7) is the number of instructions the lane with that r7 is expected
+// to run before it is split off.
+template <typename F>
+void test_lockstep(std::string_view test_name, std::uint64_t budget,
+                   F shared) {
+  auto lock = SET_TEST_DIR();
+
+  SynacorVM::snapshot start;
+  start.memory.load(testutils::read_binary(testutils::fixture_path(test_name)));
+  const std::string input = "xyz";
+
+  SynacorVM::lockstep engine(start, input);
+  for (auto l = 0u; l < SynacorVM::lockstep::lanes; ++l) {
+    engine.set_register(l, 7, SynacorVM::Word(l));
+  }
+  const auto got = engine.run(budget);
+  REQUIRE_EQ(got.size(), SynacorVM::lockstep::lanes);
+
+  for (auto l = 0u; l < SynacorVM::lockstep::lanes; ++l) {
+    INFO(std::format("lane {}", l));
+    auto lane_start = start;
+    lane_start.memory[SynacorVM::Word(0x8007)] = SynacorVM::Word(l);
+    const auto want = run_scalar_lane(lane_start, input, budget);
+
+    REQUIRE_EQ(got[l].output, want.output);
+    REQUIRE_EQ(got[l].halted, want.halted);
+    REQUIRE_EQ(got[l].state.instruction_count, want.state.instruction_count);
+    REQUIRE_EQ(got[l].state.memory.dump(), want.state.memory.dump());
+
+    SynacorVM::Memory a, b;
+    SynacorVM::CPU cpu_a{.memory = a}, cpu_b{.memory = b};
+    got[l].state.restore(cpu_a);
+    want.state.restore(cpu_b);
+    REQUIRE_EQ(SynacorVM::checksum(cpu_a), SynacorVM::checksum(cpu_b));
+
+    REQUIRE_EQ(got[l].lockstep_instructions, shared(l));
+  }
+}
+
+TEST_CASE("lockstep") {
+  // The loop runs in lockstep (only the pushed values differ) and the
+  // printed character, 'a' + 3*r7 % 7, splits the lanes: only r7 = 0, 7, 14
+  // print the same as lane 0. Out of those, r7 = 14 branches elsewhere
+  // after returning, and the other two stay together until they halt.
+  SUBCASE("sweep") {
+    test_lockstep("lockstep/sweep", 1000, [](unsigned r7) -> std::uint64_t {
+      switch (r7) {
+      case 0:
+      case 7:
+        return 80;
+      case 14:
+        return 78;
+      default:
+        return 74;
+      }
+    });
+  }
+  SUBCASE("sweep out of budget") {
+    test_lockstep("lockstep/sweep", 30,
+                  [](unsigned) -> std::uint64_t { return 30; });
+  }
+}
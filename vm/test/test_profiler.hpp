@@ -0,0 +1,70 @@
+#pragma once
+
+#include <doctest/doctest.h>
+
+#include <cstdint>
+#include <format>
+#include <sstream>
+#include <string>
+
+#include "lib/control_flow.hpp"
+#include "lib/cpu.hpp"
+#include "lib/memory.hpp"
+#include "lib/profiler.hpp"
+#include "lib/symbols.hpp"
+#include "testutils/utils.hpp"
+
+TEST_CASE("profiler") {
+  auto lock = SET_TEST_DIR();
+  using SynacorVM::Number;
+
+  std::stringstream out;
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out};
+  ram.load(testutils::read_binary(testutils::fixture_path("trace/calls")));
+
+  SynacorVM::control_flow_graph graph(ram);
+  SynacorVM::profiler prof(graph);
+  vm.observers = {&graph, &prof};
+  while (vm.Step()) {
+  }
+
+  // countdown(n) runs 7 instructions per level and 2 at the bottom, and it is
+  // called with 5 and then 3
+  const auto countdown = 0x11u;
+  CHECK_EQ(prof.count(Number(countdown)), 10u);
+  CHECK_EQ(prof.count(Number(0)), 1u);
+
+  const auto fs = prof.functions();
+  REQUIRE_EQ(fs.size(), 2u);
+  CHECK_EQ(fs[0].entry.to_uint(), countdown);
+  CHECK_EQ(fs[0].self, 7u * 8u + 2u * 2u);
+  CHECK_EQ(fs[0].total, fs[0].self);
+  CHECK_EQ(fs[0].calls, 10u);
+
+  CHECK_EQ(fs[1].entry.to_uint(), 0xffffu);
+  CHECK_EQ(fs[1].self, 7u);
+  CHECK_EQ(fs[1].total, vm.instruction_count);
+
+  // Recursion is folded into a single frame
+  std::stringstream folded;
+  prof.write_folded(folded);
+  CHECK_EQ(folded.str(), "start 7\nstart;0x0011 60\n");
+
+  const auto report = prof.report(5);
+  CHECK_NE(report.find(std::format("{:<8} {:>10} {:>10} {:>10}\n", "0x0011",
+                                   60, 60, 10)),
+           std::string::npos);
+  CHECK_NE(report.find(std::format("0x0011 {:>10}\n", 10)), std::string::npos);
+
+  // Symbols name the functions, and give the source of the addresses
+  const auto symbols =
+      SynacorVM::symbol_table::load("testdata/fixtures/trace/calls.sym");
+  std::stringstream named;
+  prof.write_folded(named, symbols);
+  CHECK_EQ(named.str(), "start 7\nstart;countdown 60\n");
+  CHECK_NE(prof.report(5, symbols)
+               .find(std::format("0x0011 {:>10}  countdown at calls.as:10:5\n",
+                                 10)),
+           std::string::npos);
+}
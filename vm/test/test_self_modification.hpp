@@ -0,0 +1,168 @@
+#pragma once
+
+#include <doctest/doctest.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "lib/control_flow.hpp"
+#include "lib/coverage.hpp"
+#include "lib/cpu.hpp"
+#include "lib/memory.hpp"
+#include "lib/native.hpp"
+#include "lib/self_modification.hpp"
+#include "test_control_flow.hpp"
+#include "testutils/utils.hpp"
+
+inline SynacorVM::page_map run_pages(SynacorVM::Memory &ram) {
+  std::stringstream out;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out};
+  SynacorVM::control_flow_graph graph(ram);
+  SynacorVM::self_modification smc(vm, graph);
+  vm.observers = {&graph, &smc};
+  while (vm.Step()) {
+  }
+  return smc.map();
+}
+
+// Static and dynamic classification of the pages
+TEST_CASE("self-modifying code") {
+  using SynacorVM::page_kind;
+  auto lock = SET_TEST_DIR();
+
+  SUBCASE("data") {
+    // wmem 0x1000 5, halt
+    SynacorVM::Memory ram;
+    load_words(ram, {16, 0x1000, 5, 0});
+    SynacorVM::CPU vm{.memory = ram};
+
+    const auto written = SynacorVM::page_map::analyze(vm);
+    REQUIRE(written.has_value());
+    CHECK(written->pages[0x10] == page_kind::DATA);
+    CHECK(written->pages[0] == page_kind::UNWRITTEN);
+
+    const auto ran = run_pages(ram);
+    CHECK(ran.pages == written->pages);
+    CHECK(ran.stable(0));
+    CHECK(ran.stable(0x1000));
+    CHECK_EQ(ran.stable_pages().count(), SynacorVM::Memory::page_count);
+  }
+
+  SUBCASE("code changed after it ran") {
+    // 0: call 7, wmem 7 19, jmp 7
+    // 7: ret, which becomes out 'a', halt
+    SynacorVM::Memory ram;
+    load_words(ram, {17, 7, 16, 7, 19, 6, 7, 18, 'a', 0});
+    SynacorVM::CPU vm{.memory = ram};
+
+    const auto written = SynacorVM::page_map::analyze(vm);
+    REQUIRE(written.has_value());
+    CHECK(written->pages[0] == page_kind::MODIFIED_CODE);
+
+    const auto ran = run_pages(ram);
+    CHECK(ran.pages[0] == page_kind::MODIFIED_CODE);
+    CHECK_FALSE(ran.stable(7));
+    CHECK_EQ(ran.stable_pages().count(), SynacorVM::Memory::page_count - 1);
+  }
+
+  SUBCASE("code written before it runs") {
+    // 0: set r0 6, wmem r0 21, then a halt that becomes a noop, halt
+    SynacorVM::Memory ram;
+    load_words(ram, {1, 0x8000, 6, 16, 0x8000, 21, 0, 0});
+    SynacorVM::CPU vm{.memory = ram};
+
+    // Only running it tells where r0 points
+    CHECK_FALSE(SynacorVM::page_map::analyze(vm).has_value());
+
+    const auto ran = run_pages(ram);
+    CHECK(ran.pages[0] == page_kind::MODIFIED_CODE);
+  }
+
+  SUBCASE("save and merge") {
+    SynacorVM::page_map a;
+    a.pages[1] = page_kind::DATA;
+    a.pages[2] = page_kind::MODIFIED_CODE;
+
+    const std::string file = "pages.txt";
+    a.save(file);
+    auto b = SynacorVM::page_map::load(file);
+    std::remove(file.c_str());
+    CHECK(b.pages == a.pages);
+
+    SynacorVM::page_map c;
+    c.pages[1] = page_kind::MODIFIED_CODE;
+    c.pages[3] = page_kind::DATA;
+    b |= c;
+    CHECK(b.pages[1] == page_kind::MODIFIED_CODE);
+    CHECK(b.pages[2] == page_kind::MODIFIED_CODE);
+    CHECK(b.pages[3] == page_kind::DATA);
+    CHECK(b.pages[4] == page_kind::UNWRITTEN);
+
+    c.image = 1;
+    CHECK_THROWS_AS(b |= c, std::runtime_error);
+  }
+
+  SUBCASE("blocks over several pages") {
+    // A block from page 0 to page 2, written in page 1 only
+    constexpr auto page = SynacorVM::Memory::page_size;
+    SynacorVM::page_map map;
+    map.pages[1] = page_kind::MODIFIED_CODE;
+    CHECK(map.stable(0, page - 1));
+    CHECK_FALSE(map.stable(0, 2 * page));
+
+    const std::vector<std::uint16_t> image(3 * page, 0);
+    const std::vector<SynacorVM::native::block> blocks = {
+        {.first = 0, .end = std::uint16_t(2 * page + 1)}};
+    SynacorVM::native machine(image, blocks);
+    CHECK_FALSE(machine.stale(0, 2 * page));
+    machine.write(page + 1, 21);
+    CHECK(machine.stale(0, 2 * page));
+    CHECK_FALSE(machine.stale(0, page - 1));
+  }
+
+  SUBCASE("trusted pages") {
+    SynacorVM::Memory ram;
+    load_words(ram, {9, 0x8000, 0x8000, 1, 0});
+    SynacorVM::control_flow_graph g(ram);
+    const auto id = g.at(0).id;
+
+    std::bitset<SynacorVM::Memory::page_count> stable;
+    stable.set(0);
+    g.trust(stable);
+    g.on_write(SynacorVM::Word(3));
+    CHECK_EQ(g.at(0).id, id);
+
+    g.trust({});
+    g.on_write(SynacorVM::Word(3));
+    CHECK_NE(g.at(0).id, id);
+  }
+}
+
+// Coverage and the dynamic pass follow the same graph, which the program
+// changes under both of them
+TEST_CASE("shared control flow graph") {
+  using SynacorVM::page_kind;
+
+  // 0: call 7, wmem 7 19, jmp 7
+  // 7: ret, which becomes out 'a', halt
+  SynacorVM::Memory ram;
+  load_words(ram, {17, 7, 16, 7, 19, 6, 7, 18, 'a', 0});
+
+  std::stringstream out;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out};
+  SynacorVM::control_flow_graph graph(ram);
+  SynacorVM::coverage cov(vm, graph);
+  SynacorVM::self_modification smc(vm, graph);
+  vm.observers = {&graph, &cov, &smc};
+  while (vm.Step()) {
+  }
+
+  CHECK_EQ(out.str(), "a");
+  CHECK_EQ(cov.report().covered.count(), 10u);
+  CHECK_EQ(cov.report().blocks.count(), 3u);
+  CHECK(smc.map().pages[0] == page_kind::MODIFIED_CODE);
+}
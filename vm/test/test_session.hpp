@@ -0,0 +1,114 @@
+#pragma once
+
+#include <doctest/doctest.h>
+
+#include <cstdio>
+#include <format>
+#include <fstream>
+#include <ios>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "lib/cpu.hpp"
+#include "lib/memory.hpp"
+#include "lib/session.hpp"
+#include "lib/snapshot.hpp"
+#include "testutils/utils.hpp"
+
+inline SynacorVM::session_log record_session(std::string_view test_name) {
+  std::stringstream in{"This is a message!"};
+  std::stringstream out;
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out, .stdIn = &in};
+  ram.load(testutils::read_binary(testutils::fixture_path(test_name)));
+
+  SynacorVM::session_recorder recorder(vm, 2);
+  recorder.install();
+  recorder.patch(SynacorVM::Word(0x8007), SynacorVM::Word(0x1234));
+  ram[SynacorVM::Word(0x8007)] = SynacorVM::Word(0x1234);
+
+  vm.Run();
+  recorder.finish();
+
+  return recorder.log();
+}
+
+inline void test_replay(std::string_view test_name) {
+  auto lock = SET_TEST_DIR();
+
+  const auto log = record_session(test_name);
+  REQUIRE_FALSE(log.events.empty());
+  REQUIRE(log.events.back().kind == SynacorVM::session_log::event_kind::END);
+
+  // Round trip through a file
+  const auto file = std::string("session.rec");
+  log.save(file);
+  const auto loaded = SynacorVM::session_log::load(file);
+  std::remove(file.c_str());
+  REQUIRE_EQ(loaded.inputs.size(), log.inputs.size());
+  REQUIRE_EQ(loaded.events.size(), log.events.size());
+
+  // Replay with no input stream attached
+  std::stringstream out;
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out, .stdIn = nullptr};
+  ram.load(testutils::read_binary(testutils::fixture_path(test_name)));
+
+  SynacorVM::session_replayer replayer(vm, loaded);
+  REQUIRE_FALSE(replayer.run_until(SynacorVM::session_replayer::forever));
+  REQUIRE_EQ(vm.instruction_count, log.events.back().instruction);
+  REQUIRE_EQ(SynacorVM::checksum(vm), log.events.back().checksum);
+
+  // Going back in time lands on the same state as running forward
+  const auto end = vm.instruction_count;
+  const auto middle = end / 2 + 1;
+
+  SynacorVM::Memory forward_ram;
+  SynacorVM::CPU forward_vm{
+      .memory = forward_ram, .stdOut = &out, .stdIn = nullptr};
+  forward_ram.load(
+      testutils::read_binary(testutils::fixture_path(test_name)));
+  SynacorVM::session_replayer forward(forward_vm, loaded);
+  forward.run_until(middle);
+  REQUIRE_EQ(forward_vm.instruction_count, middle);
+  const auto want = SynacorVM::checksum(forward_vm);
+
+  replayer.seek(middle);
+  REQUIRE_EQ(vm.instruction_count, middle);
+  REQUIRE_EQ(SynacorVM::checksum(vm), want);
+
+  replayer.seek(end);
+  replayer.seek(middle);
+  REQUIRE_EQ(SynacorVM::checksum(vm), want);
+
+  // So does a replayer that keeps only a few of the checkpoints
+  SynacorVM::Memory thin_ram;
+  SynacorVM::CPU thin_vm{.memory = thin_ram, .stdOut = &out, .stdIn = nullptr};
+  thin_ram.load(testutils::read_binary(testutils::fixture_path(test_name)));
+  SynacorVM::session_replayer thin(thin_vm, loaded, 3);
+  REQUIRE_FALSE(thin.run_until(SynacorVM::session_replayer::forever));
+  thin.seek(middle);
+  REQUIRE_EQ(thin_vm.instruction_count, middle);
+  REQUIRE_EQ(SynacorVM::checksum(thin_vm), want);
+}
+
+TEST_CASE("session") {
+  SUBCASE("in") { test_replay("cpu/in"); }
+  SUBCASE("call-ret") { test_replay("cpu/call-ret"); }
+  SUBCASE("rwmem") { test_replay("cpu/rwmem"); }
+}
+
+TEST_CASE("corrupt session log") {
+  auto lock = SET_TEST_DIR();
+
+  // Magic, both checksums, and then a huge number of inputs
+  const std::string file = "corrupt.rec";
+  {
+    std::ofstream f(file, std::ios::binary);
+    f << "SYNREC1\n" << '\x01' << '\x02' << "\xff\xff\xff\xff\x0f";
+  }
+
+  REQUIRE_THROWS_AS(SynacorVM::session_log::load(file), std::runtime_error);
+  std::remove(file.c_str());
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <doctest/doctest.h>
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+
+#include "lib/cpu.hpp"
+#include "lib/memory.hpp"
+#include "lib/snapshot.hpp"
+#include "testutils/utils.hpp"
+
+TEST_CASE("snapshot diff") {
+  auto lock = SET_TEST_DIR();
+  using SynacorVM::Word;
+
+  std::stringstream out;
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out};
+  ram.load(
+      testutils::read_binary(testutils::fixture_path("lockstep/sweep")));
+
+  const auto before = SynacorVM::snapshot::take(vm);
+  for (int i = 0; i < 10; ++i) {
+    REQUIRE(vm.Step());
+  }
+  auto after = SynacorVM::snapshot::take(vm);
+
+  // The first round of the loop wrote r0 to 0x1000 and pushed r1
+  auto d = SynacorVM::snapshot_diff::compare(before, after);
+  CHECK_EQ(d.report(before, after), "ip: 0x0000 -> 0x000b\n"
+                                    "0x1000 (1 word): 0000 -> 0001\n"
+                                    "r0 (1 word): 0000 -> 0002\n"
+                                    "stack size: 0 -> 1\n");
+  CHECK_FALSE(d.empty());
+
+  // Runs go across the blocks compared at once, and long ones are counted
+  for (unsigned i = 0x1e; i < 0x22; ++i) {
+    after.memory[Word(i)] = Word(i);
+  }
+  for (unsigned i = 0x100; i < 0x110; ++i) {
+    after.memory[Word(i)] = Word(1u);
+  }
+  after.memory[Word(0x8007u)] = Word(7u);
+  d = SynacorVM::snapshot_diff::compare(before, after);
+  REQUIRE_EQ(d.memory.size(), 5u);
+  CHECK_EQ(d.memory[0].first, 0x1eu);
+  CHECK_EQ(d.memory[0].count, 4u);
+  CHECK_EQ(d.memory[1].count, 16u);
+  CHECK_NE(d.report(before, after).find("0x0100..0x010f (16 words)\n"),
+           std::string::npos);
+
+  // Files keep the whole state
+  const std::string file = "diff.snap";
+  after.save(file);
+  const auto loaded = SynacorVM::snapshot::load(file);
+  std::remove(file.c_str());
+  CHECK(SynacorVM::snapshot_diff::compare(after, loaded).empty());
+  CHECK_EQ(loaded.instruction_count, 10u);
+  CHECK_EQ(SynacorVM::snapshot_diff::compare(loaded, after).report(loaded,
+                                                                   after),
+           "No differences\n");
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <doctest/doctest.h>
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <ios>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arch/arch.hpp"
+#include "lib/cpu.hpp"
+#include "lib/mapped_file.hpp"
+#include "lib/memory.hpp"
+#include "lib/observer.hpp"
+#include "lib/trace.hpp"
+#include "testutils/utils.hpp"
+
+// Collects what the trace is expected to contain
+struct trace_collector : SynacorVM::observer {
+  struct effect {
+    std::uint32_t ip;
+    bool wrote = false;
+    SynacorVM::Word address = SynacorVM::Word(0);
+    SynacorVM::Word value = SynacorVM::Word(0);
+    std::vector<SynacorVM::Word> pushed = {};
+  };
+  std::vector<effect> effects;
+
+  void on_instruction(SynacorVM::Number ip) override {
+    effects.push_back({.ip = ip.to_uint()});
+  }
+  void on_write(SynacorVM::Word address, SynacorVM::Word,
+                SynacorVM::Word value) override {
+    effects.back().wrote = true;
+    effects.back().address = address;
+    effects.back().value = value;
+  }
+  void on_push(SynacorVM::Word value) override {
+    effects.back().pushed.push_back(value);
+  }
+};
+
+inline void test_trace(std::string_view test_name) {
+  auto lock = SET_TEST_DIR();
+
+  std::stringstream in{"Hello, world!"};
+  std::stringstream out;
+  SynacorVM::Memory ram;
+  SynacorVM::CPU vm{.memory = ram, .stdOut = &out, .stdIn = &in};
+  const auto image = testutils::read_binary(testutils::fixture_path(test_name));
+  ram.load(image);
+
+  // Start mid-run, so that the header must carry the registers
+  const std::string file = "trace.bin";
+  const auto start = 3u;
+  for (auto i = 0u; i < start; ++i) {
+    REQUIRE(vm.Step());
+  }
+  ram[SynacorVM::Word(0x8006)] = SynacorVM::Word(0x1234);
+
+  trace_collector want;
+  {
+    SynacorVM::trace_writer writer(vm, file);
+    vm.observers = {&want, &writer};
+    while (vm.Step()) {
+    }
+  }
+
+  SynacorVM::Memory original;
+  original.load(image);
+
+  SynacorVM::trace_record r;
+  {
+    SynacorVM::mapped_file mapped(file);
+    SynacorVM::trace_reader reader(mapped.bytes());
+    REQUIRE_EQ(reader.first_instruction(), start);
+
+    auto registers = reader.initial_registers();
+    REQUIRE_EQ(registers[6].to_uint(), 0x1234u);
+
+    for (auto const &e : want.effects) {
+      REQUIRE(reader.next(r));
+      REQUIRE_EQ(r.ip.to_uint(), e.ip);
+
+      const auto opcode = original[SynacorVM::Number(e.ip)].to_uint();
+      REQUIRE_EQ(unsigned(r.opcode), opcode);
+      for (auto i = 0; i < arch::argument_count(r.opcode); ++i) {
+        const auto operand = SynacorVM::Number(e.ip + 1 + unsigned(i));
+        REQUIRE_EQ(r.operands[unsigned(i)].to_uint(),
+                   original[operand].to_uint());
+      }
+
+      REQUIRE_EQ(r.wrote, e.wrote);
+      if (e.wrote) {
+        REQUIRE_EQ(r.address.to_uint(), e.address.to_uint());
+        REQUIRE_EQ(r.value.to_uint(), e.value.to_uint());
+        if (r.address.to_uint() >= 0x8000) {
+          registers[r.address.to_uint() - 0x8000] = r.value;
+        }
+      }
+      if (r.opcode == PUSH) {
+        REQUIRE_EQ(e.pushed.size(), 1u);
+        REQUIRE_EQ(r.pushed.to_uint(), e.pushed[0].to_uint());
+      }
+    }
+    REQUIRE_FALSE(reader.next(r));
+    REQUIRE_EQ(r.instruction + 1, vm.instruction_count);
+
+    // The registers can be followed from the trace alone
+    for (auto i = 0u; i < SynacorVM::Memory::register_count; ++i) {
+      REQUIRE_EQ(registers[i].to_uint(),
+                 ram[SynacorVM::Word(0x8000 + i)].to_uint());
+    }
+  }
+  std::remove(file.c_str());
+}
+
+TEST_CASE("trace") {
+  SUBCASE("echo") { test_trace("history/echo"); }
+  SUBCASE("call-ret") { test_trace("cpu/call-ret"); }
+  SUBCASE("rwmem") { test_trace("cpu/rwmem"); }
+}
+
+TEST_CASE("corrupt trace") {
+  std::basic_string<std::byte> bytes;
+  for (char ch : std::string_view("SYNREC1\n")) {
+    bytes.push_back(std::byte(ch));
+  }
+  REQUIRE_THROWS_AS(SynacorVM::trace_reader{bytes}, std::runtime_error);
+
+  // A record that jumps without saying where to: the magic, the instruction
+  // count, the registers and a JMP header
+  bytes[3] = std::byte('T');
+  bytes[4] = std::byte('R');
+  bytes.append(9, std::byte(0));
+  bytes.push_back(std::byte(0x20 | JMP));
+
+  SynacorVM::trace_reader reader(bytes);
+  SynacorVM::trace_record r;
+  REQUIRE_THROWS_AS(reader.next(r), std::runtime_error);
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <doctest/doctest.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "lib/cpu.hpp"
+#include "lib/mapped_file.hpp"
+#include "lib/memory.hpp"
+#include "lib/trace.hpp"
+#include "lib/trace_index.hpp"
+#include "testutils/utils.hpp"
+
+inline void test_trace_index(unsigned threads) {
+  auto lock = SET_TEST_DIR();
+  using SynacorVM::trace_index;
+  using SynacorVM::Word;
+
+  const std::string trace = "calls.trace";
+  const std::string index_file = "calls.trace.idx";
+  {
+    std::stringstream out;
+    SynacorVM::Memory ram;
+    SynacorVM::CPU vm{.memory = ram, .stdOut = &out};
+    ram.load(testutils::read_binary(testutils::fixture_path("trace/calls")));
+
+    // Small sync interval, so that there are several chunks
+    SynacorVM::trace_writer writer(vm, trace, 5);
+    vm.observers = {&writer};
+    while (vm.Step()) {
+    }
+  }
+
+  // Expected answers, from decoding the whole trace
+  std::vector<std::vector<trace_index::write>> writes(
+      trace_index::address_count);
+  std::vector<trace_index::call> calls;
+  std::vector<std::vector<std::uint64_t>> stacks;
+  std::uint64_t size = 0;
+  {
+    SynacorVM::mapped_file mapped(trace);
+    size = mapped.bytes().size();
+    SynacorVM::trace_reader reader(mapped.bytes());
+    REQUIRE_GT(reader.sync_points().size(), threads);
+
+    auto registers = reader.initial_registers();
+    std::vector<std::uint64_t> open;
+    SynacorVM::trace_record r;
+    while (reader.next(r)) {
+      stacks.emplace_back(open.rbegin(), open.rend());
+      if (r.opcode == CALL) {
+        const auto op = r.operands[0].to_uint();
+        calls.push_back({
+            .begin = r.instruction,
+            .end = trace_index::none,
+            .parent = open.empty() ? trace_index::none : open.back(),
+            .target = std::uint16_t(
+                op >= 0x8000 ? registers[op - 0x8000].to_uint() : op),
+            .caller = std::uint16_t(r.ip.to_uint()),
+            .depth = std::uint32_t(open.size()),
+            .registers = {},
+        });
+        open.push_back(calls.size() - 1);
+      } else if (r.opcode == RET && !open.empty()) {
+        calls[open.back()].end = r.instruction;
+        open.pop_back();
+      }
+      if (r.wrote) {
+        writes[r.address.to_uint()].push_back(
+            {.instruction = r.instruction, .value = r.value});
+        if (r.address.to_uint() >= 0x8000) {
+          registers[r.address.to_uint() - 0x8000] = r.value;
+        }
+      }
+    }
+  }
+  REQUIRE_EQ(calls.size(), 10u);
+
+  trace_index::build(trace, index_file, threads);
+  {
+    trace_index index(index_file, size);
+
+    for (auto a : {0x1000u, 0x1001u, 0x8000u, 0x8001u}) {
+      INFO(std::format("address {:04x}", a));
+      const auto got = index.writes(Word(a));
+      REQUIRE_EQ(got.size(), writes[a].size());
+      for (auto i = 0u; i < got.size(); ++i) {
+        REQUIRE_EQ(got[i].instruction, writes[a][i].instruction);
+        REQUIRE_EQ(got[i].value.to_uint(), writes[a][i].value.to_uint());
+      }
+    }
+
+    // The countdown from 5 writes 4, 3, 2, 1, 0 into 0x1001
+    const auto w = index.writes(Word(0x1001));
+    REQUIRE_EQ(w.size(), 8u);
+    const auto before = index.last_write(Word(0x1001), w[2].instruction);
+    REQUIRE(before.has_value());
+    REQUIRE_EQ(before->instruction, w[1].instruction);
+    REQUIRE_EQ(before->value.to_uint(), 3u);
+    REQUIRE_FALSE(index.last_write(Word(0x1001), w[0].instruction));
+    REQUIRE_FALSE(index.last_write(Word(0x2000), 1000));
+
+    REQUIRE_EQ(index.calls().size(), calls.size());
+    for (auto i = 0u; i < calls.size(); ++i) {
+      INFO(std::format("call {}", i));
+      auto const &got = index.calls()[i];
+      REQUIRE_EQ(got.begin, calls[i].begin);
+      REQUIRE_EQ(got.end, calls[i].end);
+      REQUIRE_EQ(got.parent, calls[i].parent);
+      REQUIRE_EQ(got.depth, calls[i].depth);
+      REQUIRE_EQ(got.target, calls[i].target);
+      REQUIRE_EQ(got.caller, calls[i].caller);
+    }
+
+    // Both calls from the top, the second one through a register
+    const auto top = index.calls_to(Word(calls[0].target));
+    REQUIRE_EQ(top.size(), 10u);
+    REQUIRE_EQ(index.calls()[top[0]].registers[0], 5u);
+    REQUIRE_EQ(index.calls()[top[6]].registers[0], 3u);
+    REQUIRE_EQ(index.calls()[top[6]].depth, 0u);
+
+    for (auto i = 0u; i < stacks.size(); ++i) {
+      INFO(std::format("instruction {}", i));
+      REQUIRE(index.stack_at(i) == stacks[i]);
+    }
+  }
+
+  REQUIRE_THROWS_AS(trace_index(index_file, size + 1), std::runtime_error);
+
+  std::remove(trace.c_str());
+  std::remove(index_file.c_str());
+}
+
+TEST_CASE("trace index") {
+  SUBCASE("one thread") { test_trace_index(1); }
+  SUBCASE("three threads") { test_trace_index(3); }
+}
@@ -0,0 +1,3 @@
+spin:
+    add r0 r0 1
+    jmp spin
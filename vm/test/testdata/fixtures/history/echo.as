@@ -0,0 +1,15 @@
+loop:
+    in r0
+    push r0
+    call count
+    pop r1
+    out r1
+    eq r2 r1 '!'
+    jf r2 loop
+halt
+
+count:
+    rmem r3 0x1000
+    add r3 r3 1
+    wmem 0x1000 r3
+    ret
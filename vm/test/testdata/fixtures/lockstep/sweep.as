@@ -0,0 +1,29 @@
+set r0 0
+loop:
+    add r0 r0 1
+    mult r1 r0 r7
+    mod r1 r1 7
+    wmem 0x1000 r0
+    push r1
+    eq r2 r0 10
+    jf r2 loop
+
+pop r5
+call print
+gt r3 r7 7
+jt r3 big
+out 'S'
+halt
+
+big:
+    wmem 0x2000 r7
+    out 'B'
+    in r4
+    out r4
+    halt
+
+print:
+    add r5 r5 'a'
+    out r5
+    out '\n'
+    ret
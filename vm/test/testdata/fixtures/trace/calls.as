@@ -0,0 +1,17 @@
+    set r0 5
+    call countdown
+    wmem 0x1000 r0
+    set r1 countdown
+    set r0 3
+    call r1
+    halt
+
+countdown:
+    jf r0 done
+    push r0
+    add r0 r0 32767
+    wmem 0x1001 r0
+    call countdown
+    pop r0
+done:
+    ret